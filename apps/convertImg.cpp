@@ -1,18 +1,139 @@
 #include "imgio/loadsave.h"
 
 #include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <boost/filesystem.hpp>
 using std::cout;
 using std::endl;
 
+//
+// Load every image in a directory and see how well each codec does on them,
+// in terms of compression ratio and encode / decode speed.
+//
+void Benchmark( std::string dir, std::vector< std::string > codecStrs )
+{
+	if( codecStrs.size() == 0 )
+	{
+		codecStrs = { "none", "snappy", "lz4", "lz4:9", "zstd:1", "zstd:3", "zstd:19" };
+	}
+
+	std::vector< cv::Mat > imgs;
+	size_t rawBytes = 0;
+	boost::filesystem::path p( dir );
+	std::vector< boost::filesystem::path > files;
+	for( auto di = boost::filesystem::directory_iterator(p); di != boost::filesystem::directory_iterator(); ++di )
+	{
+		if( boost::filesystem::is_regular_file( di->path() ) )
+			files.push_back( di->path() );
+	}
+	std::sort( files.begin(), files.end() );
+
+	for( unsigned fc = 0; fc < files.size(); ++fc )
+	{
+		try
+		{
+			cv::Mat img = LoadImage( files[fc].string() );
+			if( img.empty() )
+				continue;
+			if( !img.isContinuous() )
+				img = img.clone();
+			rawBytes += img.total() * img.elemSize();
+			imgs.push_back( img );
+		}
+		catch( std::exception &e )
+		{
+			// not an image, skip it.
+		}
+	}
+
+	if( imgs.size() == 0 )
+	{
+		cout << "No images found in " << dir << endl;
+		return;
+	}
+
+	cout << "Loaded " << imgs.size() << " images, " << rawBytes / (1024.0*1024.0) << " MB uncompressed" << endl;
+	cout << std::setw(12) << "codec" << std::setw(10) << "ratio" << std::setw(14) << "enc MB/s" << std::setw(14) << "dec MB/s" << endl;
+
+	std::vector<char> compressed;
+	std::vector<char> decompressed;
+	for( unsigned cc = 0; cc < codecStrs.size(); ++cc )
+	{
+		ImgCodecOptions opts = ParseImgCodec( codecStrs[cc] );
+		if( !ImgCodecAvailable( opts.codec ) )
+		{
+			cout << std::setw(12) << codecStrs[cc] << "   (not available in this build)" << endl;
+			continue;
+		}
+
+		size_t compBytes = 0;
+		double encTime = 0.0, decTime = 0.0;
+		for( unsigned ic = 0; ic < imgs.size(); ++ic )
+		{
+			cv::Mat &img = imgs[ic];
+			size_t len = img.total() * img.elemSize();
+			decompressed.resize( len );
+
+			// the filters are only for float images.
+			ImgCodecOptions o = opts;
+			if( img.elemSize1() != 4 )
+				o.filter = IMGFILTER_NONE;
+
+			unsigned ch = img.channels();
+			auto t0 = std::chrono::steady_clock::now();
+			size_t s = ImgEncodePayload( o, (char*)img.data, img.rows, img.cols*ch, ch, img.elemSize1(), compressed );
+			auto t1 = std::chrono::steady_clock::now();
+			bool ok = ImgDecodePayload( o.codec, o.filter, compressed.data(), s, decompressed.data(), img.rows, img.cols*ch, ch, img.elemSize1() );
+			auto t2 = std::chrono::steady_clock::now();
+
+			if( !ok || memcmp( decompressed.data(), imgs[ic].data, len ) != 0 )
+			{
+				throw std::runtime_error("Round trip failed for codec " + codecStrs[cc] );
+			}
+
+			compBytes += s;
+			encTime += std::chrono::duration<double>( t1 - t0 ).count();
+			decTime += std::chrono::duration<double>( t2 - t1 ).count();
+		}
+
+		double mb = rawBytes / (1024.0*1024.0);
+		cout << std::setw(12) << codecStrs[cc]
+		     << std::setw(10) << std::setprecision(3) << (double)rawBytes / compBytes
+		     << std::setw(14) << std::setprecision(5) << mb / encTime
+		     << std::setw(14) << std::setprecision(5) << mb / decTime << endl;
+	}
+}
+
 int main( int argc, char* argv[] )
 {
-	if( argc != 3 )
+	if( argc >= 3 && std::string(argv[1]) == "--bench" )
+	{
+		std::vector< std::string > codecs;
+		for( int ac = 3; ac < argc; ++ac )
+			codecs.push_back( argv[ac] );
+		Benchmark( argv[2], codecs );
+		return 0;
+	}
+
+	if( argc != 3 && argc != 4 )
 	{
 		cout << "Convert the format of an image, particularly .floatImg to other formats: " << endl;
-		cout << argv[0] << " <input image> <output image>" << endl;
+		cout << argv[0] << " <input image> <output image> [codec]" << endl;
+		cout << "   codec is used for .charImg / .floatImg: none, snappy (default), lz4[:level], zstd[:level]" << endl;
+		cout << "   optionally followed by a filter for float images: +shuffle or +delta  (e.g. zstd:3+delta)" << endl;
+		cout << endl;
+		cout << "Compare the compression codecs on a directory of images: " << endl;
+		cout << argv[0] << " --bench <directory> [codec] [codec] ..." << endl;
 		return 1;
 	}
 
+	ImgCodecOptions opts;
+	if( argc == 4 )
+	{
+		opts = ParseImgCodec( argv[3] );
+	}
+
 	cv::Mat img, out;
 	img = LoadImage( argv[1] );
 
@@ -32,6 +153,6 @@ int main( int argc, char* argv[] )
 
 
 	}
-	SaveImage( img, argv[2] );
+	SaveImage( img, argv[2], opts );
 	return 0;
 }
@@ -76,59 +76,63 @@ int main( int argc, char *argv[] )
 	
 	
 	
-	// and now it's just back-projection.
-	hVec3D cc = calib.GetCameraCentre();
-	std::vector< hVec3D > pts;
-	std::vector< Eigen::Vector4f > colours;
+	// and now it's just back-projection. Find the pixels with a sensible depth,
+	// then unproject them all in one go.
+	std::vector< cv::Point > pixels;
 	for( unsigned y = 0; y < I.rows; ++y )
 	{
 		for( unsigned x = 0; x < I.cols; ++x )
 		{
 			float &d = D2.at<float>( y, x );
-			
 			if( d > 0.1 && d < 2.5 )
-			{
-				hVec2D pi; pi << x,y,1.0f;
-				
-				hVec3D o; o << 0,0,0,1;
-				
-				// TODO: remove redundant checks
-				
-				hVec3D  r = calib.Unproject( pi );
-				hVec3D p3 = cc + r * d;
-				hVec3D p3c = calib.TransformToCamera( p3 );
-				hVec3D  rc = p3c - o;
-				hVec3D rcn = rc / rc.norm();
-				
-				
-				hVec3D rca  = calib.UnprojectToCamera( pi );
-				hVec3D p3ca =  o + rca * d;
-				hVec3D p3a = calib.TransformToWorld( p3ca );
-				
-				
-				float t = d/rca(2);
-				hVec3D p3cb = o + rca * t;
-				hVec3D p3b = calib.TransformToWorld( p3cb );
-				
-				
-				if( isZmap )
-					p3 = p3b;
-				else
-					p3 = p3a;
-
-				pts.push_back( p3 );
-				
-				if( fixedColour )
-				{
-					colours.push_back( colour );
-				}
-				else
-				{
-					cv::Vec3b &bgr = I.at< cv::Vec3b >( y, x );
-					colour << bgr[2], bgr[1], bgr[0], 1.0f;
-					colours.push_back( colour );
-				}
-			}
+				pixels.push_back( cv::Point(x,y) );
+		}
+	}
+	
+	pointArray2D pis( 2, pixels.size() );
+	for( unsigned pc = 0; pc < pixels.size(); ++pc )
+	{
+		pis(0,pc) = pixels[pc].x;
+		pis(1,pc) = pixels[pc].y;
+	}
+	pointArray3D rcas;
+	calib.UnprojectToCamera( pis, rcas );
+	
+	hVec3D o; o << 0,0,0,1;
+	std::vector< hVec3D > pts;
+	std::vector< Eigen::Vector4f > colours;
+	for( unsigned pc = 0; pc < pixels.size(); ++pc )
+	{
+		int x = pixels[pc].x;
+		int y = pixels[pc].y;
+		float d = D2.at<float>( y, x );
+		
+		hVec3D rca; rca << rcas(0,pc), rcas(1,pc), rcas(2,pc), 0.0f;
+		
+		hVec3D p3;
+		if( isZmap )
+		{
+			float t = d/rca(2);
+			hVec3D p3cb = o + rca * t;
+			p3 = calib.TransformToWorld( p3cb );
+		}
+		else
+		{
+			hVec3D p3ca =  o + rca * d;
+			p3 = calib.TransformToWorld( p3ca );
+		}
+		
+		pts.push_back( p3 );
+		
+		if( fixedColour )
+		{
+			colours.push_back( colour );
+		}
+		else
+		{
+			cv::Vec3b &bgr = I.at< cv::Vec3b >( y, x );
+			colour << bgr[2], bgr[1], bgr[0], 1.0f;
+			colours.push_back( colour );
 		}
 	}
 	
@@ -229,6 +229,25 @@ int main(int argc, char *argv[] )
 	Rendering::RendererFactory::Create( ren, winW, winH, "Ground Plane");
 	ren->Get2dBgCamera()->SetOrthoProjection(0, imgSize, 0, imgSize, -10, 10);
 	
+	// The ground plane points don't change, so project them into every camera once, up front.
+	pointArray3D gpPoints( 3, imgSize * imgSize );
+	for( unsigned rc = 0; rc < imgSize; ++rc )
+	{
+		for( unsigned cc = 0; cc < imgSize; ++cc )
+		{
+			unsigned pc = rc * imgSize + cc;
+			gpPoints(0,pc) = minx + worldSize * (cc/(float)imgSize);
+			gpPoints(1,pc) = miny + worldSize * (rc/(float)imgSize);
+			gpPoints(2,pc) = 0.0f;
+		}
+	}
+	vector< pointArray2D > gpPixels( sources.size() );
+	vector< Eigen::Array<bool, 1, Eigen::Dynamic> > gpInFront( sources.size() );
+	for( unsigned isc = 0; isc < sources.size(); ++isc )
+	{
+		sources[isc]->GetCalibration().Project( gpPoints, gpPixels[isc], &gpInFront[isc] );
+	}
+	
 	bool done = false;
 	while( !done )
 	{
@@ -237,25 +256,22 @@ int main(int argc, char *argv[] )
 		{
 			for( unsigned cc = 0; cc < imgSize; ++cc )
 			{
-				hVec3D wp;
-				wp(0) = minx + worldSize * (cc/(float)imgSize);
-				wp(1) = miny + worldSize * (rc/(float)imgSize);
-				wp(2) = 0.0f;
-				wp(3) = 1.0f;
+				unsigned pc = rc * imgSize + cc;
 				
 				cv::Vec3f &gp = gpImage.at<cv::Vec3f>(rc,cc);
 				float count = 0;
 				for( unsigned isc = 0; isc < sources.size(); ++isc )
 				{
-					hVec2D ip;
-					if( sources[isc]->GetCalibration().Project(wp,ip) )
+					if( gpInFront[isc](pc) )
 					{
+						float ipx = gpPixels[isc](0,pc);
+						float ipy = gpPixels[isc](1,pc);
 						cv::Mat img = sources[isc]->GetCurrent();
-						if( ip(0) > 0 && ip(1) > 0 && ip(1) < img.rows && ip(0) < img.cols )
+						if( ipx > 0 && ipy > 0 && ipy < img.rows && ipx < img.cols )
 						{
-							gp[0] += img.at< cv::Vec3b >( ip(1), ip(0) )[0] / 255.0f;
-							gp[1] += img.at< cv::Vec3b >( ip(1), ip(0) )[1] / 255.0f;
-							gp[2] += img.at< cv::Vec3b >( ip(1), ip(0) )[2] / 255.0f;
+							gp[0] += img.at< cv::Vec3b >( ipy, ipx )[0] / 255.0f;
+							gp[1] += img.at< cv::Vec3b >( ipy, ipx )[1] / 255.0f;
+							gp[2] += img.at< cv::Vec3b >( ipy, ipx )[2] / 255.0f;
 							count += 1;
 						}
 					}
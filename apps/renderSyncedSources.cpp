@@ -7,6 +7,7 @@ using std::endl;
 using std::vector;
 
 #include "imgio/sourceFactory.h"
+#include "imgio/cachedSource.h"
 #include "calib/camNetworkCalib.h"
 
 #include "renderer2/basicRenderer.h"
@@ -90,6 +91,11 @@ int main(int argc, char* argv[])
 	// as such, we need a slightly different process if we use video sources.
 	bool isVideoSources = false;
 	std::vector< std::shared_ptr<ImageSource> > sources;
+	
+	// we scrub back and forth a lot here, so wrap each source in a frame cache,
+	// sharing a total budget of ~4GB between the sources.
+	size_t cacheBytes = (4ul * 1024 * 1024 * 1024) / (argc-1);
+	PrepareSources( std::vector< std::string >( argv + 1, argv + argc ) );
 	for( unsigned ac = 1; ac < argc; ++ac )
 	{
 		// Let the factory make the source, but we'll do some extra work to see if there are 
@@ -99,12 +105,12 @@ int main(int argc, char* argv[])
 		if( boost::filesystem::exists( cfn ) )
 		{
 			auto sp = CreateSource( argv[ac], cfn );
-			sources.push_back( sp.source );
+			sources.push_back( std::make_shared< CachedSource >( sp.source, cacheBytes ) );
 		}
 		else
 		{
 			auto sp = CreateSource( argv[ac] );
-			sources.push_back( sp.source );
+			sources.push_back( std::make_shared< CachedSource >( sp.source, cacheBytes ) );
 		}
 		
 		
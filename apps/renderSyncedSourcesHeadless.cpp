@@ -7,8 +7,10 @@ using std::endl;
 using std::vector;
 
 #include "imgio/sourceFactory.h"
+#include "imgio/syncedSourceGroup.h"
 #include "imgio/imagesource.h"
 #include "imgio/vidsrc.h"
+#include "imgio/asyncImageSaver.h"
 #include "calib/camNetworkCalib.h"
 
 #include "renderer2/basicHeadlessRenderer.h"
@@ -58,6 +60,7 @@ int main(int argc, char* argv[])
 	// as such, we need a slightly different process if we use video sources.
 	bool isVideoSources = false;
 	std::vector< std::shared_ptr<ImageSource> > sources;
+	PrepareSources( std::vector< std::string >( argv + 2, argv + argc ) );
 	for( unsigned ac = 2; ac < argc; ++ac )
 	{
 		// Let the factory make the source, but we'll do some extra work to see if there are 
@@ -198,14 +201,21 @@ int main(int argc, char* argv[])
 	}
 	
 	
+	// step all the sources in parallel.
+	SyncedSourceGroup group( sources );
+	
+	// compress and write the output frames in the background.
+	AsyncImageSaver saver;
+	
 	unsigned ic = 0;
 	bool done = false;
 	while( ic < minFrames && !done )
 	{
+		SyncedFrameSet frames = group.GetCurrent();
 		for( unsigned isc = 0; isc < sources.size(); ++isc )
 		{
-			cv::Mat img = sources[isc]->GetCurrent();
-			if( grids.size() > 0 && grids[isc].size() > 0 && grids[isc][ic].size() > 0 )
+			cv::Mat img = frames.images[isc];
+			if( frames.valid[isc] && grids.size() > 0 && grids[isc].size() > 0 && grids[isc][ic].size() > 0 )
 			{
 				float mx, Mx, my, My;
 				mx = my = std::max( img.rows, img.cols );
@@ -248,15 +258,13 @@ int main(int argc, char* argv[])
 		grab = renderer->Capture();
 		std::stringstream ss;
 		ss << outputDir << "/"  << std::setw(6) << std::setfill('0') << ic << ".jpg";
-		SaveImage( grab, ss.str() );
+		saver.Save( grab, ss.str() );
 		
 		++ic;
-		for( unsigned isc = 0; isc < sources.size(); ++isc )
-		{
-			sources[isc]->Advance();
-		}
+		group.Advance();
 		
 		cout << ic << endl;
 	}
-
+	
+	saver.Flush();
 }
@@ -1,5 +1,7 @@
 #include "imgio/vidWriter.h"
 #include "imgio/sourceFactory.h"
+#include "imgio/segmentedEncode.h"
+#include "imgio/streamCut.h"
 
 #include "libconfig.h++"
 
@@ -21,8 +23,46 @@ struct SCut
 	int end;
 };
 
-int main(int argc, char* argv[])
+// <dataRoot>/<testRoot>/<cut name>/<video file name>, making the directory if needed.
+std::string CutFilename( std::string dataRoot, std::string testRoot, std::string cutName, std::string vidFile )
 {
+	int a = vidFile.rfind("/");
+	std::stringstream oss;
+	oss << dataRoot << testRoot << cutName;
+	
+	std::string od = oss.str();
+	if( !boost::filesystem::exists(od) )
+		boost::filesystem::create_directories(od);
+	
+	oss << "/" << std::string( vidFile.begin() + a + 1, vidFile.end() );
+	return oss.str();
+}
+
+int main(int in_argc, char* in_argv[])
+{
+	// pull out the optional --segments <K> and --copy before looking at the other arguments.
+	unsigned numSegments = 0;
+	bool streamCopy = false;
+	std::vector< char* > args;
+	for( int ac = 0; ac < in_argc; ++ac )
+	{
+		if( std::string( in_argv[ac] ) == "--copy" )
+		{
+			streamCopy = true;
+			continue;
+		}
+		if( std::string( in_argv[ac] ) == "--segments" && ac + 1 < in_argc )
+		{
+			numSegments = atoi( in_argv[++ac] );
+			if( numSegments == 0 )
+				numSegments = DefaultNumSegments();
+			continue;
+		}
+		args.push_back( in_argv[ac] );
+	}
+	int argc = args.size();
+	char **argv = args.data();
+	
 	if( argc != 2 && argc != 3 && argc != 6 )
 	{
 		cout << "Cut video into sequences based on frame numbers or timecode. " << endl;
@@ -48,6 +88,15 @@ int main(int argc, char* argv[])
 		cout << "\t  - yuv420p: safe, works in all video players, lowers colour resolution" << endl;
 		cout << "\t  - yuv444p: better colour resolution, but video players tend to not like it" << endl;
 		cout << "\t  - rgb8   : try if you want, tends to be inferior for lossy compression" << endl;
+		cout << endl;
+		cout << "\t - Segmented: " << endl;
+		cout << "\t  add --segments <K> to either of the above to encode K parts of each cut at the same time" << endl;
+		cout << "\t  with K ffmpeg processes, then join them without re-encoding. 0 picks K for this machine." << endl;
+		cout << endl;
+		cout << "\t - Stream copy: " << endl;
+		cout << "\t  add --copy to copy whole GOPs of H.264/H.265 videos as they are, and only encode the" << endl;
+		cout << "\t  frames between each cut point and the nearest keyframe (with the source's codec and the given crf)." << endl;
+		cout << "\t  Videos that can't be cut like this are re-encoded as usual." << endl;
 		cout << endl << endl;
 		cout << "\t - cutFile help:" << endl;
 		cout << "\t  " << argv[0] << " help " << endl;
@@ -147,27 +196,49 @@ int main(int argc, char* argv[])
 		cout << vidFiles[vc] << endl;
 		std::stringstream vss;
 		vss << dataRoot << testRoot << vidFiles[vc];
-		auto sp = CreateSource( vidFiles[vc] );
-		auto src = sp.source;
+		// only made if we need to decode the whole cut.
+		std::shared_ptr< ImageSource > src;
 		
 		for( unsigned curCut = 0; curCut < cuts.size(); ++curCut )
 		{
 			cout << "\t" << cuts[curCut].name << endl;
+			if( streamCopy )
+			{
+				std::string of = CutFilename( dataRoot, testRoot, cuts[ curCut ].name, vidFiles[vc] );
+				if( StreamCopyCut( vidFiles[vc], cuts[ curCut ].start + offsets[vc], cuts[ curCut ].end + offsets[vc], of, fps, ocrf ) )
+					continue;
+			}
+			
+			if( numSegments > 1 )
+			{
+				std::string of = CutFilename( dataRoot, testRoot, cuts[ curCut ].name, vidFiles[vc] );
+				
+				// every segment of the cut reads from its own source and has its own ffmpeg.
+				std::string vf = vidFiles[vc];
+				auto makeSource = [vf](){ return CreateSource( vf ).source; };
+				auto makeWriter = [&]( std::string filename, cv::Mat typical )
+				{
+					return std::make_shared< VidWriter >( filename, ocdc, typical, fps, ocrf, ofmt );
+				};
+				
+				// one segment (e.g. the video can't be indexed) is just the usual way.
+				std::vector< unsigned > boundaries = SplitFrameRange( cuts[ curCut ].start + offsets[vc], cuts[ curCut ].end + offsets[vc], numSegments, vf );
+				if( boundaries.size() > 2 )
+				{
+					SegmentedEncode( makeSource, makeWriter, boundaries, of );
+					continue;
+				}
+			}
+			
+			if( !src )
+				src = CreateSource( vidFiles[vc] ).source;
+			
 			cout << "\t advancing to first frame of cut..." << cuts[ curCut ].start + offsets[vc] << "( " << cuts[ curCut ].start << " + " << offsets[vc] << ")" << endl;
 			while( src->GetCurrentFrameID() < (cuts[ curCut ].start + offsets[vc]) )
 			{
 				src->Advance();
 			}
-			int a = vidFiles[vc].rfind("/");
-			std::stringstream oss;
-			oss << dataRoot << testRoot << cuts[ curCut ].name;
-			
-			std::string od = oss.str();
-			if( !boost::filesystem::exists(od) )
-				boost::filesystem::create_directories(od);
-			
-			oss << "/" << std::string( vidFiles[vc].begin() + a + 1, vidFiles[vc].end() );
-			std::string of = oss.str();
+			std::string of = CutFilename( dataRoot, testRoot, cuts[ curCut ].name, vidFiles[vc] );
 			
 			std::shared_ptr< VidWriter > vo;
 			vo.reset( new VidWriter( of, ocdc, src->GetCurrent(), fps, ocrf, ofmt ) );
@@ -1,12 +1,30 @@
 #include "imgio/vidWriter.h"
 #include "imgio/sourceFactory.h"
+#include "imgio/segmentedEncode.h"
 
 #include <iostream>
 using std::cout;
 using std::endl;
 
-int main(int argc, char* argv[])
+int main(int in_argc, char* in_argv[])
 {
+	// pull out the optional --segments <K> before looking at the other arguments.
+	unsigned numSegments = 0;
+	std::vector< char* > args;
+	for( int ac = 0; ac < in_argc; ++ac )
+	{
+		if( std::string( in_argv[ac] ) == "--segments" && ac + 1 < in_argc )
+		{
+			numSegments = atoi( in_argv[++ac] );
+			if( numSegments == 0 )
+				numSegments = DefaultNumSegments();
+			continue;
+		}
+		args.push_back( in_argv[ac] );
+	}
+	int argc = args.size();
+	char **argv = args.data();
+	
 	if( argc != 4 && argc != 5 && argc != 7 )
 	{
 		cout << "Convert image directory to video: " << endl;
@@ -38,6 +56,10 @@ int main(int argc, char* argv[])
 		cout << "\t  set the <encoder string> and it will be passed verbatim to ffmpeg" << endl;
 		cout << "\t  make sure <encoder string> is enclosed in quotes \" . \" to pass as a single argument" << endl;
 		cout << endl;
+		cout << "\t - Segmented: " << endl;
+		cout << "\t  add --segments <K> to any of the above to encode K parts of the video at the same time" << endl;
+		cout << "\t  with K ffmpeg processes, then join them without re-encoding. 0 picks K for this machine." << endl;
+		cout << endl;
 		exit(0);
 	}
 	
@@ -48,68 +70,63 @@ int main(int argc, char* argv[])
 	auto src = sp.source;
 	int fps = atoi(argv[3]);
 	
-	std::shared_ptr< VidWriter > vo;
-	cv::Mat tmp = src->GetCurrent();
-	if( tmp.cols % 2 != 0 )
-	{
-		tmp = cv::Mat( tmp.rows, tmp.cols + 1, tmp.type() );
-	}
-	if( tmp.rows % 2 != 0 )
-	{
-		tmp = cv::Mat( tmp.rows+1, tmp.cols, tmp.type() );
-	}
-	if( argc == 4 )
-	{
-		vo.reset( new VidWriter( argv[2], "h265", tmp, atoi( argv[3] ), 18, "yuv420p" ) );
-	}
-	else if( argc == 7 )
-	{
-		vo.reset( new VidWriter( argv[2], argv[4], tmp, atoi( argv[3] ), atoi( argv[6] ), argv[5] ) );
-	}
-	else if( argc == 5 )
-	{
-		vo.reset( new VidWriter( argv[2], argv[4], tmp, atoi( argv[3] ) ) );
-	}
-	
-	do
+	// the writer converts float images to 8 bit and pads odd sized images
+	// on its own thread, so we just hand it whatever the source gives us.
+	auto makeWriter = [&]( std::string filename, cv::Mat typical )
 	{
-		cv::Mat tmp0 = src->GetCurrent();
-		cv::Mat tmp1;
-		if( tmp0.type() == CV_32FC3 )
+		std::shared_ptr< VidWriter > vo;
+		if( argc == 4 )
 		{
-			tmp0.convertTo( tmp1, CV_8UC3, 255.0f );
+			vo.reset( new VidWriter( filename, "h265", typical, fps, 18, "yuv420p" ) );
 		}
-		else if( tmp0.type() == CV_32FC1 )
+		else if( argc == 7 )
 		{
-			tmp0.convertTo( tmp1, CV_8UC1, 255.0f );
+			vo.reset( new VidWriter( filename, argv[4], typical, fps, atoi( argv[6] ), argv[5] ) );
 		}
-		else if( tmp0.type() == CV_8UC1 || tmp0.type() == CV_8UC3 )
+		else if( argc == 5 )
 		{
-			tmp1 = tmp0;
+			vo.reset( new VidWriter( filename, argv[4], typical, fps ) );
 		}
-		else
+		return vo;
+	};
+	
+	if( numSegments > 1 )
+	{
+		if( src->GetNumImages() <= 0 )
 		{
-			cout << "Image source provided images in a format we can't send to video" << endl;
-			exit(0);
+			cout << "Need to know how many frames the source has to split it into segments." << endl;
+			exit(1);
 		}
 		
-		if( tmp1.cols % 2 != 0 )
-		{
-			cv::Mat tmp2( tmp1.rows, tmp1.cols+1, tmp1.type(), cv::Scalar(0,0,0) );
-			tmp1.copyTo( tmp2( cv::Rect( 0,0, tmp1.cols, tmp1.rows ) ) );
-			tmp1 = tmp2;
-		}
+		// each segment reads from its own source.
+		std::string input = argv[1];
+		auto makeSource = [input](){ return CreateSource( input ).source; };
 		
-		if( tmp1.rows % 2 != 0 )
+		// we want all of the source, whatever frame it opened on.
+		std::vector< unsigned > boundaries = SplitFrameRange( 0, src->GetNumImages(), numSegments, input );
+		if( boundaries.size() > 2 )
 		{
-			cv::Mat tmp2( tmp1.rows + 1, tmp1.cols, tmp1.type(), cv::Scalar(0,0,0) );
-			tmp1.copyTo( tmp2( cv::Rect( 0,0, tmp1.cols, tmp1.rows ) ) );
-			tmp1 = tmp2;
+			src.reset();
+			SegmentedEncode( makeSource, makeWriter, boundaries, argv[2] );
+			return 0;
 		}
 		
-		vo->Write( tmp1 );
+		// only one segment, so no different from the usual way.
+		if( src->GetCurrentFrameID() != 0 )
+			src->JumpToFrame( 0 );
 	}
-	while( src->Advance() );
 	
+	std::shared_ptr< VidWriter > vo = makeWriter( argv[2], src->GetCurrent() );
+	
+	do
+	{
+		vo->Write( src->GetCurrent() );
+	}
+	while( src->Advance() );
 	
+	vo->Flush();
+	VidWriterStats stats = vo->GetStats();
+	cout << "wrote " << stats.written << " frames in " << stats.elapsed << "s (" << stats.written / stats.elapsed << " fps)" << endl;
+	cout << "waited " << stats.stallSeconds << "s for the encoder (" << stats.stalls << " times), "
+	     << "peak backlog " << stats.maxQueued << " frames." << endl;
 }
@@ -120,6 +120,28 @@ def FindSnappy(env):
 	# Snappy to get some speed-prioritised compression.
 	env.Append(LIBS=["snappy"])
 
+def FindCompressors(env):
+	# LZ4 and zstd are optional extra codecs for the .charImg and .floatImg
+	# formats. If they're not there, we just have snappy.
+	conf = Configure(env)
+	if conf.CheckLibWithHeader('lz4', 'lz4.h', 'c'):
+		env.Append(CPPFLAGS=['-DHAVE_LZ4'])
+	if conf.CheckLibWithHeader('zstd', 'zstd.h', 'c'):
+		env.Append(CPPFLAGS=['-DHAVE_ZSTD'])
+	env = conf.Finish()
+
+def FindImageDecoders(env):
+	# LoadImage decodes JPEG, PNG and TIFF directly with these libraries
+	# when it can, which is a lot faster than going through Magick.
+	conf = Configure(env)
+	if conf.CheckLibWithHeader('jpeg', ['stdio.h', 'jpeglib.h'], 'c'):
+		env.Append(CPPFLAGS=['-DHAVE_LIBJPEG'])
+	if conf.CheckLibWithHeader('png', 'png.h', 'c'):
+		env.Append(CPPFLAGS=['-DHAVE_LIBPNG'])
+	if conf.CheckLibWithHeader('tiff', 'tiffio.h', 'c'):
+		env.Append(CPPFLAGS=['-DHAVE_LIBTIFF'])
+	env = conf.Finish()
+
 def FindCeres(env):
 	# We use Ceres for our bundle adjust solver, which in turn requires
 	# some google libs.
@@ -149,7 +171,9 @@ def SetCoreConfig(env):
 	FindEigen(env)
 	FindBoost(env)
 	FindMagick(env)
+	FindImageDecoders(env)
 	FindLibConfig(env)
 	FindSnappy(env)
+	FindCompressors(env)
 	FindCeres(env)
 	FindHDF5(env)
@@ -85,33 +85,37 @@ hVec3D Calibration::Unproject(const hVec2D &in) const
 	return rw;
 }
 
-cv::Mat Calibration::Undistort( const cv::Mat img ) const
+std::shared_ptr< const Calibration::UndistortMaps > Calibration::GetUndistortMaps( cv::Size size ) const
 {
-	// K as opencv matrix
+	// several threads might be undistorting with the same calibration.
+	std::shared_ptr< const UndistortMaps > maps = std::atomic_load( &undistortMaps );
+	if( maps && maps->size == size && maps->K == K && maps->distParams == distParams )
+		return maps;
+	
+	std::shared_ptr< UndistortMaps > m( new UndistortMaps );
+	m->K          = K;
+	m->distParams = distParams;
+	m->size       = size;
 	cv::Mat cvK = KtoMat();
+	cv::initUndistortRectifyMap( cvK, distParams, cv::Mat(), cvK, size, CV_16SC2, m->map1, m->map2 );
 	
-	cv::Mat res = cv::Mat( img.rows, img.cols, img.type(), cv::Scalar(0) );
-	if( res.data == img.data )	// how could this possibly happen?
-	{
-		res.data = new uchar[ img.rows * img.cols * img.channels() ];
-	}
-	if( res.data == img.data )
-	{
-		cout << "wtf? Not possible!" << endl;
-	}
-	cv::undistort(img, res, cvK, distParams );
+	maps = m;
+	std::atomic_store( &undistortMaps, maps );
+	return maps;
+}
+
+cv::Mat Calibration::Undistort( const cv::Mat img ) const
+{
+	cv::Mat res;
+	Undistort( img, res );
 	return res;
 }
 
-void Calibration::Undistort( const cv::Mat img, cv::Mat &res )
+void Calibration::Undistort( const cv::Mat img, cv::Mat &res ) const
 {
-	// K as opencv matrix
-	cv::Mat cvK = KtoMat();
-	
-	if( res.rows != img.rows || res.cols != img.cols || res.type() != img.type() )
-		res = cv::Mat( img.rows, img.cols, img.type(), cv::Scalar(0) );
-	assert( res.data != img.data );
-	cv::undistort(img, res, cvK, distParams );
+	assert( res.empty() || res.data != img.data );
+	std::shared_ptr< const UndistortMaps > maps = GetUndistortMaps( img.size() );
+	cv::remap( img, res, maps->map1, maps->map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT );
 }
 
 
@@ -199,6 +203,194 @@ hVec2D Calibration::UndistortPoint(const hVec2D &in) const
 
 
 
+//
+// Batched projection. We work through the points in chunks that are small enough to stay
+// in cache, with fixed maximum size arrays so there is no allocation, and Eigen vectorises
+// the arithmetic along each chunk.
+//
+namespace
+{
+	const int batchChunk       = 1024;
+	const int batchParallelMin = 16 * 1024;
+	typedef Eigen::Array< float, 1, Eigen::Dynamic, Eigen::RowMajor, 1, batchChunk > chunkArray;
+	
+	// call f( start, count ) for each chunk of n points, from many threads if it is worth it.
+	template< typename F >
+	void ForEachChunk( int n, F f )
+	{
+		int numChunks = ( n + batchChunk - 1 ) / batchChunk;
+		#pragma omp parallel for schedule(static) if( n >= batchParallelMin )
+		for( int cc = 0; cc < numChunks; ++cc )
+		{
+			int s = cc * batchChunk;
+			f( s, std::min( batchChunk, n - s ) );
+		}
+	}
+	
+	// the same sums as Calibration::Distort(), on normalised coordinates, in place.
+	void DistortChunk( const std::vector<float> &k, chunkArray &x, chunkArray &y )
+	{
+		chunkArray r2 = x*x + y*y;
+		chunkArray v  = 1.0f + r2 * ( k[0] + r2 * ( k[1] + r2 * k[4] ) );
+		chunkArray xy = x*y;
+		chunkArray dx = 2.0f*k[2]*xy + k[3]*( r2 + 2.0f*x*x );
+		chunkArray dy = k[2]*( r2 + 2.0f*y*y ) + 2.0f*k[3]*xy;
+		x = v*x + dx;
+		y = v*y + dy;
+	}
+	
+	// ... and Calibration::Undistort().
+	void UndistortChunk( const std::vector<float> &k, chunkArray &x, chunkArray &y )
+	{
+		chunkArray gx = x;
+		chunkArray gy = y;
+		for( unsigned c = 0; c < 20; ++c )
+		{
+			chunkArray r2 = gx*gx + gy*gy;
+			chunkArray v  = 1.0f + r2 * ( k[0] + r2 * ( k[1] + r2 * k[4] ) );
+			chunkArray xy = gx*gy;
+			chunkArray dx = 2.0f*k[2]*xy + k[3]*( r2 + 2.0f*gx*gx );
+			chunkArray dy = k[2]*( r2 + 2.0f*gy*gy ) + 2.0f*k[3]*xy;
+			gx = ( x - dx ) / v;
+			gy = ( y - dy ) / v;
+		}
+		x = gx;
+		y = gy;
+	}
+	
+	// normalised coordinates to pixels.
+	void ToPixels( const transMatrix2D &K, const chunkArray &x, const chunkArray &y, pointArray2D &out, int s, int c )
+	{
+		out.row(0).segment(s,c).array() = K(0,0)*x + K(0,1)*y + K(0,2);
+		out.row(1).segment(s,c).array() = K(1,0)*x + K(1,1)*y + K(1,2);
+	}
+	
+	// pixels to distorted normalised coordinates.
+	void FromPixels( const transMatrix2D &Ki, const pointArray2D &in, int s, int c, chunkArray &x, chunkArray &y )
+	{
+		chunkArray u = in.row(0).segment(s,c).array();
+		chunkArray v = in.row(1).segment(s,c).array();
+		x = Ki(0,0)*u + Ki(0,1)*v + Ki(0,2);
+		y = Ki(1,0)*u + Ki(1,1)*v + Ki(1,2);
+	}
+}
+
+void Calibration::Project( const pointArray3D &in, pointArray2D &out, Eigen::Array<bool, 1, Eigen::Dynamic> *inFront ) const
+{
+	int n = in.cols();
+	out.resize( 2, n );
+	if( inFront )
+		inFront->resize( n );
+	
+	ForEachChunk( n, [&]( int s, int c )
+	{
+		chunkArray x = in.row(0).segment(s,c).array();
+		chunkArray y = in.row(1).segment(s,c).array();
+		chunkArray z = in.row(2).segment(s,c).array();
+		
+		chunkArray xc = L(0,0)*x + L(0,1)*y + L(0,2)*z + L(0,3);
+		chunkArray yc = L(1,0)*x + L(1,1)*y + L(1,2)*z + L(1,3);
+		chunkArray zc = L(2,0)*x + L(2,1)*y + L(2,2)*z + L(2,3);
+		if( inFront )
+			inFront->segment(s,c) = zc > 0.0f;
+		
+		x = xc / zc;
+		y = yc / zc;
+		DistortChunk( distParams, x, y );
+		ToPixels( K, x, y, out, s, c );
+	});
+}
+
+void Calibration::ProjectFromCamera( const pointArray3D &in, pointArray2D &out ) const
+{
+	int n = in.cols();
+	out.resize( 2, n );
+	
+	ForEachChunk( n, [&]( int s, int c )
+	{
+		chunkArray z = in.row(2).segment(s,c).array();
+		chunkArray x = in.row(0).segment(s,c).array() / z;
+		chunkArray y = in.row(1).segment(s,c).array() / z;
+		DistortChunk( distParams, x, y );
+		ToPixels( K, x, y, out, s, c );
+	});
+}
+
+void Calibration::UnprojectToCamera( const pointArray2D &in, pointArray3D &rays ) const
+{
+	int n = in.cols();
+	rays.resize( 3, n );
+	transMatrix2D Ki = K.inverse();
+	
+	ForEachChunk( n, [&]( int s, int c )
+	{
+		chunkArray x, y;
+		FromPixels( Ki, in, s, c, x, y );
+		UndistortChunk( distParams, x, y );
+		
+		chunkArray l = ( x*x + y*y + 1.0f ).sqrt();
+		rays.row(0).segment(s,c).array() = x / l;
+		rays.row(1).segment(s,c).array() = y / l;
+		rays.row(2).segment(s,c).array() = 1.0f / l;
+	});
+}
+
+void Calibration::Unproject( const pointArray2D &in, pointArray3D &rays ) const
+{
+	int n = in.cols();
+	rays.resize( 3, n );
+	transMatrix2D Ki = K.inverse();
+	transMatrix3D Li = L.inverse();
+	
+	ForEachChunk( n, [&]( int s, int c )
+	{
+		chunkArray x, y;
+		FromPixels( Ki, in, s, c, x, y );
+		UndistortChunk( distParams, x, y );
+		
+		// rays are directions, so only rotate.
+		chunkArray xw = Li(0,0)*x + Li(0,1)*y + Li(0,2);
+		chunkArray yw = Li(1,0)*x + Li(1,1)*y + Li(1,2);
+		chunkArray zw = Li(2,0)*x + Li(2,1)*y + Li(2,2);
+		chunkArray l = ( xw*xw + yw*yw + zw*zw ).sqrt();
+		rays.row(0).segment(s,c).array() = xw / l;
+		rays.row(1).segment(s,c).array() = yw / l;
+		rays.row(2).segment(s,c).array() = zw / l;
+	});
+}
+
+void Calibration::DistortPoints( const pointArray2D &in, pointArray2D &out ) const
+{
+	int n = in.cols();
+	out.resize( 2, n );
+	transMatrix2D Ki = K.inverse();
+	
+	ForEachChunk( n, [&]( int s, int c )
+	{
+		chunkArray x, y;
+		FromPixels( Ki, in, s, c, x, y );
+		DistortChunk( distParams, x, y );
+		ToPixels( K, x, y, out, s, c );
+	});
+}
+
+void Calibration::UndistortPoints( const pointArray2D &in, pointArray2D &out ) const
+{
+	int n = in.cols();
+	out.resize( 2, n );
+	transMatrix2D Ki = K.inverse();
+	
+	ForEachChunk( n, [&]( int s, int c )
+	{
+		chunkArray x, y;
+		FromPixels( Ki, in, s, c, x, y );
+		UndistortChunk( distParams, x, y );
+		ToPixels( K, x, y, out, s, c );
+	});
+}
+
+
+
 bool Calibration::Read( std::string filename )
 {
 	boost::filesystem::path p(filename);
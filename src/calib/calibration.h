@@ -6,6 +6,7 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <memory>
 using std::endl;
 
 class Calibration
@@ -17,6 +18,8 @@ public:
 		distParams.assign(5,0);
 		K = transMatrix2D::Zero();
 		L = transMatrix3D::Zero();
+		width  = 0;
+		height = 0;
 	}
 
 	transMatrix2D K;
@@ -36,6 +39,20 @@ public:
 	hVec3D Unproject(const hVec2D &in) const;
 	hVec3D UnprojectToCamera(const hVec2D &in) const;	// unproject, but only to camera coords.
 	
+	//
+	// Batched versions of the above for when there are a lot of points, e.g. one per pixel.
+	// World/camera points are 3xN, pixels are 2xN, and rays are unit length directions.
+	// Each batch only works out L^-1 and K^-1 once, and big batches are shared out over
+	// OpenMP threads. If inFront is given, it says which points were in front of the camera
+	// (the others are still projected, as with Project(in)).
+	//
+	void Project( const pointArray3D &in, pointArray2D &out, Eigen::Array<bool, 1, Eigen::Dynamic> *inFront = NULL ) const;
+	void ProjectFromCamera( const pointArray3D &in, pointArray2D &out ) const;
+	void Unproject( const pointArray2D &in, pointArray3D &rays ) const;
+	void UnprojectToCamera( const pointArray2D &in, pointArray3D &rays ) const;
+	void DistortPoints( const pointArray2D &in, pointArray2D &out ) const;
+	void UndistortPoints( const pointArray2D &in, pointArray2D &out ) const;
+	
 	// rescale the translation. Useful if we have calibrated in mm but need metres, for example.
 	void Rescale( float scale )
 	{
@@ -70,6 +87,7 @@ public:
 		// and remember new size
 		width  = nwidth1;
 		height = nheight1;
+		undistortMaps.reset();
 	}
 	
 	void RescaleImage( int nWidth, int nHeight )
@@ -89,6 +107,19 @@ public:
 		// and remember new size
 		width  = nWidth;
 		height = nHeight;
+		undistortMaps.reset();
+	}
+	
+	// if we only have a region of the image, the principal point moves
+	// but the focal length does not.
+	void CropImage( int x, int y, int nWidth, int nHeight )
+	{
+		K(0,2) -= x;
+		K(1,2) -= y;
+		
+		width  = nWidth;
+		height = nHeight;
+		undistortMaps.reset();
 	}
 	
 
@@ -102,15 +133,29 @@ public:
 private:
 	hVec2D Distort(const hVec2D &in) const;
 	hVec2D Undistort(const hVec2D &in) const;
+	
+	// Building the undistortion maps costs far more than using them, so we keep the
+	// last ones we made, along with what they were made from. As K and distParams can
+	// be changed directly, we check they still match every time we use the maps.
+	struct UndistortMaps
+	{
+		transMatrix2D K;
+		std::vector<float> distParams;
+		cv::Size size;
+		cv::Mat map1, map2;	// fixed point, CV_16SC2 and CV_16UC1
+	};
+	mutable std::shared_ptr< const UndistortMaps > undistortMaps;
+	std::shared_ptr< const UndistortMaps > GetUndistortMaps( cv::Size size ) const;
 
 public:
 	hVec2D DistortPoint( const hVec2D &in ) const;
 	hVec2D UndistortPoint( const hVec2D &in ) const;
 	
 	
-	// undistort an image.
+	// undistort an image. The second version writes into res, re-using its
+	// buffer if it is already the right size and type (so it must not be img).
 	cv::Mat Undistort( const cv::Mat img ) const;
-	void Undistort( const cv::Mat img, cv::Mat &res );
+	void Undistort( const cv::Mat img, cv::Mat &res ) const;
 
 	hVec3D GetCameraCentre()
 	{
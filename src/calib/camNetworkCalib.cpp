@@ -390,9 +390,12 @@ void CamNetCalibrator::FindGridThread(std::shared_ptr<ImageSource> dir, unsigned
 	std::vector< CircleGridDetector::GridPoint > gps;
 	do
 	{
-		// Get current image and convert it to greyscale.
+		// Get current image and convert it to greyscale (unless the source already did).
 		currentImage = dir->GetCurrent();
-		cv::cvtColor(currentImage, grey, cv::COLOR_BGR2GRAY);
+		if( currentImage.channels() == 1 )
+			grey = currentImage;
+		else
+			cv::cvtColor(currentImage, grey, cv::COLOR_BGR2GRAY);
 		++imgCount;
 		gridProg[isc] = imgCount;
 		
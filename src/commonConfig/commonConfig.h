@@ -34,8 +34,26 @@ public:
 	unsigned maxSingleWindowWidth;
 	unsigned maxSingleWindowHeight;
 	
+	// how many frames an ImageDirectory decodes ahead of the current frame,
+	// and how many threads it uses to do that decoding.
+	unsigned imgDirPrefetchDepth;
+	unsigned imgDirPrefetchThreads;
+	
+	// how many frames a VideoSource decodes ahead on a background thread.
+	// 0 means decode on the caller's thread.
+	unsigned vidDecodeAhead;
+	
+	// keep a manifest of the files in image directories so they open quickly (see imgio/dirManifest.h)
+	bool imgDirManifest;
+	
 	CommonConfig()
 	{
+		// defaults for the optional settings.
+		imgDirPrefetchDepth   = 4;
+		imgDirPrefetchThreads = 2;
+		vidDecodeAhead        = 0;
+		imgDirManifest        = true;
+		
 		// we need to know the user's home directory.
 		// ideally in a safe and sane cross-platform way.
 		// ha ha ha ha.
@@ -77,6 +95,11 @@ public:
 				cfgRoot.add("maxSingleWindowWidth", libconfig::Setting::TypeInt );
 				cfgRoot.add("maxSingleWindowHeight", libconfig::Setting::TypeInt );
 				
+				cfgRoot.add("imgDirPrefetchDepth", libconfig::Setting::TypeInt );
+				cfgRoot.add("imgDirPrefetchThreads", libconfig::Setting::TypeInt );
+				cfgRoot.add("vidDecodeAhead", libconfig::Setting::TypeInt );
+				cfgRoot.add("imgDirManifest", libconfig::Setting::TypeBoolean );
+				
 				cfg.lookup("dataRoot")     = userHome + "/programming/mc_dev/mc_core/data/";
 				cfg.lookup("shadersRoot")  = userHome + "/programming/mc_dev/mc_core/shaders/";
 				cfg.lookup("coreDataRoot") = userHome + "/programming/mc_dev/mc_core/data/";
@@ -87,6 +110,11 @@ public:
 				cfg.lookup("maxSingleWindowWidth") = 1000;
 				cfg.lookup("maxSingleWindowHeight") = 800;
 				
+				cfg.lookup("imgDirPrefetchDepth")   = (int)imgDirPrefetchDepth;
+				cfg.lookup("imgDirPrefetchThreads") = (int)imgDirPrefetchThreads;
+				cfg.lookup("vidDecodeAhead")        = (int)vidDecodeAhead;
+				cfg.lookup("imgDirManifest")        = imgDirManifest;
+				
 				cfg.writeFile( ss.str().c_str() );
 			}
 			
@@ -102,6 +130,16 @@ public:
 			
 			maxSingleWindowWidth  = cfg.lookup("maxSingleWindowWidth");
 			maxSingleWindowHeight = cfg.lookup("maxSingleWindowHeight");
+			
+			// older config files won't have these, so they stay optional.
+			if( cfg.exists("imgDirPrefetchDepth") )
+				imgDirPrefetchDepth = cfg.lookup("imgDirPrefetchDepth");
+			if( cfg.exists("imgDirPrefetchThreads") )
+				imgDirPrefetchThreads = cfg.lookup("imgDirPrefetchThreads");
+			if( cfg.exists("vidDecodeAhead") )
+				vidDecodeAhead = cfg.lookup("vidDecodeAhead");
+			if( cfg.exists("imgDirManifest") )
+				imgDirManifest = cfg.lookup("imgDirManifest");
 		}
 		catch( libconfig::SettingException &e)
 		{
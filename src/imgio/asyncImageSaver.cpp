@@ -0,0 +1,160 @@
+#include "imgio/asyncImageSaver.h"
+
+#include <chrono>
+#include <iostream>
+using std::cout;
+using std::endl;
+
+AsyncImageSaver::AsyncImageSaver( unsigned in_maxQueue, unsigned in_numThreads, ImgCodecOptions in_opts )
+{
+	opts = in_opts;
+	maxQueue = std::max( 1u, in_maxQueue );
+	inFlight = 0;
+	threadQuit = false;
+	err = nullptr;
+
+	stats.saved        = 0;
+	stats.stalls       = 0;
+	stats.stallSeconds = 0.0;
+	stats.queued       = 0;
+
+	if( in_numThreads == 0 )
+	{
+		in_numThreads = std::min( 4u, std::max( 1u, std::thread::hardware_concurrency() ) );
+	}
+
+	for( unsigned tc = 0; tc < in_numThreads; ++tc )
+	{
+		threads.push_back( std::thread( &AsyncImageSaver::SaveThread, this ) );
+	}
+}
+
+AsyncImageSaver::~AsyncImageSaver()
+{
+	// make sure everything gets written, but we can't throw from a destructor.
+	try
+	{
+		Flush();
+	}
+	catch( std::exception &e )
+	{
+		cout << "AsyncImageSaver: error while saving: " << e.what() << endl;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock( mutex );
+		threadQuit = true;
+	}
+	work_cv.notify_all();
+	for( unsigned tc = 0; tc < threads.size(); ++tc )
+		threads[tc].join();
+}
+
+void AsyncImageSaver::RethrowError()
+{
+	// mutex is held by the caller.
+	if( err )
+	{
+		std::exception_ptr e = err;
+		err = nullptr;
+		std::rethrow_exception( e );
+	}
+}
+
+void AsyncImageSaver::Save( cv::Mat img, std::string filename, bool copy )
+{
+	SaveJob job;
+	if( copy )
+		job.img = img.clone();
+	else
+		job.img = img;
+	job.filename = filename;
+
+	std::unique_lock<std::mutex> lock( mutex );
+	RethrowError();
+
+	if( queue.size() >= maxQueue )
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		while( queue.size() >= maxQueue && !err )
+		{
+			space_cv.wait( lock );
+		}
+		auto t1 = std::chrono::steady_clock::now();
+
+		stats.stalls++;
+		stats.stallSeconds += std::chrono::duration<double>( t1 - t0 ).count();
+
+		RethrowError();
+	}
+
+	queue.push_back( std::move(job) );
+	lock.unlock();
+	work_cv.notify_one();
+}
+
+void AsyncImageSaver::Flush()
+{
+	std::unique_lock<std::mutex> lock( mutex );
+	while( !queue.empty() || inFlight > 0 )
+	{
+		done_cv.wait( lock );
+	}
+	RethrowError();
+}
+
+ImageSaverStats AsyncImageSaver::GetStats()
+{
+	std::unique_lock<std::mutex> lock( mutex );
+	ImageSaverStats s = stats;
+	s.queued = queue.size() + inFlight;
+	return s;
+}
+
+void AsyncImageSaver::SaveThread()
+{
+	std::unique_lock<std::mutex> lock( mutex );
+	while( true )
+	{
+		if( queue.empty() )
+		{
+			if( threadQuit )
+				break;
+			work_cv.wait( lock );
+			continue;
+		}
+
+		SaveJob job = std::move( queue.front() );
+		queue.pop_front();
+		++inFlight;
+		lock.unlock();
+		space_cv.notify_one();
+
+		std::exception_ptr e;
+		try
+		{
+			SaveImage( job.img, job.filename, opts );
+		}
+		catch( ... )
+		{
+			e = std::current_exception();
+		}
+		job.img.release();
+
+		lock.lock();
+		--inFlight;
+		if( e )
+		{
+			// keep the first error, and wake up anyone waiting for space
+			// so they find out about it.
+			if( !err )
+				err = e;
+			space_cv.notify_all();
+		}
+		else
+		{
+			stats.saved++;
+		}
+		done_cv.notify_all();
+	}
+}
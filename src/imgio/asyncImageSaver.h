@@ -0,0 +1,83 @@
+#ifndef MC_ASYNC_IMAGE_SAVER_H
+#define MC_ASYNC_IMAGE_SAVER_H
+
+#include "imgio/loadsave.h"
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+//
+// Saving an image means compressing it and writing it to disk, and for a tool that
+// dumps every frame that is usually slower than the processing that made the frame.
+// The AsyncImageSaver takes (image, filename) jobs into a bounded queue and a small
+// pool of threads does the SaveImage() calls, so the producer only waits when the
+// queue is full.
+//
+// Any format SaveImage() understands can be used (.charImg, .floatImg, or whatever
+// Magick / OpenCV can write).
+//
+// If a save fails, the exception is kept and re-thrown from the next call to Save(),
+// Flush() or the destructor's Flush(), so errors are not silently lost.
+//
+struct ImageSaverStats
+{
+	unsigned long saved;        // images written
+	unsigned long stalls;       // times Save() had to wait for space in the queue
+	double        stallSeconds; // total time Save() spent waiting
+	unsigned      queued;       // images currently waiting to be written
+};
+
+class AsyncImageSaver
+{
+public:
+	// maxQueue is how many images may be waiting to be saved before Save() blocks.
+	// numThreads of 0 uses the number of hardware threads (up to 4).
+	// opts chooses the compression for .charImg / .floatImg files.
+	AsyncImageSaver( unsigned in_maxQueue = 16, unsigned in_numThreads = 0, ImgCodecOptions in_opts = ImgCodecOptions() );
+	~AsyncImageSaver();
+
+	// Queue the image to be saved. By default the image is cloned, so the caller
+	// is free to overwrite it as soon as this returns. If the caller will never
+	// touch the image data again, set copy to false to avoid the clone.
+	void Save( cv::Mat img, std::string filename, bool copy = true );
+
+	// wait until everything queued so far has been written. Re-throws the first
+	// error that happened since the last Flush().
+	void Flush();
+
+	ImageSaverStats GetStats();
+
+protected:
+
+	struct SaveJob
+	{
+		cv::Mat img;
+		std::string filename;
+	};
+
+	void SaveThread();
+	void RethrowError();
+
+	std::deque< SaveJob > queue;
+	unsigned maxQueue;
+	unsigned inFlight;          // jobs taken off the queue but not finished
+
+	std::mutex mutex;
+	std::condition_variable work_cv;   // signals threads that there is a job
+	std::condition_variable space_cv;  // signals Save() that there is space in the queue
+	std::condition_variable done_cv;   // signals Flush() that a job finished
+
+	std::vector< std::thread > threads;
+	bool threadQuit;
+
+	std::exception_ptr err;
+	
+	ImgCodecOptions opts;
+
+	ImageSaverStats stats;
+};
+
+#endif
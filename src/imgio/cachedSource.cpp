@@ -0,0 +1,263 @@
+#include "imgio/cachedSource.h"
+
+#include <iostream>
+using std::cout;
+using std::endl;
+
+CachedSource::CachedSource( std::shared_ptr< ImageSource > in_src, size_t in_byteBudget, unsigned in_window )
+{
+	src        = in_src;
+	byteBudget = in_byteBudget;
+	window     = std::max( 1u, in_window );
+	
+	calibration = src->GetCalibration();
+	numImages   = src->GetNumImages();
+	
+	bytes  = 0;
+	hits   = 0;
+	misses = 0;
+	
+	// we start wherever the source currently is.
+	frameIdx = src->GetCurrentFrameID();
+	srcIdx   = frameIdx;
+	dir      = 1;
+	current  = src->GetCurrent().clone();
+	currentTime = src->GetCurrentFrameTime();
+	Insert( frameIdx, current, currentTime );
+	
+	threadQuit     = false;
+	preFetchFailed = false;
+	preFetchThread = std::thread( &CachedSource::PreFetchThread, this );
+}
+
+CachedSource::~CachedSource()
+{
+	std::unique_lock<std::mutex> lock( cache_mutex );
+	threadQuit = true;
+	lock.unlock();
+	cache_cv.notify_one();
+	
+	preFetchThread.join();
+}
+
+cv::Mat CachedSource::GetCurrent()
+{
+	return current;
+}
+
+bool CachedSource::Advance()
+{
+	if( numImages > 0 && frameIdx + 1 >= (unsigned)numImages )
+		return false;
+	return Goto( frameIdx + 1, 1 );
+}
+
+bool CachedSource::Regress()
+{
+	if( frameIdx == 0 )
+		return false;
+	return Goto( frameIdx - 1, -1 );
+}
+
+bool CachedSource::JumpToFrame(unsigned frame)
+{
+	// assume that we'll carry on moving in the same direction.
+	int d = dir;
+	if( frame > frameIdx )
+		d = 1;
+	else if( frame < frameIdx )
+		d = -1;
+	return Goto( frame, d );
+}
+
+unsigned CachedSource::GetCurrentFrameID()
+{
+	return frameIdx;
+}
+
+frameTime_t CachedSource::GetCurrentFrameTime()
+{
+	return currentTime;
+}
+
+int CachedSource::GetNumImages()
+{
+	return numImages;
+}
+
+void CachedSource::SaveCalibration()
+{
+	std::unique_lock<std::mutex> lock( src_mutex );
+	src->GetCalibration() = calibration;
+	src->SaveCalibration();
+}
+
+FrameCacheStats CachedSource::GetCacheStats()
+{
+	std::unique_lock<std::mutex> lock( cache_mutex );
+	FrameCacheStats s;
+	s.hits   = hits;
+	s.misses = misses;
+	s.bytes  = bytes;
+	s.frames = cache.size();
+	return s;
+}
+
+bool CachedSource::Goto( unsigned frame, int in_dir )
+{
+	std::unique_lock<std::mutex> lock( cache_mutex );
+	auto i = cache.find( frame );
+	if( i != cache.end() )
+	{
+		++hits;
+		
+		// move to front of the lru list.
+		lru.splice( lru.begin(), lru, i->second.lruPos );
+		current  = i->second.img;
+		currentTime = i->second.time;
+		frameIdx = frame;
+		dir      = in_dir;
+		preFetchFailed = false;
+		lock.unlock();
+		cache_cv.notify_one();
+		return true;
+	}
+	++misses;
+	lock.unlock();
+	
+	// not cached, so we have to wait on the source.
+	frameTime_t time;
+	cv::Mat img = Fetch( frame, time );
+	if( img.empty() )
+		return false;
+	
+	lock.lock();
+	Insert( frame, img, time );
+	current  = img;
+	currentTime = time;
+	frameIdx = frame;
+	dir      = in_dir;
+	preFetchFailed = false;
+	lock.unlock();
+	cache_cv.notify_one();
+	
+	return true;
+}
+
+cv::Mat CachedSource::Fetch( unsigned frame, frameTime_t &time )
+{
+	std::unique_lock<std::mutex> lock( src_mutex );
+	bool ok = true;
+	if( srcIdx != (int)frame )
+	{
+		// stepping forward is usually much cheaper than a jump (especially for videos)
+		if( srcIdx >= 0 && srcIdx + 1 == (int)frame )
+			ok = src->Advance();
+		else
+			ok = src->JumpToFrame( frame );
+	}
+	
+	if( !ok )
+	{
+		// no idea where the source is now.
+		srcIdx = -1;
+		return cv::Mat();
+	}
+	srcIdx = frame;
+	time   = src->GetCurrentFrameTime();
+	
+	// Some sources (e.g. video) decode into the same buffer each time,
+	// so we need our own copy to keep in the cache.
+	return src->GetCurrent().clone();
+}
+
+void CachedSource::Insert( unsigned frame, cv::Mat img, frameTime_t time )
+{
+	auto i = cache.find( frame );
+	if( i != cache.end() )
+	{
+		// two threads fetched the same frame. Keep the one we already had.
+		lru.splice( lru.begin(), lru, i->second.lruPos );
+		return;
+	}
+	
+	lru.push_front( frame );
+	CacheEntry &e = cache[ frame ];
+	e.img    = img;
+	e.time   = time;
+	e.bytes  = img.total() * img.elemSize();
+	e.lruPos = lru.begin();
+	bytes += e.bytes;
+	
+	Evict();
+}
+
+void CachedSource::Evict()
+{
+	// Throw out the least recently used frames, but try to keep
+	// the frames that are close to the current frame.
+	while( bytes > byteBudget && cache.size() > 1 )
+	{
+		auto victim = std::prev( lru.end() );
+		for( auto li = lru.rbegin(); li != lru.rend(); ++li )
+		{
+			int d = (int)(*li) - (int)frameIdx;
+			if( std::abs(d) > (int)window )
+			{
+				victim = std::prev( li.base() );
+				break;
+			}
+		}
+		
+		auto ci = cache.find( *victim );
+		bytes -= ci->second.bytes;
+		cache.erase( ci );
+		lru.erase( victim );
+	}
+}
+
+void CachedSource::PreFetchThread()
+{
+	std::unique_lock<std::mutex> lock( cache_mutex );
+	while( !threadQuit )
+	{
+		// find the nearest frame in the direction of travel that we don't have.
+		int want = -1;
+		if( !preFetchFailed )
+		{
+			for( unsigned k = 1; k <= window; ++k )
+			{
+				int f = (int)frameIdx + dir * (int)k;
+				if( f < 0 || (numImages > 0 && f >= numImages) )
+					break;
+				if( cache.find( f ) == cache.end() )
+				{
+					want = f;
+					break;
+				}
+			}
+		}
+		
+		if( want < 0 )
+		{
+			cache_cv.wait( lock );
+			continue;
+		}
+		
+		lock.unlock();
+		frameTime_t time;
+		cv::Mat img = Fetch( want, time );
+		lock.lock();
+		
+		if( img.empty() )
+		{
+			// don't keep hammering the source until we move again.
+			preFetchFailed = true;
+			continue;
+		}
+		
+		// if we've jumped a long way since, this might not be worth keeping,
+		// but that's for the LRU to decide.
+		Insert( want, img, time );
+	}
+}
@@ -0,0 +1,99 @@
+#ifndef MC_CACHED_SOURCE_H
+#define MC_CACHED_SOURCE_H
+
+#include "imgio/imagesource.h"
+
+#include <list>
+#include <map>
+#include <memory>
+
+//
+// When scrubbing back and forth through a sequence (renderSyncedSources, pointMatcher, etc.)
+// the sources end up decoding the same few hundred frames again and again. Wrapping a source
+// in a CachedSource keeps the decoded frames in a least-recently-used cache with a byte budget,
+// so that stepping backwards or revisiting a frame is just a cache hit.
+//
+// A background thread also fetches frames ahead of us in whichever direction we are moving, 
+// and frames within 'window' of the current frame are the last to be thrown out of the cache.
+//
+// The wrapped source should not be used directly once it has been handed to the CachedSource.
+//
+struct FrameCacheStats
+{
+	unsigned long hits;
+	unsigned long misses;
+	size_t        bytes;     // bytes currently held in the cache
+	size_t        frames;    // frames currently held in the cache
+};
+
+class CachedSource : public ImageSource
+{
+public:
+	CachedSource( std::shared_ptr< ImageSource > in_src, size_t in_byteBudget = 1024*1024*1024, unsigned in_window = 16 );
+	virtual ~CachedSource();
+	
+	cv::Mat GetCurrent();
+	
+	bool Advance();
+	bool Regress();
+	bool JumpToFrame(unsigned frame);
+	
+	unsigned GetCurrentFrameID();
+	frameTime_t GetCurrentFrameTime();
+	
+	int GetNumImages();
+	
+	void SaveCalibration();
+	
+	FrameCacheStats GetCacheStats();
+	
+	std::shared_ptr< ImageSource > GetSource() {return src;}
+	
+protected:
+	
+	// move to the specified frame, from the cache if we can.
+	bool Goto( unsigned frame, int in_dir );
+	
+	// get a frame, and the time the source gives it, from the wrapped source.
+	cv::Mat Fetch( unsigned frame, frameTime_t &time );
+	
+	// put a frame into the cache and evict anything over budget.
+	// caller should hold the cache mutex.
+	void Insert( unsigned frame, cv::Mat img, frameTime_t time );
+	void Evict();
+	
+	void PreFetchThread();
+	
+	std::shared_ptr< ImageSource > src;
+	std::mutex src_mutex;
+	int srcIdx;
+	int numImages;
+	
+	struct CacheEntry
+	{
+		cv::Mat img;
+		frameTime_t time;
+		size_t bytes;
+		std::list<unsigned>::iterator lruPos;
+	};
+	std::map< unsigned, CacheEntry > cache;
+	std::list< unsigned > lru;    // most recently used at the front.
+	size_t bytes;
+	size_t byteBudget;
+	unsigned window;
+	
+	std::mutex cache_mutex;
+	std::condition_variable cache_cv;
+	std::thread preFetchThread;
+	bool threadQuit;
+	bool preFetchFailed;
+	
+	unsigned frameIdx;
+	int dir;
+	cv::Mat current;
+	frameTime_t currentTime;
+	
+	unsigned long hits, misses;
+};
+
+#endif
@@ -0,0 +1,255 @@
+#include "imgio/dirManifest.h"
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <ctime>
+
+#include <sys/stat.h>
+#include <unistd.h>
+using std::cout;
+using std::endl;
+
+static const char *manifestName = ".mcdev_manifest";
+static const char *manifestTag  = "mcdevManifest1";
+
+// modification time of a directory, to the nanosecond if the file system has it.
+static bool DirMTime( const std::string &dir, int64_t &sec, int64_t &nsec )
+{
+	struct stat st;
+	if( stat( dir.c_str(), &st ) != 0 )
+		return false;
+#ifdef __APPLE__
+	sec  = st.st_mtimespec.tv_sec;
+	nsec = st.st_mtimespec.tv_nsec;
+#else
+	sec  = st.st_mtim.tv_sec;
+	nsec = st.st_mtim.tv_nsec;
+#endif
+	return true;
+}
+
+// The first line of the manifest is fixed width, so that we can update
+// the directory time in place once the manifest has been moved into the directory.
+static std::string HeaderLine( int64_t sec, int64_t nsec, size_t count )
+{
+	char buf[128];
+	snprintf( buf, sizeof(buf), "%s %020lld %020lld %020llu\n", manifestTag, (long long)sec, (long long)nsec, (unsigned long long)count );
+	return buf;
+}
+
+// the places the manifest of dir can be: first in dir itself, then in the user's cache.
+static std::vector< std::string > ManifestPaths( const std::string &dir, const std::string &absDir )
+{
+	std::vector< std::string > paths;
+	paths.push_back( (boost::filesystem::path(dir) / manifestName).string() );
+
+	const char *home = getenv("HOME");
+	if( home )
+	{
+		std::stringstream ss;
+		ss << home << "/.cache/mc_dev/dirManifests/" << std::hex << std::hash< std::string >()( absDir );
+		paths.push_back( ss.str() );
+	}
+	return paths;
+}
+
+// read a manifest, which is only any good if it was made when the directory had the time it has now.
+// The copy in the directory itself can be used wherever the directory is mounted, but the one in
+// the cache is only good for the directory it was made for.
+static bool ReadManifest( const std::string &fn, const std::string &absDir, bool checkDir, int64_t sec, int64_t nsec, std::vector< DirManifestEntry > &entries )
+{
+	std::ifstream infi( fn );
+	if( !infi )
+		return false;
+
+	std::string tag, mdir;
+	long long msec, mnsec;
+	unsigned long long count;
+	infi >> tag >> msec >> mnsec >> count;
+	infi.get();
+	std::getline( infi, mdir );
+	if( !infi || tag != manifestTag || msec != sec || mnsec != nsec )
+		return false;
+	if( checkDir && mdir != absDir )
+		return false;
+
+	entries.resize( count );
+	for( unsigned long long ec = 0; ec < count; ++ec )
+	{
+		DirManifestEntry &e = entries[ec];
+		infi >> e.size >> e.mtime;
+		infi.get();
+		std::getline( infi, e.name );
+	}
+	return (bool)infi;
+}
+
+static std::vector< DirManifestEntry > ScanDirectory( const std::string &dir )
+{
+	std::vector< DirManifestEntry > entries;
+	boost::filesystem::directory_iterator di(dir), endi;
+	for( ; di != endi; ++di )
+	{
+		// skip our own manifest (and any temporary copies of it).
+		std::string name = di->path().filename().string();
+		if( name.compare( 0, strlen(manifestName), manifestName ) == 0 || name.find('\n') != std::string::npos )
+			continue;
+
+		struct stat st;
+		if( stat( di->path().string().c_str(), &st ) != 0 || S_ISDIR( st.st_mode ) )
+			continue;
+
+		DirManifestEntry e;
+		e.name  = name;
+		e.size  = st.st_size;
+		e.mtime = st.st_mtime;
+		entries.push_back( e );
+	}
+
+	std::sort( entries.begin(), entries.end(), []( const DirManifestEntry &a, const DirManifestEntry &b ){ return a.name < b.name; } );
+	return entries;
+}
+
+static bool SameEntries( const std::vector< DirManifestEntry > &a, const std::vector< DirManifestEntry > &b )
+{
+	if( a.size() != b.size() )
+		return false;
+	for( unsigned ec = 0; ec < a.size(); ++ec )
+	{
+		if( a[ec].name != b[ec].name || a[ec].size != b[ec].size || a[ec].mtime != b[ec].mtime )
+			return false;
+	}
+	return true;
+}
+
+static bool WriteManifest( const std::string &fn, const std::string &dir, const std::string &absDir, int64_t sec, int64_t nsec, const std::vector< DirManifestEntry > &entries )
+{
+	boost::system::error_code ec;
+	boost::filesystem::create_directories( boost::filesystem::path(fn).parent_path(), ec );
+
+	// write to a temporary file and rename it, so that nobody reads half a manifest.
+	std::stringstream tss;
+	tss << fn << ".tmp." << getpid() << "." << std::this_thread::get_id();
+	std::string tmp = tss.str();
+	{
+		std::ofstream outfi( tmp );
+		if( !outfi )
+			return false;
+		outfi << HeaderLine( sec, nsec, entries.size() ) << absDir << "\n";
+		for( unsigned ec = 0; ec < entries.size(); ++ec )
+			outfi << entries[ec].size << " " << entries[ec].mtime << " " << entries[ec].name << "\n";
+		if( !outfi )
+		{
+			outfi.close();
+			unlink( tmp.c_str() );
+			return false;
+		}
+	}
+	if( rename( tmp.c_str(), fn.c_str() ) != 0 )
+	{
+		unlink( tmp.c_str() );
+		return false;
+	}
+
+	// Putting the manifest into the directory has changed the directory's time, so
+	// record the new time. Overwriting the file in place doesn't change it again.
+	int64_t sec1, nsec1;
+	if( DirMTime( dir, sec1, nsec1 ) && ( sec1 != sec || nsec1 != nsec ) )
+	{
+		// But somebody else might have added or removed a file since we listed the directory,
+		// and the new time would cover that too. So only take the new time if the directory
+		// still has what we listed, and hasn't changed since we got the time. With a coarse
+		// timestamp a later change in the same second wouldn't show, so then we can't be sure,
+		// and leave the manifest stale so that next time the directory is listed again.
+		if( nsec1 == 0 && time(NULL) - sec1 <= 2 )
+			return true;
+		std::vector< DirManifestEntry > now = ScanDirectory( dir );
+		int64_t sec2, nsec2;
+		if( !DirMTime( dir, sec2, nsec2 ) || sec2 != sec1 || nsec2 != nsec1 || !SameEntries( now, entries ) )
+			return true;
+		
+		std::fstream fs( fn, std::ios::in | std::ios::out | std::ios::binary );
+		fs.seekp( 0 );
+		fs << HeaderLine( sec1, nsec1, entries.size() );
+		if( !fs )
+			return false;
+	}
+	return true;
+}
+
+std::vector< DirManifestEntry > ListDirectory( std::string dir, bool useManifest )
+{
+	boost::filesystem::path p( dir );
+	if( !boost::filesystem::is_directory( p ) )
+		throw std::runtime_error( "ListDirectory: " + dir + " is not a directory." );
+
+	int64_t sec0, nsec0;
+	if( !useManifest || !DirMTime( dir, sec0, nsec0 ) )
+		return ScanDirectory( dir );
+
+	std::string absDir = boost::filesystem::absolute( p ).string();
+	std::vector< std::string > paths = ManifestPaths( dir, absDir );
+
+	std::vector< DirManifestEntry > entries;
+	for( unsigned pc = 0; pc < paths.size(); ++pc )
+	{
+		if( ReadManifest( paths[pc], absDir, pc > 0, sec0, nsec0, entries ) )
+			return entries;
+	}
+
+	entries = ScanDirectory( dir );
+
+	// Don't keep the listing if the directory changed while we were reading it, or changed so
+	// recently that it is probably still being written to - a coarse file system timestamp
+	// could then hide the next change from us.
+	int64_t sec1, nsec1;
+	if( DirMTime( dir, sec1, nsec1 ) && sec1 == sec0 && nsec1 == nsec0 && time(NULL) - sec0 > 2 )
+	{
+		for( unsigned pc = 0; pc < paths.size(); ++pc )
+		{
+			if( WriteManifest( paths[pc], dir, absDir, sec0, nsec0, entries ) )
+				break;
+		}
+	}
+
+	return entries;
+}
+
+void PrepareDirectoryManifests( const std::vector< std::string > &dirs, unsigned numThreads )
+{
+	if( numThreads == 0 )
+		numThreads = 32;
+	numThreads = std::max( 1u, std::min( numThreads, (unsigned)dirs.size() ) );
+
+	std::atomic<unsigned> next(0);
+	auto work = [&]()
+	{
+		unsigned dc;
+		while( (dc = next++) < dirs.size() )
+		{
+			try
+			{
+				ListDirectory( dirs[dc] );
+			}
+			catch( std::exception &e )
+			{
+				// the source will complain properly when it is created.
+				cout << "could not list " << dirs[dc] << " : " << e.what() << endl;
+			}
+		}
+	};
+
+	std::vector< std::thread > threads;
+	for( unsigned tc = 1; tc < numThreads; ++tc )
+		threads.push_back( std::thread( work ) );
+	work();
+	for( unsigned tc = 0; tc < threads.size(); ++tc )
+		threads[tc].join();
+}
@@ -0,0 +1,35 @@
+#ifndef MC_DIR_MANIFEST_H
+#define MC_DIR_MANIFEST_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//
+// Listing a directory of a few hundred thousand images, particularly over NFS, can take
+// tens of seconds. So the first time we list a directory we write a manifest of what is
+// in it, and next time we just read that back, as long as the directory's modification
+// time says nothing has been added, removed or renamed since.
+//
+// The manifest goes in the directory itself (.mcdev_manifest) so that everyone using the
+// data benefits, or under ~/.cache/mc_dev/ if we can't write to the directory.
+//
+// Changing the contents of a file doesn't change the directory's modification time,
+// so the sizes and times in the manifest are those from when it was made.
+//
+struct DirManifestEntry
+{
+	std::string name;    // file name, without the directory.
+	uint64_t    size;    // in bytes.
+	int64_t     mtime;   // seconds since the epoch.
+};
+
+// List the files (not sub-directories) in dir, sorted by name.
+// Uses (and if need be, makes) the manifest unless useManifest is false.
+std::vector< DirManifestEntry > ListDirectory( std::string dir, bool useManifest = true );
+
+// Bring the manifests of several directories up to date at once, using numThreads threads.
+// Directory listings over NFS are latency bound, so 0 means one thread per directory (up to 32).
+void PrepareDirectoryManifests( const std::vector< std::string > &dirs, unsigned numThreads = 0 );
+
+#endif
@@ -2,13 +2,15 @@
 #define MC_FNIMGSRC_H
 
 #include "imagesource.h"
+#include "imgio/dirManifest.h"
+#include "commonConfig/commonConfig.h"
 #include <map>
 
 #include <iostream>
 using std::cout;
 using std::endl;
 
-class FNImageDirectory : public ImageSource
+class FNImageDirectory : public ImageSource, public FrameProvider
 {
 protected:
 	
@@ -112,15 +114,16 @@ public:
 	void GetImgMap()
 	{
 		cout << "\t getting image map: " << endl;
-		// find the images in the directory.
+		// find the images in the directory, from its manifest if we can.
 		boost::filesystem::path p(path);
 		std::vector< std::string > imageList;
 		if( boost::filesystem::exists(p) && boost::filesystem::is_directory(p))
 		{
-			boost::filesystem::directory_iterator di(p), endi;
-			for( ; di != endi; ++di )
+			CommonConfig ccfg;
+			std::vector< DirManifestEntry > entries = ListDirectory( path, ccfg.imgDirManifest );
+			for( unsigned ec = 0; ec < entries.size(); ++ec )
 			{
-				std::string s = di->path().string();
+				std::string s = (p / entries[ec].name).string();
 				
 				if( IsImage(s) )
 				{
@@ -237,32 +240,55 @@ public:
 		{
 			realFrameNo = frameIdx + firstFrame;
 		}
-		auto i = imgMap.find( realFrameNo );
-		if( i != imgMap.end() )
-		{
-			current = LoadImage( i->second );
-		}
-		else
+		if( imgMap.find( realFrameNo ) == imgMap.end() )
 		{
 			cout << "source didn't have " << frameIdx << " (" << realFrameNo << ")" << endl;
 			cout << "so using: " << imgMap.begin()->first << endl;
-			// we need an image of a sensible size... load the first image and blank it.
-			// really we could remember what size image and just make a blank image, but
-			// will it matter?
-			current = LoadImage( imgMap.begin()->second );
-			current = cv::Mat( current.rows, current.cols, current.type(), cv::Scalar(0) );
 		}
+		current = GetFrame( frameIdx );
 		cout << "frameIdx: " << frameIdx << " (" << realFrameNo << ")" << " : " << current.rows << " " << current.cols << endl;
 		
 		return true;
 	}
 	
 	
+	// imgMap doesn't change once we're made, so this is fine from any thread.
+	cv::Mat GetFrame( unsigned frame )
+	{
+		if( frame > maxFrame )
+			return cv::Mat();
+		
+		int realFrameNo = frame;
+		if( firstFrame > -1 )
+		{
+			realFrameNo = frame + firstFrame;
+		}
+		auto i = imgMap.find( realFrameNo );
+		if( i != imgMap.end() )
+		{
+			return LoadImage( i->second, decodeOpts );
+		}
+		
+		// we need an image of a sensible size... load the first image and blank it.
+		// really we could remember what size image and just make a blank image, but
+		// will it matter?
+		cv::Mat img = LoadImage( imgMap.begin()->second, decodeOpts );
+		return cv::Mat( img.rows, img.cols, img.type(), cv::Scalar(0) );
+	}
+	
+	
 	// WARNING!!!
 	// replaces the calibration file in the source directory!
 	void SaveCalibration()
 	{
-		calibration.Write( path + "/calibFile" );
+		Calibration full = GetFullCalibration();
+		full.Write( path + "/calibFile" );
+	}
+	
+	bool SetDecodeOptions( const LoadImageOptions &opts )
+	{
+		UpdateDecodeCalibration( opts, current.size() );
+		return ReadImage();
 	}
 
 
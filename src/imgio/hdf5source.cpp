@@ -2,70 +2,603 @@
 
 #include "imgio/hdf5source.h"
 #include "misc/tokeniser.h"
+#include "commonConfig/commonConfig.h"
+#include "imgio/imgDecoders.h"
 
+#include <H5Zpublic.h>
 
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 using std::cout;
 using std::endl;
 
-HDF5ImageWriter::HDF5ImageWriter( std::string outfn )
+std::string HDF5FrameName( const HDF5FrameInfo &info )
 {
+	std::stringstream ss;
+	ss << std::setw(12) << std::setfill('0') << info.fno << "_" << info.rows << "_" << info.cols << "_";
+	ss << CV_MAT_CN( info.type ) << "_";
+	if( info.bayer != BAYER_NONE )
+		ss << BayerPatternName( info.bayer );
+	else
+		ss << ( CV_MAT_DEPTH( info.type ) == CV_32F ? "f" : "b" );
+	return ss.str();
+}
+
+bool ParseHDF5FrameName( const std::string &name, HDF5FrameInfo &info )
+{
+	// we should have [ frameNumber, rows, cols, channels, type ]
+	auto ss = SplitLine( name, "_");
+	if( ss.size() != 5 )
+		return false;
+
+	int channels = std::atoi( ss[3].c_str() );
+	int depth = CV_8U;
+	info.bayer = BAYER_NONE;
+	if( ss[4].compare("f") == 0 )
+	{
+		depth = CV_32F;
+	}
+	else if( ss[4].compare("b") != 0 )
+	{
+		for( int b = BAYER_RGGB; b <= BAYER_GBRG; ++b )
+		{
+			if( ss[4].compare( BayerPatternName( (bayerPattern_t)b ) ) == 0 )
+				info.bayer = (bayerPattern_t)b;
+		}
+		if( info.bayer == BAYER_NONE || channels != 1 )
+			return false;
+	}
+
+	info.fno  = std::atoi( ss[0].c_str() );
+	info.rows = std::atoi( ss[1].c_str() );
+	info.cols = std::atoi( ss[2].c_str() );
+	info.type = CV_MAKETYPE( depth, channels );
+	return info.rows > 0 && info.cols > 0 && ( channels == 1 || channels == 3 );
+}
+
+bool ReadHDF5FrameIndex( HighFive::File &file, std::vector< HDF5FrameInfo > &frames )
+{
+	if( !file.exist( HDF5_INDEX_NAME ) )
+		return false;
+
+	HighFive::DataSet ds = file.getDataSet( HDF5_INDEX_NAME );
+	std::vector< size_t > dims = ds.getSpace().getDimensions();
+	if( dims.size() != 2 || dims[1] != HDF5_INDEX_COLS )
+		return false;
+
+	// if the writer didn't get to update the index, there will be more datasets than it knows about.
+	if( file.getNumberObjects() != dims[0] + 1 )
+	{
+		cout << "hdf5: frame index is out of date." << endl;
+		return false;
+	}
+
+	std::vector< uint32_t > raw( dims[0] * HDF5_INDEX_COLS );
+	if( raw.size() > 0 )
+		ds.read( raw.data() );
+
+	frames.resize( dims[0] );
+	for( unsigned fc = 0; fc < frames.size(); ++fc )
+	{
+		const uint32_t *r = &raw[ fc * HDF5_INDEX_COLS ];
+		frames[fc].fno  = r[0];
+		frames[fc].rows = r[1];
+		frames[fc].cols = r[2];
+		frames[fc].type = r[3];
+		frames[fc].bayer = r[4] <= BAYER_GBRG ? (bayerPattern_t)r[4] : BAYER_NONE;
+	}
+
+	// rows are in the order the images were written, which isn't always frame order.
+	std::sort( frames.begin(), frames.end(), []( const HDF5FrameInfo &a, const HDF5FrameInfo &b ) { return a.fno < b.fno; } );
+	return true;
+}
+
+void ScanHDF5FrameNames( HighFive::File &file, std::vector< HDF5FrameInfo > &frames, std::vector< std::string > &names )
+{
+	std::vector< std::pair< HDF5FrameInfo, std::string > > found;
+	bool namesMatch = true;
+	std::vector< std::string > dsList = file.listObjectNames();
+	for( unsigned lc = 0; lc < dsList.size(); ++lc )
+	{
+		HDF5FrameInfo fi;
+		if( !ParseHDF5FrameName( dsList[lc], fi ) )
+		{
+			if( dsList[lc].compare( HDF5_INDEX_NAME ) != 0 )
+				cout << "hdf5: ignoring dataset: " << dsList[lc] << endl;
+			continue;
+		}
+		namesMatch = namesMatch && HDF5FrameName( fi ).compare( dsList[lc] ) == 0;
+		found.push_back( std::make_pair( fi, dsList[lc] ) );
+	}
+
+	std::sort( found.begin(), found.end(), []( const std::pair< HDF5FrameInfo, std::string > &a, const std::pair< HDF5FrameInfo, std::string > &b )
+	{
+		return a.first.fno < b.first.fno;
+	});
+
+	frames.clear();
+	names.clear();
+	for( unsigned fc = 0; fc < found.size(); ++fc )
+	{
+		frames.push_back( found[fc].first );
+		if( !namesMatch )
+			names.push_back( found[fc].second );
+	}
+}
+
+
+
+// HighFive doesn't know about filter plugins, so this adds one to the dataset creation properties.
+struct HDF5PluginFilter
+{
+	HDF5PluginFilter( H5Z_filter_t in_id ) : id( in_id ) {}
+	
+	void apply( hid_t hid ) const
+	{
+		if( H5Pset_filter( hid, id, H5Z_FLAG_OPTIONAL, 0, NULL ) < 0 )
+			throw std::runtime_error("hdf5: could not add filter plugin to dataset.");
+	}
+	
+	H5Z_filter_t id;
+};
+
+// the OpenCV type of the images in a stacked frames dataset.
+static int HDF5StackType( const HighFive::DataSet &ds, const std::vector< size_t > &dims )
+{
+	if( dims.size() != 4 || ( dims[3] != 1 && dims[3] != 3 ) )
+		throw std::runtime_error("hdf5: the frames dataset should be N x rows x cols x 1 or 3.");
+	int depth = ds.getDataType() == HighFive::AtomicType<float>() ? CV_32F : CV_8U;
+	return CV_MAKETYPE( depth, dims[3] );
+}
+
+// HighFive takes the memory datatype from the type of the pointer it is given, so the
+// image data has to be passed as a float* for float images. Otherwise HDF5 converts 
+// each element to or from an unsigned char. obj is a DataSet or a Selection of one.
+template< class H5Obj >
+static void HDF5WriteMat( H5Obj &&obj, const cv::Mat &img )
+{
+	if( img.depth() == CV_32F )
+		obj.write( (const float*)img.data );
+	else
+		obj.write( (const unsigned char*)img.data );
+}
+
+template< class H5Obj >
+static void HDF5ReadMat( H5Obj &&obj, cv::Mat &img )
+{
+	if( img.depth() == CV_32F )
+		obj.read( (float*)img.data );
+	else
+		obj.read( (unsigned char*)img.data );
+}
+
+
+
+HDF5ImageWriter::HDF5ImageWriter( std::string outfn, HDF5WriterOptions in_opts )
+{
+	opts = in_opts;
 	try
 	{
 		outfi = new HighFive::File( outfn, HighFive::File::ReadWrite | HighFive::File::Create );
 	}
-	catch (HighFive::Exception& err) 
+	catch (HighFive::Exception& err)
 	{
 		// catch and print any HDF5 error
 		std::cout << err.what() << std::endl;
 		exit(0);
 	}
+
+	indexDirty = false;
+	indexRows  = 0;
+	stackLen   = 0;
+	if( outfi->exist( HDF5_STACK_NAME ) )
+	{
+		// carry on adding to the stack that is already there.
+		opts.stacked = true;
+		stack.reset( new HighFive::DataSet( outfi->getDataSet( HDF5_STACK_NAME ) ) );
+		stackFnos.reset( new HighFive::DataSet( outfi->getDataSet( HDF5_STACK_FNO_NAME ) ) );
+		
+		std::vector< size_t > dims = stack->getSpace().getDimensions();
+		stackType = HDF5StackType( *stack, dims );
+		stackRows = dims[1];
+		stackCols = dims[2];
+		if( stack->hasAttribute("bayer") )
+		{
+			int b;
+			stack->getAttribute("bayer").read( b );
+			opts.bayer = (bayerPattern_t)b;
+		}
+		
+		// if we stopped between writing a frame and its number, forget the odd one.
+		stackLen  = std::min( dims[0], stackFnos->getSpace().getDimensions()[0] );
+	}
+	else if( opts.stacked && outfi->getNumberObjects() > 0 )
+	{
+		delete outfi;
+		throw std::runtime_error("HDF5ImageWriter: can't add stacked images to a file of per-image datasets: " + outfn );
+	}
+	else if( !opts.stacked && outfi->getNumberObjects() > 0 )
+	{
+		// If we're adding to an existing file, the index has to cover what is already there. We
+		// only ever append to an extendible index, so anything else gets written again from scratch.
+		std::vector< HDF5FrameInfo > existing;
+		bool haveIndex = ReadHDF5FrameIndex( *outfi, existing );
+		if( haveIndex )
+		{
+			HighFive::DataSet ds = outfi->getDataSet( HDF5_INDEX_NAME );
+			std::vector< size_t > maxDims = ds.getSpace().getMaxDimensions();
+			if( maxDims.size() == 2 && maxDims[0] == HighFive::DataSpace::UNLIMITED )
+			{
+				indexDs.reset( new HighFive::DataSet( ds ) );
+				indexRows = existing.size();
+			}
+		}
+		else
+		{
+			std::vector< std::string > names;
+			ScanHDF5FrameNames( *outfi, existing, names );
+		}
+		
+		if( !indexDs )
+		{
+			if( outfi->exist( HDF5_INDEX_NAME ) )
+				outfi->unlink( HDF5_INDEX_NAME );
+			newIndexRows = existing;
+			indexDirty = true;
+		}
+	}
+	
+	lastFlush       = std::chrono::steady_clock::now();
+	secondHighWater = 0;
+	writing         = false;
+	threadQuit      = false;
+	if( opts.queueLength > 0 )
+	{
+		pool.SetMaxBuffers( opts.queueLength + 2 );
+		writerThread = std::thread( &HDF5ImageWriter::WriterThread, this );
+	}
 }
 
 HDF5ImageWriter::~HDF5ImageWriter()
 {
-	outfi->flush();
+	if( writerThread.joinable() )
+	{
+		// the thread writes whatever is still in the queue before it stops.
+		std::unique_lock<std::mutex> lock( queue_mutex );
+		threadQuit = true;
+		lock.unlock();
+		ready_cv.notify_all();
+		writerThread.join();
+	}
+	
+	if( writeErr )
+	{
+		cout << "HDF5ImageWriter: stopped writing images after an error, " << stats.added - stats.written - stats.dropped << " images lost." << endl;
+	}
+	
+	// a destructor mustn't throw, and after a failed write HDF5 might well complain again.
+	std::lock_guard<std::mutex> flock( file_mutex );
+	try
+	{
+		FlushFile();
+	}
+	catch( std::exception &e )
+	{
+		cout << "HDF5ImageWriter: failed to flush the file when closing it: " << e.what() << endl;
+	}
 	delete outfi;
 }
 
-void HDF5ImageWriter::AddImage( cv::Mat &img, size_t imgNumber )
+bool HDF5ImageWriter::AddImage( cv::Mat &img, size_t imgNumber )
 {
-	std::stringstream ss;
-	ss << std::setw(12) << std::setfill('0') << imgNumber << "_" << img.rows << "_" << img.cols << "_";
-	std::vector<size_t> dims;
+	if( !writerThread.joinable() )
+	{
+		std::lock_guard<std::mutex> flock( file_mutex );
+		WriteImage( img, imgNumber );
+		if( FlushDue() )
+			FlushFile();
+		
+		std::lock_guard<std::mutex> qlock( queue_mutex );
+		++stats.added;
+		++stats.written;
+		return true;
+	}
+	
+	std::unique_lock<std::mutex> qlock( queue_mutex );
+	if( writeErr )
+		std::rethrow_exception( writeErr );
+	
+	++stats.added;
+	if( writeQueue.size() >= opts.queueLength && opts.whenFull == HDF5WriterOptions::DROP_NEWEST )
+	{
+		++stats.dropped;
+		return false;
+	}
+	qlock.unlock();
+	
+	// copy without holding the lock, so we don't hold up the writer thread.
+	cv::Mat c = pool.Get( img.rows, img.cols, img.type() );
+	img.copyTo( c );
+	
+	qlock.lock();
+	if( writeQueue.size() >= opts.queueLength )
+	{
+		switch( opts.whenFull )
+		{
+			case HDF5WriterOptions::BLOCK:
+				while( writeQueue.size() >= opts.queueLength && !writeErr )
+					space_cv.wait( qlock );
+				if( writeErr )
+					std::rethrow_exception( writeErr );
+				break;
+			
+			case HDF5WriterOptions::DROP_OLDEST:
+				writeQueue.pop_front();
+				++stats.dropped;
+				break;
+			
+			case HDF5WriterOptions::DROP_NEWEST:
+				++stats.dropped;
+				return false;
+		}
+	}
+	writeQueue.push_back( std::make_pair( c, imgNumber ) );
+	stats.queueHighWater = std::max( stats.queueHighWater, (unsigned)writeQueue.size() );
+	secondHighWater      = std::max( secondHighWater, (unsigned)writeQueue.size() );
+	qlock.unlock();
+	ready_cv.notify_all();
+	return true;
+}
+
+void HDF5ImageWriter::WriterThread()
+{
+	HDF5WriterStats last;
+	auto nextStats = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+	
+	std::unique_lock<std::mutex> qlock( queue_mutex );
+	while( !writeErr )
+	{
+		if( std::chrono::steady_clock::now() >= nextStats )
+		{
+			if( opts.printStats )
+				PrintStats( last );
+			nextStats += std::chrono::seconds(1);
+		}
+		
+		std::pair< cv::Mat, size_t > item;
+		if( !writeQueue.empty() )
+		{
+			item = std::move( writeQueue.front() );
+			writeQueue.pop_front();
+		}
+		else if( threadQuit )
+		{
+			break;
+		}
+		else
+		{
+			ready_cv.wait_until( qlock, nextStats );
+			
+			// if there's still nothing to write, we just see if a flush is due.
+			if( !writeQueue.empty() || threadQuit )
+				continue;
+		}
+		writing = true;
+		qlock.unlock();
+		space_cv.notify_all();
+		
+		bool wrote = false;
+		std::exception_ptr err;
+		try
+		{
+			std::lock_guard<std::mutex> flock( file_mutex );
+			if( !item.first.empty() )
+			{
+				WriteImage( item.first, item.second );
+				wrote = true;
+			}
+			if( FlushDue() )
+				FlushFile();
+		}
+		catch(...)
+		{
+			err = std::current_exception();
+		}
+		item.first.release();
+		
+		qlock.lock();
+		writing  = false;
+		writeErr = err;
+		if( wrote )
+			++stats.written;
+		if( writeQueue.empty() || writeErr )
+		{
+			idle_cv.notify_all();
+			space_cv.notify_all();
+		}
+	}
+}
+
+void HDF5ImageWriter::PrintStats( HDF5WriterStats &last )
+{
+	// caller must hold the queue mutex.
+	cout << "hdf5 writer: " << stats.written - last.written << " written, "
+	     << stats.dropped - last.dropped << " dropped, queue high water "
+	     << secondHighWater << "/" << opts.queueLength << endl;
+	last = stats;
+	secondHighWater = writeQueue.size();
+}
+
+HDF5WriterStats HDF5ImageWriter::GetStats()
+{
+	std::lock_guard<std::mutex> qlock( queue_mutex );
+	return stats;
+}
+
+void HDF5ImageWriter::WriteImage( const cv::Mat &img, size_t imgNumber )
+{
+	if( opts.bayer != BAYER_NONE && ( img.type() != CV_8UC1 || img.cols % 2 != 0 || img.rows % 2 != 0 ) )
+		throw std::runtime_error("HDF5ImageWriter: raw Bayer images must be 8 bit, 1 channel, with an even width and height.");
+	
+	if( opts.stacked )
+	{
+		if( !stack )
+			CreateStack( img );
+		if( img.rows != stackRows || img.cols != stackCols || img.type() != stackType )
+			throw std::runtime_error("HDF5ImageWriter: every image in a stacked file must be the same size and type.");
+		
+		size_t ch = img.channels();
+		cv::Mat c = img.isContinuous() ? img : img.clone();
+		stack->resize( { stackLen + 1, (size_t)stackRows, (size_t)stackCols, ch } );
+		HDF5WriteMat( stack->select( { stackLen, 0, 0, 0 }, { 1, (size_t)stackRows, (size_t)stackCols, ch } ), c );
+		
+		uint32_t fno = imgNumber;
+		stackFnos->resize( { stackLen + 1 } );
+		stackFnos->select( { stackLen }, { 1 } ).write( &fno );
+		++stackLen;
+		return;
+	}
+	
+	HDF5FrameInfo fi;
+	fi.fno  = imgNumber;
+	fi.rows = img.rows;
+	fi.cols = img.cols;
+	fi.type = img.type();
+	fi.bayer = opts.bayer;
+	std::string name = HDF5FrameName( fi );
+
+	std::vector<size_t> dims = { (size_t)img.rows * (size_t)img.cols * img.channels() };
 	std::shared_ptr< HighFive::DataSet > dsi;
 	switch( img.type() )
 	{
 		case CV_8UC1:
-			dims = {(size_t)img.rows * (size_t)img.cols * 1 };
-			ss << "1_b";
-			dsi.reset(new HighFive::DataSet(outfi->createDataSet<unsigned char>( ss.str(), HighFive::DataSpace( dims ) ) ) );
-			break;
 		case CV_8UC3:
-			dims = {(size_t)img.rows * (size_t)img.cols * 3 };
-			ss << "3_b";
-			dsi.reset(new HighFive::DataSet(outfi->createDataSet<unsigned char>( ss.str(), HighFive::DataSpace( dims ) ) ) );
+			dsi.reset(new HighFive::DataSet(outfi->createDataSet<unsigned char>( name, HighFive::DataSpace( dims ) ) ) );
 			break;
 		case CV_32FC1:
-			dims = {(size_t)img.rows * (size_t)img.cols * 1 };
-			ss << "1_f";
-			dsi.reset(new HighFive::DataSet(outfi->createDataSet<float>( ss.str(), HighFive::DataSpace( dims ) ) ) );
-			break;
 		case CV_32FC3:
-			dims = { (size_t)img.rows * (size_t)img.cols * 3 };
-			ss << "3_f";
-			dsi.reset(new HighFive::DataSet(outfi->createDataSet<float>( ss.str(), HighFive::DataSpace( dims ) ) ) );
+			dsi.reset(new HighFive::DataSet(outfi->createDataSet<float>( name, HighFive::DataSpace( dims ) ) ) );
 			break;
+		default:
+			throw std::runtime_error("HDF5ImageWriter: can only write 8 bit or float images with 1 or 3 channels.");
 	}
-	cout << ss.str() << endl;
-	dsi->write( img.data );
+	HDF5WriteMat( *dsi, img.isContinuous() ? img : img.clone() );
+
+	newIndexRows.push_back( fi );
+	indexDirty = true;
 }
 
+void HDF5ImageWriter::CreateStack( const cv::Mat &img )
+{
+	stackRows = img.rows;
+	stackCols = img.cols;
+	stackType = img.type();
+	if( stackType != CV_8UC1 && stackType != CV_8UC3 && stackType != CV_32FC1 && stackType != CV_32FC3 )
+		throw std::runtime_error("HDF5ImageWriter: can only write 8 bit or float images with 1 or 3 channels.");
+	
+	size_t ch = img.channels();
+	std::vector<size_t> dims    = { 0, (size_t)stackRows, (size_t)stackCols, ch };
+	std::vector<size_t> maxDims = { HighFive::DataSpace::UNLIMITED, (size_t)stackRows, (size_t)stackCols, ch };
+	
+	// one frame per chunk, so reading a frame is reading a chunk.
+	HighFive::DataSetCreateProps props;
+	props.add( HighFive::Chunking( { 1, (hsize_t)stackRows, (hsize_t)stackCols, (hsize_t)ch } ) );
+	
+	bool lz4 = false;
+	if( opts.lz4 )
+	{
+		lz4 = H5Zfilter_avail( HDF5_LZ4_FILTER ) > 0;
+		if( lz4 )
+			props.add( HDF5PluginFilter( HDF5_LZ4_FILTER ) );
+		else
+			cout << "HDF5ImageWriter: LZ4 filter plugin not available (is HDF5_PLUGIN_PATH set?)" << endl;
+	}
+	if( !lz4 && opts.deflate > 0 )
+	{
+		// shuffling the bytes of floats makes them compress much better.
+		if( CV_MAT_DEPTH( stackType ) == CV_32F )
+			props.add( HighFive::Shuffle() );
+		props.add( HighFive::Deflate( std::min( opts.deflate, 9 ) ) );
+	}
+	
+	if( CV_MAT_DEPTH( stackType ) == CV_32F )
+		stack.reset( new HighFive::DataSet( outfi->createDataSet<float>( HDF5_STACK_NAME, HighFive::DataSpace( dims, maxDims ), props ) ) );
+	else
+		stack.reset( new HighFive::DataSet( outfi->createDataSet<unsigned char>( HDF5_STACK_NAME, HighFive::DataSpace( dims, maxDims ), props ) ) );
+	if( opts.bayer != BAYER_NONE )
+		stack->createAttribute( "bayer", (int)opts.bayer );
+	
+	HighFive::DataSetCreateProps fnoProps;
+	fnoProps.add( HighFive::Chunking( { 1024 } ) );
+	std::vector<size_t> fnoDims = { 0 }, fnoMaxDims = { HighFive::DataSpace::UNLIMITED };
+	stackFnos.reset( new HighFive::DataSet( outfi->createDataSet<uint32_t>( HDF5_STACK_FNO_NAME, HighFive::DataSpace( fnoDims, fnoMaxDims ), fnoProps ) ) );
+	stackLen = 0;
+}
+
+void HDF5ImageWriter::WriteIndex()
+{
+	// the index is extendible, like the stack, so a flush only writes the rows
+	// for the images since the last one.
+	if( !indexDs )
+	{
+		HighFive::DataSetCreateProps props;
+		props.add( HighFive::Chunking( { 1024, HDF5_INDEX_COLS } ) );
+		std::vector<size_t> dims = { 0, HDF5_INDEX_COLS }, maxDims = { HighFive::DataSpace::UNLIMITED, HDF5_INDEX_COLS };
+		indexDs.reset( new HighFive::DataSet( outfi->createDataSet<uint32_t>( HDF5_INDEX_NAME, HighFive::DataSpace( dims, maxDims ), props ) ) );
+		indexRows = 0;
+	}
+	
+	size_t n = newIndexRows.size();
+	if( n > 0 )
+	{
+		std::vector< uint32_t > raw( n * HDF5_INDEX_COLS, 0 );
+		for( unsigned fc = 0; fc < n; ++fc )
+		{
+			uint32_t *r = &raw[ fc * HDF5_INDEX_COLS ];
+			r[0] = newIndexRows[fc].fno;
+			r[1] = newIndexRows[fc].rows;
+			r[2] = newIndexRows[fc].cols;
+			r[3] = newIndexRows[fc].type;
+			r[4] = newIndexRows[fc].bayer;
+		}
+		
+		indexDs->resize( { indexRows + n, HDF5_INDEX_COLS } );
+		indexDs->select( { indexRows, 0 }, { n, HDF5_INDEX_COLS } ).write( raw.data() );
+		indexRows += n;
+		newIndexRows.clear();
+	}
+	indexDirty = false;
+}
 
 void HDF5ImageWriter::Flush()
 {
+	if( writerThread.joinable() )
+	{
+		std::unique_lock<std::mutex> qlock( queue_mutex );
+		while( ( !writeQueue.empty() || writing ) && !writeErr )
+			idle_cv.wait( qlock );
+		if( writeErr )
+			std::rethrow_exception( writeErr );
+	}
+	
+	std::lock_guard<std::mutex> flock( file_mutex );
+	FlushFile();
+}
+
+bool HDF5ImageWriter::FlushDue()
+{
+	// caller must hold the file mutex.
+	return opts.flushInterval > 0 && std::chrono::steady_clock::now() - lastFlush >= std::chrono::duration<float>( opts.flushInterval );
+}
+
+void HDF5ImageWriter::FlushFile()
+{
+	// caller must hold the file mutex.
+	if( indexDirty )
+		WriteIndex();
 	outfi->flush();
+	lastFlush = std::chrono::steady_clock::now();
 }
 
 
@@ -76,7 +609,7 @@ void HDF5ImageWriter::Flush()
 
 
 
-HDF5Source::HDF5Source( std::string in_filepath, std::string in_calibPath )
+HDF5Source::HDF5Source( std::string in_filepath, std::string in_calibPath, int prefetchDepth )
 {
 	//
 	// Input filepath can be of the format:
@@ -102,34 +635,156 @@ HDF5Source::HDF5Source( std::string in_filepath, std::string in_calibPath )
 	cout << "opening: " << filepath << endl;
 	infi = new HighFive::File( filepath, HighFive::File::ReadOnly );
 	
-	// get list of dataset names from file
-	dsList = infi->listObjectNames();
+	// what is in the file - quickly from the index if there is one.
+	if( infi->exist( HDF5_STACK_NAME ) )
+	{
+		OpenStack();
+	}
+	else if( !ReadHDF5FrameIndex( *infi, frames ) )
+	{
+		cout << "hdf5 source: no frame index, looking at every dataset name..." << endl;
+		ScanHDF5FrameNames( *infi, frames, dsNames );
+	}
+	if( frames.size() == 0 )
+	{
+		delete infi;
+		throw std::runtime_error( "hdf5 source: no images in " + filepath );
+	}
+	framesDense = frames.back().fno - frames.front().fno + 1 == frames.size();
+	MakeBlank();
 	
-	// map frame index to frame number from dataset name
-	for( unsigned lc = 0; lc < dsList.size(); ++lc )
+	calibPath = in_calibPath;
+	
+	if( prefetchDepth < 0 )
 	{
-		auto a = dsList[ lc ].find("_");
-		std::string numStr = std::string( dsList[ lc ].begin(), dsList[ lc ].begin() + a );
-		unsigned fno = std::atoi( numStr.c_str() );
-		
-//		cout << lc << " " << dsList[lc] << " " << fno << endl;
-		
-		idx2fno[ lc ] = fno;
-		fno2idx[ fno ] = lc;
+		CommonConfig ccfg;
+		prefetchDepth = ccfg.imgDirPrefetchDepth;
 	}
+	depth = prefetchDepth;
 	
+	// enough open datasets for the read-ahead queue, and a few frames either side of it.
+	dsCacheSize = 2 * depth + 8;
 	
 	FindImage();
 	
-	calibPath = in_calibPath;
+	fetchFrameNo = currentFrameNo + 1;
+	queueGen     = 0;
+	threadQuit   = false;
+	pool.SetMaxBuffers( 2 * depth + 4 );
+	if( depth > 0 )
+	{
+		prefetchThread = std::thread( &HDF5Source::PrefetchThread, this );
+	}
 }
 
 
+void HDF5Source::OpenStack()
+{
+	stack.reset( new HighFive::DataSet( infi->getDataSet( HDF5_STACK_NAME ) ) );
+	std::vector< size_t > dims = stack->getSpace().getDimensions();
+	int type = HDF5StackType( *stack, dims );
+	int bayer = BAYER_NONE;
+	if( stack->hasAttribute("bayer") )
+		stack->getAttribute("bayer").read( bayer );
+	
+	std::vector< uint32_t > fnos;
+	if( infi->exist( HDF5_STACK_FNO_NAME ) )
+	{
+		HighFive::DataSet fds = infi->getDataSet( HDF5_STACK_FNO_NAME );
+		fnos.resize( fds.getSpace().getDimensions()[0] );
+		if( fnos.size() > 0 )
+			fds.read( fnos.data() );
+	}
+	
+	// frames are normally written in order, but don't have to be.
+	std::vector< std::pair< uint32_t, unsigned > > order;
+	for( unsigned rc = 0; rc < std::min( dims[0], fnos.size() ); ++rc )
+		order.push_back( std::make_pair( fnos[rc], rc ) );
+	std::sort( order.begin(), order.end() );
+	
+	frames.resize( order.size() );
+	stackRows.resize( order.size() );
+	for( unsigned fc = 0; fc < order.size(); ++fc )
+	{
+		frames[fc].fno  = order[fc].first;
+		frames[fc].rows = dims[1];
+		frames[fc].cols = dims[2];
+		frames[fc].type = type;
+		frames[fc].bayer = (bayerPattern_t)bayer;
+		stackRows[fc]   = order[fc].second;
+	}
+}
+
 HDF5Source::~HDF5Source()
 {
+	if( prefetchThread.joinable() )
+	{
+		std::unique_lock<std::mutex> lock( queue_mutex );
+		threadQuit = true;
+		lock.unlock();
+		space_cv.notify_all();
+		prefetchThread.join();
+	}
+	
+	dsCache.clear();
+	dsLru.clear();
+	stack.reset();
 	delete infi;
 }
 
+void HDF5Source::PrefetchThread()
+{
+	std::unique_lock<std::mutex> qlock( queue_mutex );
+	while( !threadQuit )
+	{
+		if( frameQueue.size() >= depth || fetchErr || (int)fetchFrameNo >= GetNumImages() )
+		{
+			space_cv.wait( qlock );
+			continue;
+		}
+		unsigned frame = fetchFrameNo++;
+		unsigned gen   = queueGen;
+		qlock.unlock();
+		
+		cv::Mat img;
+		std::exception_ptr err;
+		try
+		{
+			img = ReadFrame( frame );
+		}
+		catch(...)
+		{
+			err = std::current_exception();
+		}
+		
+		qlock.lock();
+		
+		// if the source jumped while we were reading, this frame is no use.
+		if( gen != queueGen )
+			continue;
+		
+		if( err )
+			fetchErr = err;
+		else
+			frameQueue.push_back( std::make_pair( frame, img ) );
+		ready_cv.notify_all();
+	}
+}
+
+void HDF5Source::RestartPrefetch( unsigned from )
+{
+	if( depth == 0 )
+		return;
+	
+	std::unique_lock<std::mutex> qlock( queue_mutex );
+	++queueGen;
+	frameQueue.clear();
+	fetchErr     = nullptr;
+	fetchFrameNo = from;
+	qlock.unlock();
+	space_cv.notify_all();
+}
+
 cv::Mat HDF5Source::GetCurrent()
 {
 	return current;
@@ -137,13 +792,34 @@ cv::Mat HDF5Source::GetCurrent()
 
 bool HDF5Source::Advance()
 {
-	if( currentFrameNo < GetNumImages() - 1 )
+	if( currentFrameNo >= GetNumImages() - 1 )
+		return false;
+	++currentFrameNo;
+	
+	if( depth > 0 )
 	{
-		++currentFrameNo;
-		FindImage();
-		return true;
+		// the queue holds the frames straight after the current one.
+		std::unique_lock<std::mutex> qlock( queue_mutex );
+		while( frameQueue.empty() && !fetchErr )
+			ready_cv.wait( qlock );
+		
+		if( !frameQueue.empty() && frameQueue.front().first == (unsigned)currentFrameNo )
+		{
+			current = std::move( frameQueue.front().second );
+			frameQueue.pop_front();
+			qlock.unlock();
+			space_cv.notify_all();
+			return true;
+		}
+		qlock.unlock();
+		
+		// the read ahead went wrong - start again from here, and if the
+		// problem is still there, FindImage() will tell the caller.
+		RestartPrefetch( currentFrameNo + 1 );
 	}
-	else return false;
+	
+	FindImage();
+	return true;
 }
 
 
@@ -152,6 +828,7 @@ bool HDF5Source::Regress()
 	if( currentFrameNo > 0 )
 	{
 		--currentFrameNo;
+		RestartPrefetch( currentFrameNo + 1 );
 		FindImage();
 		return true;
 	}
@@ -173,72 +850,141 @@ int HDF5Source::GetNumImages()
 {
 	// what we really want to do is return our largest frame number
 	// so not this: return dsList.size();
-	//cout << "hdf5 fnos: " <<  fno2idx.begin()->first << " " << fno2idx.rbegin()->first << endl;
-	return fno2idx.rbegin()->first;
+	return frames.back().fno;
 }
 
 
 bool HDF5Source::JumpToFrame(unsigned frame)
 {
+	// stepping on by one is what the read ahead is for.
+	if( depth > 0 && (int)frame == currentFrameNo + 1 && currentFrameNo < GetNumImages() - 1 )
+		return Advance();
+	
 	currentFrameNo = frame;
+	RestartPrefetch( currentFrameNo + 1 );
 	FindImage();
+	return true;
 }
 
 void HDF5Source::FindImage()
 {
-//	cout << "Finding frame number: " << currentFrameNo << endl;
-	auto i = fno2idx.find( currentFrameNo );
-	if( i == fno2idx.end() )
-	{
-//		cout << "\t" << "no such frame no" << endl;
-		// make a blank image the same size as the first image we can get.
-		dsIdx = fno2idx.begin()->second;
-		GetImage();
-		
-		current = cv::Mat( current.rows, current.cols, current.type(), cv::Scalar(0) );
-	}
-	else
+	current = ReadFrame( currentFrameNo );
+}
+
+cv::Mat HDF5Source::GetFrame( unsigned frame )
+{
+	return ReadFrame( frame );
+}
+
+cv::Mat HDF5Source::ReadFrame( unsigned frame )
+{
+	int idx = FindFrame( frame );
+	if( idx < 0 )
 	{
-//		cout << "\t" << currentFrameNo << " had idx : " << i->second << endl;
-		dsIdx = i->second;
-		GetImage();
+		// a new image every time, as callers are free to draw on what they get.
+		std::lock_guard<std::mutex> lock( h5mutex );
+		cv::Mat img = pool.Get( blank.rows, blank.cols, blank.type() );
+		blank.copyTo( img );
+		return img;
 	}
+	return ReadDataset( idx );
+}
+
+void HDF5Source::MakeBlank()
+{
+	// caller must hold the h5mutex.
+	// a black image the same size as the first image will be, without having to read it.
+	const HDF5FrameInfo &first = frames[0];
+	int type = first.type;
+	if( first.bayer != BAYER_NONE )
+		type = readOpts.bayerGray ? CV_8UC1 : CV_8UC3;
+	cv::Rect o = readOpts.OutputRect( first.cols, first.rows );
+	blank = cv::Mat( o.height, o.width, type, cv::Scalar(0) );
 }
 
-void HDF5Source::GetImage()
+bool HDF5Source::SetDecodeOptions( const LoadImageOptions &opts )
 {
-	HighFive::DataSet dsi = infi->getDataSet( dsList[ dsIdx ] );
+	std::unique_lock<std::mutex> lock( h5mutex );
+	UpdateDecodeCalibration( opts, current.size() );
+	readOpts = opts;
+	MakeBlank();
+	lock.unlock();
 	
-	auto ss = SplitLine( dsList[ dsIdx ], "_");
-	for( unsigned c = 0; c < ss.size(); ++c )
-	{
-//		cout << c << " " << ss[c] << endl;
-	}
-	// we should have [ frameNumber, rows, cols, channels, type ]
-	if( ss[3].compare("1") == 0 && ss[4].compare("b") == 0 )
-	{
-		current = cv::Mat( std::atoi( ss[1].c_str()), std::atoi(ss[2].c_str()), CV_8UC1 );
-	}
-	else if( ss[3].compare("3") == 0 && ss[4].compare("b") == 0 )
-	{
-		current = cv::Mat( std::atoi( ss[1].c_str()), std::atoi(ss[2].c_str()), CV_8UC3 );
-	}
-	else if( ss[3].compare("1") == 0 && ss[4].compare("f") == 0 )
+	// everything already read is the wrong size now.
+	RestartPrefetch( currentFrameNo + 1 );
+	FindImage();
+	return true;
+}
+
+int HDF5Source::FindFrame( unsigned fno )
+{
+	if( fno < frames.front().fno || fno > frames.back().fno )
+		return -1;
+	
+	if( framesDense )
+		return fno - frames.front().fno;
+	
+	auto i = std::lower_bound( frames.begin(), frames.end(), fno, []( const HDF5FrameInfo &a, unsigned f ) { return a.fno < f; } );
+	if( i == frames.end() || i->fno != fno )
+		return -1;
+	return i - frames.begin();
+}
+
+cv::Mat HDF5Source::ReadDataset( unsigned idx )
+{
+	const HDF5FrameInfo &fi = frames[ idx ];
+	cv::Mat img = pool.Get( fi.rows, fi.cols, fi.type );
+	
+	std::unique_lock<std::mutex> lock( h5mutex );
+	LoadImageOptions opts = readOpts;
+	if( stack )
 	{
-		current = cv::Mat( std::atoi( ss[1].c_str()), std::atoi(ss[2].c_str()), CV_32FC1 );
+		HDF5ReadMat( stack->select( { stackRows[ idx ], 0, 0, 0 }, { 1, (size_t)fi.rows, (size_t)fi.cols, (size_t)img.channels() } ), img );
 	}
-	else if( ss[3].compare("3") == 0 && ss[4].compare("f") == 0 )
+	else
 	{
-		current = cv::Mat( std::atoi( ss[1].c_str()), std::atoi(ss[2].c_str()), CV_32FC3 );
+		HDF5ReadMat( GetDataset( idx ), img );
 	}
+	lock.unlock();
+	
+	// demosaic / scale outside of the lock, so that threads can do it at the same time.
+	if( fi.bayer == BAYER_NONE && opts.IsDefault() )
+		return img;
+	
+	cv::Mat out;
+	if( fi.bayer != BAYER_NONE )
+		DecodeBayer( img, fi.bayer, out, opts, &pool );
 	else
+		ApplyLoadOptions( img, out, opts, &pool );
+	return out;
+}
+
+HighFive::DataSet &HDF5Source::GetDataset( unsigned idx )
+{
+	// caller must hold the h5mutex.
+	auto i = dsCache.find( idx );
+	if( i != dsCache.end() )
 	{
-		cout << "didn't understand string: " << dsList[ dsIdx ] << endl;
-		throw std::runtime_error( "Error with hdf5 source" );
+		dsLru.splice( dsLru.begin(), dsLru, i->second.lruPos );
+		return *i->second.ds;
 	}
 	
+	const HDF5FrameInfo &fi = frames[ idx ];
+	std::string name = dsNames.empty() ? HDF5FrameName( fi ) : dsNames[ idx ];
 	
-	dsi.read( current.data );
+	std::shared_ptr< HighFive::DataSet > ds( new HighFive::DataSet( infi->getDataSet( name ) ) );
+	dsLru.push_front( idx );
+	OpenDataset &od = dsCache[ idx ];
+	od.ds     = ds;
+	od.lruPos = dsLru.begin();
+	
+	// close the ones we haven't used for longest.
+	while( dsCache.size() > dsCacheSize )
+	{
+		dsCache.erase( dsLru.back() );
+		dsLru.pop_back();
+	}
+	return *ds;
 }
 
 #endif
@@ -5,13 +5,113 @@
 #undef None
 #include <highfive/H5File.hpp>
 #include "imgio/imagesource.h"
+#include "imgio/imgCodec.h"
 
+#include <mutex>
+#include <deque>
+#include <list>
 #include <map>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 
 //
 // Two things we want to do.
 //
+// Each image is its own dataset, named <frame number>_<rows>_<cols>_<channels>_<b|f>, or
+// with the Bayer pattern (e.g. "rggb") in place of b|f for raw Bayer images.
+// Listing and parsing the names of a million datasets takes a long time though, so the
+// writer also keeps a "frameIndex" dataset: one row of HDF5_INDEX_COLS numbers per image,
+// (frame number, rows, cols, OpenCV type, Bayer pattern) in the order the images were written,
+// which the source can read in one go. The index is extendible and each flush only appends the
+// new rows. Files without an index (or with one that doesn't match the file) are still opened
+// by scanning the names.
+//
+// For a camera stream, where every frame is the same size, that is still a lot of HDF5
+// objects. The "stacked" layout instead appends every frame to one extendible N x H x W x C
+// dataset called "frames", chunked one frame per chunk so any frame is one read, and
+// optionally compressed. The frame number of each row is in the 1D "frameNumbers" dataset,
+// and raw Bayer frames have the pattern in the "bayer" attribute of the frames dataset.
+//
+
+#define HDF5_INDEX_NAME "frameIndex"
+#define HDF5_INDEX_COLS 5
+
+#define HDF5_STACK_NAME "frames"
+#define HDF5_STACK_FNO_NAME "frameNumbers"
+
+// registered id of the LZ4 filter plugin (https://github.com/HDFGroup/hdf5_plugins)
+#define HDF5_LZ4_FILTER 32004
+
+// what we know about each image dataset in the file.
+struct HDF5FrameInfo
+{
+	unsigned fno;
+	int rows, cols, type;
+	bayerPattern_t bayer;
+};
 
+// parse a dataset name of the form <frame number>_<rows>_<cols>_<channels>_<b|f|bayer pattern>
+bool ParseHDF5FrameName( const std::string &name, HDF5FrameInfo &info );
+
+// ... and make one.
+std::string HDF5FrameName( const HDF5FrameInfo &info );
+
+// read the frame index of the file. Returns false if there isn't a usable one.
+bool ReadHDF5FrameIndex( HighFive::File &file, std::vector< HDF5FrameInfo > &frames );
+
+// find the images in the file from the dataset names, the slow way. If any of the names
+// aren't exactly what HDF5FrameName() would make, names gets the name of every image.
+void ScanHDF5FrameNames( HighFive::File &file, std::vector< HDF5FrameInfo > &frames, std::vector< std::string > &names );
+
+
+struct HDF5WriterOptions
+{
+	HDF5WriterOptions() : stacked(false), deflate(0), lz4(false), bayer(BAYER_NONE), queueLength(0), whenFull(BLOCK), flushInterval(0), printStats(false) {}
+	
+	// use the stacked layout. Every image must then be the same size and type.
+	bool stacked;
+	
+	// stacked layout only: gzip compression level, 1 to 9, or 0 for none.
+	int deflate;
+	
+	// stacked layout only: compress with the LZ4 filter plugin, which is much faster than
+	// gzip. Ignored (with a warning) if the HDF5 library can't find the plugin.
+	bool lz4;
+	
+	// the images are raw Bayer mosaics with this pattern (so must be CV_8UC1, with an
+	// even width and height), which HDF5Source will demosaic.
+	bayerPattern_t bayer;
+	
+	//
+	// For capturing from a live camera, the writer can take images off the caller
+	// straight away and write them on its own thread. AddImage() then copies the image
+	// onto a queue of up to queueLength images, and if the disk can't keep up and the
+	// queue is full, it either waits for space (BLOCK), throws away the oldest image
+	// in the queue (DROP_OLDEST) or doesn't add the new image (DROP_NEWEST).
+	// queueLength 0 writes the image in AddImage().
+	//
+	unsigned queueLength;
+	enum FullPolicy { BLOCK, DROP_OLDEST, DROP_NEWEST } whenFull;
+	
+	// flush the file at least this often (seconds), so a crash loses little. 0 means only
+	// flush when asked to, or when the writer is destroyed.
+	float flushInterval;
+	
+	// with a queue, print the counters from GetStats() for each second.
+	bool printStats;
+};
+
+struct HDF5WriterStats
+{
+	HDF5WriterStats() : added(0), written(0), dropped(0), queueHighWater(0) {}
+	
+	uint64_t added;           // images given to AddImage()
+	uint64_t written;         // images that made it into the file
+	uint64_t dropped;         // images thrown away because the queue was full
+	unsigned queueHighWater;  // most images waiting in the queue at once
+};
 
 //
 // First is a small class for writing data to hdf5 files.
@@ -19,19 +119,63 @@
 class HDF5ImageWriter
 {
 public:
-	HDF5ImageWriter( std::string outfn );
+	// if the file exists, the new images are added to it, using whichever layout it already has.
+	HDF5ImageWriter( std::string outfn, HDF5WriterOptions in_opts = HDF5WriterOptions() );
 	~HDF5ImageWriter();
 	
 	
-	void AddImage( cv::Mat &img, size_t imgNumber );
+	// returns false if the image was dropped. The writer keeps a copy
+	// of the image, so the caller is free to change it straight away.
+	bool AddImage( cv::Mat &img, size_t imgNumber );
 	
+	// writes the frame index too. With a queue, waits for the queue to be written first.
 	void Flush();
 	
+	// since the writer was made.
+	HDF5WriterStats GetStats();
+	
 protected:
 	
 	HighFive::File* outfi;
-
-
+	HDF5WriterOptions opts;
+	std::mutex file_mutex;    // held by whoever is using outfi
+	
+	void WriteImage( const cv::Mat &img, size_t imgNumber );
+	void FlushFile();
+	std::chrono::steady_clock::time_point lastFlush;
+	
+	//
+	// the queue for asynchronous writing. Lock order is file, then queue.
+	//
+	void WriterThread();
+	bool FlushDue();
+	void PrintStats( HDF5WriterStats &last );
+	
+	std::deque< std::pair< cv::Mat, size_t > > writeQueue;
+	ImageBufferPool pool;
+	HDF5WriterStats stats;
+	unsigned secondHighWater;  // queue high water since the last PrintStats()
+	bool writing;
+	std::exception_ptr writeErr;
+	std::mutex queue_mutex;
+	std::condition_variable space_cv;  // tells AddImage() there is room in the queue
+	std::condition_variable ready_cv;  // tells the writer thread there is an image in the queue
+	std::condition_variable idle_cv;   // tells Flush() the queue has been written
+	std::thread writerThread;
+	bool threadQuit;
+	
+	// rows of the frame index that aren't in the file yet.
+	std::vector< HDF5FrameInfo > newIndexRows;
+	std::shared_ptr< HighFive::DataSet > indexDs;
+	size_t indexRows;
+	bool indexDirty;
+	void WriteIndex();
+	
+	// stacked layout. The datasets are made when the first image arrives.
+	void CreateStack( const cv::Mat &img );
+	std::shared_ptr< HighFive::DataSet > stack, stackFnos;
+	size_t stackLen;
+	int stackRows, stackCols, stackType;
 };
 
 
@@ -39,10 +183,18 @@ protected:
 //
 // Second is an image source for reading from hdf5 files.
 //
-class HDF5Source : public ImageSource
+// The frame index is read once when the file is opened, dataset handles are kept
+// once they have been opened, and a thread reads the next few frames ahead of the
+// current frame.
+//
+class HDF5Source : public ImageSource, public FrameProvider
 {
 public:
-	HDF5Source( std::string in_filepath, std::string in_calibPath );
+	//
+	// prefetchDepth is how many frames to read ahead of the current frame. 0 means read
+	// on the caller's thread, and a negative value uses imgDirPrefetchDepth from the user's CommonConfig.
+	//
+	HDF5Source( std::string in_filepath, std::string in_calibPath, int prefetchDepth = -1 );
 	~HDF5Source();
 	
 	cv::Mat GetCurrent();
@@ -60,21 +212,79 @@ public:
 			calibration.Write( calibPath );
 	}
 	
+	// read any frame without changing the current frame. The HDF5 library
+	// isn't thread safe, so threads take turns reading from the file.
+	cv::Mat GetFrame( unsigned frame );
+	
+	// images are scaled and cropped after they are read, apart from raw Bayer
+	// images, which are demosaiced straight to the size we want (see DecodeBayer).
+	bool SetDecodeOptions( const LoadImageOptions &opts );
+	
 protected:
 	
 	
 	HighFive::File* infi;
+	std::mutex h5mutex;
 	
-	std::vector< std::string > dsList;
-	std::map<unsigned, unsigned> idx2fno, fno2idx;
-	int dsIdx;
+	// sorted by frame number. When there are no gaps, frame f is at f - frames[0].fno.
+	std::vector< HDF5FrameInfo > frames;
+	bool framesDense;
+	int FindFrame( unsigned fno );
 	
-	void FindImage();
-	void GetImage();
-	cv::Mat current;
+	// only for files with dataset names we can't make again from the index.
+	std::vector< std::string > dsNames;
+	
+	// stacked layout: the frames dataset, and the row of it for each entry of frames.
+	void OpenStack();
+	std::shared_ptr< HighFive::DataSet > stack;
+	std::vector< unsigned > stackRows;
+	
+	// the datasets we've opened most recently, by index into frames. Only use with the h5mutex.
+	// Each open dataset costs memory in HDF5, so only the ones around the current and 
+	// read-ahead frames are kept open (in LRU order), not one for every frame we ever read.
+	struct OpenDataset
+	{
+		std::shared_ptr< HighFive::DataSet > ds;
+		std::list< unsigned >::iterator lruPos;
+	};
+	std::map< unsigned, OpenDataset > dsCache;
+	std::list< unsigned > dsLru;
+	unsigned dsCacheSize;
+	HighFive::DataSet &GetDataset( unsigned idx );
+	
+	// for the frames we don't have. Only use with the h5mutex.
+	cv::Mat blank;
+	void MakeBlank();
+	
+	// what SetDecodeOptions() asked for. Only use with the h5mutex.
+	LoadImageOptions readOpts;
 	
-	int maxFrame, minFrame;
+	// read a frame - missing frames give a copy of the blank image.
+	cv::Mat ReadFrame( unsigned frame );
+	cv::Mat ReadDataset( unsigned idx );
 	
+	// frames we read go into these, to save allocating for every frame.
+	ImageBufferPool pool;
+	
+	//
+	// read-ahead.
+	//
+	void PrefetchThread();
+	void RestartPrefetch( unsigned from );
+	
+	unsigned depth;
+	unsigned fetchFrameNo;      // next frame the prefetch thread will read
+	unsigned queueGen;          // changes whenever the queue is thrown away
+	std::deque< std::pair< unsigned, cv::Mat > > frameQueue;
+	std::exception_ptr fetchErr;
+	std::mutex queue_mutex;
+	std::condition_variable space_cv;  // tells the prefetch thread there is room in the queue
+	std::condition_variable ready_cv;  // tells Advance() there is a frame in the queue
+	std::thread prefetchThread;
+	bool threadQuit;
+	
+	void FindImage();
+	cv::Mat current;
 	
 	//
 	// We operate on the approach that we can have synchronised images sources,
@@ -1,60 +1,175 @@
 #include "imgio/imagesource.h"
 
+#include "imgio/dirManifest.h"
+#include "commonConfig/commonConfig.h"
+
+#include <chrono>
+
 // the most basic image source is a directory of images.
+//
+// To keep up with heavy processing, we keep a ring of decoded frames ahead
+// of the current frame, which a small pool of threads keeps topped up.
 void ImageDirectory::PreFetchThread()
 {
+	std::unique_lock<std::mutex> lock( ring_mutex );
 	while( !threadQuit )
 	{
-		// wait for trigger
-		std::unique_lock<std::mutex> lock( nextImage_mutex );
-		while( !getNext && !threadQuit )
+		// wait until there is something to decode.
+		unsigned slot;
+		int frame;
+		if( !NextJob( slot, frame ) )
 		{
-			if( threadQuit )
-				continue;
-			nextImage_cv.wait( lock );
+			ring_cv.wait( lock );
+			continue;
 		}
 		
-		// read image 
-		if( frameIdx+1  < imageList.size() )
+		// claim the slot, then let go of the mutex while we do the slow bit.
+		PreFetchSlot &ps = ring[slot];
+		ps.frame   = frame;
+		ps.gen     = ringGen;
+		ps.loading = true;
+		ps.ready   = false;
+		ps.img.release();
+		ps.err     = nullptr;
+		std::string fn = imageList[frame];
+		LoadImageOptions opts = decodeOpts;
+		lock.unlock();
+		
+		cv::Mat img;
+		std::exception_ptr err;
+		try
 		{
-			//std::cout << "\n*\n*\n*\n*\nprefetch load \n*\n*\n*\n*" << std::endl;
-			nextImage = LoadImage( imageList[frameIdx+1] );
+			img = LoadImage( fn, pool, opts );
+		}
+		catch(...)
+		{
+			// hand the problem over to whoever wants this frame.
+			err = std::current_exception();
 		}
 		
-		// release mutex and allow anyone waiting on us to continue.
-		getNext = false;
-		lock.unlock();
-		nextImage_cv.notify_one();
-		
+		lock.lock();
+		ps.loading = false;
+		if( ps.gen == ringGen )
+		{
+			ps.img   = img;
+			ps.err   = err;
+			ps.ready = true;
+		}
+		else
+		{
+			// image list was changed under us, so this frame is junk.
+			ps.frame = -1;
+		}
+		ready_cv.notify_all();
 	}
 }
 
-ImageDirectory::ImageDirectory( std::string in_path )
+int ImageDirectory::FindSlot( int frame )
 {
-	this->path = in_path;
-	
-	// find the images in the directory.
-	boost::filesystem::path p(path);
-	
-	if( boost::filesystem::exists(p) && boost::filesystem::is_directory(p))
+	for( unsigned sc = 0; sc < ring.size(); ++sc )
 	{
-		boost::filesystem::directory_iterator di(p), endi;
-		for( ; di != endi; ++di )
+		if( ring[sc].frame == frame && ring[sc].gen == ringGen )
+			return sc;
+	}
+	return -1;
+}
+
+bool ImageDirectory::NextJob( unsigned &slot, int &frame )
+{
+	// the window of frames we want decoded is (frameIdx, frameIdx + depth],
+	// and we want the nearest frames first.
+	int first = (int)frameIdx + 1;
+	int last  = std::min( (int)frameIdx + (int)ring.size(), (int)imageList.size() - 1 );
+	for( int f = first; f <= last; ++f )
+	{
+		if( FindSlot( f ) >= 0 )
+			continue;
+		
+		// any slot not being loaded, and which holds nothing in the window, is free.
+		for( unsigned sc = 0; sc < ring.size(); ++sc )
 		{
-			std::string s = di->path().string();
-			
-			if( IsImage(s) )
+			const PreFetchSlot &ps = ring[sc];
+			if( ps.loading )
+				continue;
+			if( ps.frame < first || ps.frame > last || ps.gen != ringGen )
 			{
-				imageList.push_back(s);
+				slot  = sc;
+				frame = f;
+				return true;
 			}
 		}
+		
+		// no free slots.
+		return false;
 	}
-	else
+	return false;
+}
+
+void ImageDirectory::StartPreFetch( unsigned in_depth, unsigned in_threads )
+{
+	if( in_depth == 0 || in_threads == 0 )
+	{
+		CommonConfig ccfg;
+		if( in_depth == 0 )
+			in_depth = ccfg.imgDirPrefetchDepth;
+		if( in_threads == 0 )
+			in_threads = ccfg.imgDirPrefetchThreads;
+	}
+	
+	// no point having more threads than frames to decode.
+	in_depth   = std::max( 1u, in_depth );
+	in_threads = std::max( 1u, std::min( in_threads, in_depth ) );
+	
+	PreFetchSlot empty;
+	empty.frame   = -1;
+	empty.gen     = 0;
+	empty.loading = false;
+	empty.ready   = false;
+	ring.assign( in_depth, empty );
+	ringGen = 0;
+	
+	// enough buffers for the ring, the current frame, and a few held by the caller.
+	pool.SetMaxBuffers( in_depth + in_threads + 4 );
+	
+	ResetPrefetchStats();
+	
+	threadQuit = false;
+	for( unsigned tc = 0; tc < in_threads; ++tc )
+	{
+		preFetchThreads.push_back( std::thread( &ImageDirectory::PreFetchThread, this ) );
+	}
+}
+
+void ImageDirectory::FindImages()
+{
+	// find the images in the directory - from its manifest if we can,
+	// as listing a big directory can be very slow.
+	boost::filesystem::path p(path);
+	if( !boost::filesystem::exists(p) || !boost::filesystem::is_directory(p) )
 	{
 		throw std::runtime_error("Could not find image source directory.");
 	}
 	
-	std::sort( imageList.begin(), imageList.end() );
+	CommonConfig ccfg;
+	std::vector< DirManifestEntry > entries = ListDirectory( path, ccfg.imgDirManifest );
+	
+	// the listing is sorted by name, so the image list is sorted too.
+	imageList.clear();
+	for( unsigned ec = 0; ec < entries.size(); ++ec )
+	{
+		std::string s = (p / entries[ec].name).string();
+		if( IsImage(s) )
+		{
+			imageList.push_back(s);
+		}
+	}
+}
+
+ImageDirectory::ImageDirectory( std::string in_path, unsigned prefetchDepth, unsigned prefetchThreads )
+{
+	this->path = in_path;
+	
+	FindImages();
 	
 	// find the calibration file in the directory and read it.
 	// if there's no file, this will return false, but we'll still
@@ -66,41 +181,18 @@ ImageDirectory::ImageDirectory( std::string in_path )
 	frameIdx = 0;
 	ReadImage();
 	
-	// start the pre-fetch thread.
+	// start the pre-fetch threads.
 	// If we're doing heavy processing, we don't want to have to also wait to
 	// read the next image from disk if we don't have to.
-	getNext = true;
-	threadQuit = false;
-	preFetchThread = std::thread( &ImageDirectory::PreFetchThread, this );
+	StartPreFetch( prefetchDepth, prefetchThreads );
 	
 }
 
-ImageDirectory::ImageDirectory( std::string in_path, std::string in_calibPath )
+ImageDirectory::ImageDirectory( std::string in_path, std::string in_calibPath, unsigned prefetchDepth, unsigned prefetchThreads )
 {
 	this->path = in_path;
 
-	// find the images in the directory.
-	boost::filesystem::path p(path);
-
-	if( boost::filesystem::exists(p) && boost::filesystem::is_directory(p))
-	{
-		boost::filesystem::directory_iterator di(p), endi;
-		for( ; di != endi; ++di )
-		{
-			std::string s = di->path().string();
-			
-			if( IsImage(s) )
-			{
-				imageList.push_back(s);
-			}
-		}
-	}
-	else
-	{
-		throw std::runtime_error("Could not find image source directory.");
-	}
-
-	std::sort( imageList.begin(), imageList.end() );
+	FindImages();
 
 	// find the calibration file in the directory and read it.
 	// if there's no file, this will return false, but we'll still
@@ -112,23 +204,22 @@ ImageDirectory::ImageDirectory( std::string in_path, std::string in_calibPath )
 	frameIdx = 0;
 	ReadImage();
 	
-	// start the pre-fetch thread.
+	// start the pre-fetch threads.
 	// If we're doing heavy processing, we don't want to have to also wait to
 	// read the next image from disk if we don't have to.
-	getNext = true;
-	threadQuit = false;
-	preFetchThread = std::thread( &ImageDirectory::PreFetchThread, this );
+	StartPreFetch( prefetchDepth, prefetchThreads );
 	
 }
 	
 ImageDirectory::~ImageDirectory()
 {
-	std::unique_lock<std::mutex> lock( nextImage_mutex );
+	std::unique_lock<std::mutex> lock( ring_mutex );
 	threadQuit = true;
 	lock.unlock();
-	nextImage_cv.notify_one();
+	ring_cv.notify_all();
 	
-	preFetchThread.join();
+	for( unsigned tc = 0; tc < preFetchThreads.size(); ++tc )
+		preFetchThreads[tc].join();
 }
 
 cv::Mat ImageDirectory::GetCurrent()
@@ -144,54 +235,106 @@ bool ImageDirectory::Advance()
 		return false;
 	
 	//
-	// The prefetch should have the next image ready for us.
+	// The prefetch should have the next image ready for us,
+	// if not, we wait until it does.
 	//
-	
-	
-	// try to lock nextImage mutex
-	bool got = false;
-	while( !got )
+	std::unique_lock<std::mutex> lock( ring_mutex );
+	int next = frameIdx + 1;
+	int s = FindSlot( next );
+	if( s >= 0 && ring[s].ready )
 	{
-		std::unique_lock<std::mutex> lock( nextImage_mutex );
-		current = nextImage.clone();
-		if( current.rows == 0 || current.cols == 0 )
-		{
-			// std::cout << "ImageDirectory: Got empty image from nextImage?" << std::endl;
-			lock.unlock();
-		}
-		else
+		++stats.hits;
+	}
+	else
+	{
+		++stats.stalls;
+		auto t0 = std::chrono::steady_clock::now();
+		
+		// make sure the decode threads know there's work.
+		ring_cv.notify_all();
+		while( (s = FindSlot( next )) < 0 || !ring[s].ready )
 		{
-			got = true;
-			++frameIdx;
-			
-			// let the prefetch work on getting the next image.
-			getNext = true;
-			lock.unlock();
-			nextImage_cv.notify_one();
-			
+			ready_cv.wait( lock );
 		}
+		
+		std::chrono::duration<double> waited = std::chrono::steady_clock::now() - t0;
+		stats.stallSeconds += waited.count();
 	}
+	++stats.advances;
+	
+	// take the image out of the ring - no need for a copy, it's ours now.
+	PreFetchSlot &ps = ring[s];
+	std::exception_ptr err = ps.err;
+	current = std::move( ps.img );
+	ps.img.release();
+	ps.err   = nullptr;
+	ps.ready = false;
+	ps.frame = -1;
+	if( !err )
+		++frameIdx;
 	
+	// let the prefetch work on refilling the ring.
+	lock.unlock();
+	ring_cv.notify_all();
 	
+	if( err )
+		std::rethrow_exception( err );
 	
 	return true;
 }
 
+bool ImageDirectory::TakeFromRing( unsigned frame )
+{
+	// caller should hold the ring mutex.
+	int s = FindSlot( frame );
+	if( s < 0 || !ring[s].ready || ring[s].err )
+		return false;
+	
+	current = std::move( ring[s].img );
+	ring[s].img.release();
+	ring[s].ready = false;
+	ring[s].frame = -1;
+	return true;
+}
+
 bool ImageDirectory::Regress()
 {
 	if( frameIdx == 0 )
 		return false;
 	
 	// have some care of the pre-fetch...
-	std::unique_lock<std::mutex> lock( nextImage_mutex );
-	nextImage = current.clone();
+	std::unique_lock<std::mutex> lock( ring_mutex );
 	
 	// decrement the frame index
 	--frameIdx;
 	
+	// the image we've got now is the next image, so if there's space
+	// for it, keep it in the ring.
+	cv::Mat prev = current;
+	bool got = TakeFromRing( frameIdx );
+	if( FindSlot( frameIdx+1 ) < 0 )
+	{
+		for( unsigned sc = 0; sc < ring.size(); ++sc )
+		{
+			PreFetchSlot &ps = ring[sc];
+			if( !ps.loading && ( ps.frame <= (int)frameIdx || ps.frame > (int)(frameIdx + ring.size()) || ps.gen != ringGen ) )
+			{
+				ps.frame = frameIdx+1;
+				ps.gen   = ringGen;
+				ps.img   = prev;
+				ps.err   = nullptr;
+				ps.ready = true;
+				break;
+			}
+		}
+	}
+	
 	lock.unlock();
-
+	ring_cv.notify_all();
+	
 	// load the image and update timestamps etc.
+	if( got )
+		return true;
 	return ReadImage();
 }
 
@@ -208,11 +351,24 @@ frameTime_t ImageDirectory::GetCurrentFrameTime()
 bool ImageDirectory::ReadImage( )
 {
 	// current = cv::imread( imageList[frameIdx] );
-	current = LoadImage( imageList[frameIdx] );
+	current = LoadImage( imageList[frameIdx], pool, decodeOpts );
 	return true;
 	//TODO: Error checks!
 }
 
+cv::Mat ImageDirectory::GetFrame( unsigned frame )
+{
+	// the image list can be sorted or shuffled under us.
+	std::unique_lock<std::mutex> lock( ring_mutex );
+	if( frame >= imageList.size() )
+		return cv::Mat();
+	std::string fn = imageList[frame];
+	LoadImageOptions opts = decodeOpts;
+	lock.unlock();
+	
+	return LoadImage( fn, opts );
+}
+
 int ImageDirectory::GetNumImages()
 {
 	return imageList.size();
@@ -222,55 +378,101 @@ int ImageDirectory::GetNumImages()
 // replaces the calibration file in the source directory!
 void ImageDirectory::SaveCalibration()
 {
-	calibration.Write( path + "/calibFile" );
+	Calibration full = GetFullCalibration();
+	full.Write( path + "/calibFile" );
+}
+
+bool ImageDirectory::SetDecodeOptions( const LoadImageOptions &opts )
+{
+	std::unique_lock<std::mutex> lock( ring_mutex );
+	UpdateDecodeCalibration( opts, current.size() );
+	
+	// everything already decoded is the wrong size now.
+	InvalidateRing();
+	lock.unlock();
+	ring_cv.notify_all();
+	
+	// and so is the current frame.
+	return ReadImage();
 }
 
 bool ImageDirectory::JumpToFrame(unsigned frame)
 {
-	std::unique_lock<std::mutex> lock( nextImage_mutex );
+	if( frame >= imageList.size() )
+		return false;
 	
+	std::unique_lock<std::mutex> lock( ring_mutex );
 	frameIdx = frame;
-	if( ReadImage() )
-	{
-		// let the prefetch work on getting the next image.
-		getNext = true;
-		lock.unlock();
-		nextImage_cv.notify_one();
-		
+	bool got = TakeFromRing( frameIdx );
+	lock.unlock();
+	
+	// let the prefetch work on getting the next images.
+	ring_cv.notify_all();
+	
+	if( got )
 		return true;
-	}
-	return false;
+	return ReadImage();
 }
 
+void ImageDirectory::InvalidateRing()
+{
+	// caller should hold the ring mutex.
+	// anything being loaded right now gets thrown away when it finishes.
+	++ringGen;
+	for( unsigned sc = 0; sc < ring.size(); ++sc )
+	{
+		if( !ring[sc].loading )
+		{
+			ring[sc].frame = -1;
+			ring[sc].ready = false;
+			ring[sc].img.release();
+			ring[sc].err   = nullptr;
+		}
+	}
+}
 
 // sometimes we might want something weird like this.
 void ImageDirectory::SortImageList()
 {
-	std::unique_lock<std::mutex> lock( nextImage_mutex );
+	std::unique_lock<std::mutex> lock( ring_mutex );
 	frameIdx = 0;
 	std::sort( imageList.begin(), imageList.end() );
+	InvalidateRing();
 	
 	// let the prefetch work on getting the next image.
-	getNext = true;
 	lock.unlock();
-	nextImage_cv.notify_one();
+	ring_cv.notify_all();
 }
 
 void ImageDirectory::ShuffleImageList()
 {
-	std::unique_lock<std::mutex> lock( nextImage_mutex );
+	std::unique_lock<std::mutex> lock( ring_mutex );
 	frameIdx = 0;
 	
 	std::random_device rd;
 	std::mt19937 g(rd());
 	std::shuffle(imageList.begin(), imageList.end(), g);
+	InvalidateRing();
 	
 	// let the prefetch work on getting the next image.
-	getNext = true;
 	lock.unlock();
-	nextImage_cv.notify_one();
+	ring_cv.notify_all();
+}
+
+PrefetchStats ImageDirectory::GetPrefetchStats()
+{
+	std::unique_lock<std::mutex> lock( ring_mutex );
+	return stats;
 }
 
+void ImageDirectory::ResetPrefetchStats()
+{
+	std::unique_lock<std::mutex> lock( ring_mutex );
+	stats.advances     = 0;
+	stats.hits         = 0;
+	stats.stalls       = 0;
+	stats.stallSeconds = 0.0;
+}
 
 
 bool ImageDirectory::IsImage(string s)
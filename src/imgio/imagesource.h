@@ -15,6 +15,7 @@ using std::string;
 
 #include <thread>
 #include <condition_variable>
+#include <exception>
 #include <random>
 
 #include "imgio/loadsave.h"
@@ -77,30 +78,150 @@ public:
 
 
 	virtual void SaveCalibration() = 0;
+	
+	// Ask the source to give us images at reduced resolution and/or only a region
+	// of interest, as a cheaper alternative to resizing what we get. The calibration is
+	// changed to match the images we now get (see Calibration::RescaleImage/CropImage).
+	// Default options go back to full images and the original calibration.
+	// Returns false if the source can't do this.
+	virtual bool SetDecodeOptions( const LoadImageOptions &opts )
+	{
+		return false;
+	}
+	
+	LoadImageOptions GetDecodeOptions()
+	{
+		return decodeOpts;
+	}
+	
+	// the calibration of the full resolution images, whatever the decode options.
+	Calibration GetFullCalibration()
+	{
+		if( decodeOpts.IsDefault() )
+			return calibration;
+		return fullCalibration;
+	}
 
 	// all image sources should have an associated calibration,
 	// even if that calibration is a null calibration.
 	Calibration calibration;
+	
+protected:
+	
+	// Sources that support SetDecodeOptions call this when the options change,
+	// giving the size of the images they have been producing until now.
+	void UpdateDecodeCalibration( const LoadImageOptions &opts, cv::Size currentSize )
+	{
+		if( decodeOpts.IsDefault() )
+		{
+			fullCalibration = calibration;
+			fullImageSize   = currentSize;
+			
+			// a null calibration still needs to know how big the images are.
+			if( fullCalibration.width <= 0 || fullCalibration.height <= 0 )
+			{
+				fullCalibration.width  = currentSize.width;
+				fullCalibration.height = currentSize.height;
+			}
+		}
+		
+		// check the options before we change anything.
+		cv::Rect o = opts.OutputRect( fullImageSize.width, fullImageSize.height );
+		
+		decodeOpts  = opts;
+		calibration = fullCalibration;
+		if( opts.IsDefault() )
+			return;
+		
+		int d = opts.scaleDenom;
+		calibration.RescaleImage( (fullImageSize.width + d - 1) / d, (fullImageSize.height + d - 1) / d );
+		calibration.CropImage( o.x, o.y, o.width, o.height );
+	}
+	
+	LoadImageOptions decodeOpts;
+	Calibration fullCalibration;
+	cv::Size fullImageSize;
+};
+
+
+//
+// An ImageSource is a cursor, so sharing one between threads means taking turns. Sources
+// which can also get at any frame without moving the cursor implement this as well, so that
+// the frames of one long recording can be shared out between threads.
+//
+// GetFrame() gives the same image as JumpToFrame(frame) followed by GetCurrent() (so with the
+// source's decode options), or an empty cv::Mat if the source doesn't have the frame. It can
+// be called from any number of threads at once, and alongside the source's own Advance() etc.
+// Don't change the source's decode options while other threads are getting frames.
+// The image is the caller's to keep.
+//
+class FrameProvider
+{
+public:
+	virtual ~FrameProvider(){};
+	
+	virtual cv::Mat GetFrame( unsigned frame )=0;
 };
 
 
+// counters describing how well the ImageDirectory prefetch is keeping up.
+// If stalls is a large fraction of advances, the prefetch depth (or number
+// of decode threads) should be increased.
+struct PrefetchStats
+{
+	unsigned long advances;     // number of calls to Advance() that moved the source on.
+	unsigned long hits;         // ... of which the frame was already decoded and waiting.
+	unsigned long stalls;       // ... of which we had to wait for the decoder.
+	double        stallSeconds; // total time spent waiting for the decoder.
+};
+
 // the most basic image source is a directory of images.
-class ImageDirectory : public ImageSource
+class ImageDirectory : public ImageSource, public FrameProvider
 {
 private:
+	void FindImages();
+	
 	void PreFetchThread();
+	void StartPreFetch( unsigned in_depth, unsigned in_threads );
 	
-	cv::Mat nextImage;
-	std::condition_variable nextImage_cv;
-	std::mutex nextImage_mutex;
-	bool getNext;
-	std::thread preFetchThread;
+	// one entry in the prefetch ring.
+	struct PreFetchSlot
+	{
+		int frame;         // which frame of imageList this slot holds (-1 for none)
+		unsigned gen;      // generation of imageList the frame was decoded from
+		bool loading;      // a decode thread is currently filling this slot
+		bool ready;        // the image is decoded and waiting
+		cv::Mat img;
+		std::exception_ptr err;  // set if decoding failed.
+	};
+	
+	// a ring of decoded frames, ahead of the current frame.
+	std::vector< PreFetchSlot > ring;
+	unsigned ringGen;
+	int FindSlot( int frame );
+	bool NextJob( unsigned &slot, int &frame );
+	bool TakeFromRing( unsigned frame );
+	void InvalidateRing();
+	
+	std::condition_variable ring_cv;     // signals decode threads that there is work.
+	std::condition_variable ready_cv;    // signals Advance() that a frame is ready.
+	std::mutex ring_mutex;
+	std::vector< std::thread > preFetchThreads;
 	bool threadQuit;
 	
+	PrefetchStats stats;
+	
+	// decoded frames come out of here so that steady-state playback
+	// does not keep allocating new images.
+	ImageBufferPool pool;
+	
 public:
-	ImageDirectory( std::string in_path );
+	// prefetchDepth is how many frames to decode ahead of the current frame,
+	// prefetchThreads is how many threads do the decoding. Leaving either as 0
+	// uses the values from the user's CommonConfig.
+	ImageDirectory( std::string in_path, unsigned prefetchDepth = 0, unsigned prefetchThreads = 0 );
 	
-	ImageDirectory( std::string in_path, std::string in_calibPath );
+	ImageDirectory( std::string in_path, std::string in_calibPath, unsigned prefetchDepth = 0, unsigned prefetchThreads = 0 );
 	
 	~ImageDirectory();
 	
@@ -120,6 +241,7 @@ public:
 	
 	// WARNING!!!
 	// replaces the calibration file in the source directory!
+	// This is always the full resolution calibration.
 	void SaveCalibration();
 
 	virtual bool JumpToFrame(unsigned frame);
@@ -132,6 +254,16 @@ public:
 	
 	
 	std::vector<string> GetImageList() {return imageList;}
+	
+	// decoded frames are scaled / cropped by the decoder where it can (e.g. JPEG)
+	// and by the prefetch threads otherwise.
+	bool SetDecodeOptions( const LoadImageOptions &opts );
+	
+	// decodes straight from the file, whatever the prefetch is doing.
+	cv::Mat GetFrame( unsigned frame );
+	
+	PrefetchStats GetPrefetchStats();
+	void ResetPrefetchStats();
 private:
 
 	bool IsImage(string s);
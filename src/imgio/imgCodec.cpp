@@ -0,0 +1,445 @@
+#include "imgio/imgCodec.h"
+
+#include <snappy.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <cstring>
+#include <climits>
+#include <cctype>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+ImgCodecOptions ParseImgCodec( std::string s )
+{
+	ImgCodecOptions opts;
+	
+	size_t pp = s.find("+");
+	if( pp != std::string::npos )
+	{
+		std::string f = s.substr(pp+1);
+		s = s.substr(0, pp);
+		if( f == "shuffle" )
+			opts.filter = IMGFILTER_SHUFFLE;
+		else if( f == "delta" )
+			opts.filter = IMGFILTER_DELTA;
+		else if( f != "none" )
+			throw std::runtime_error("Unknown image filter: " + f );
+	}
+	
+	std::string name = s;
+	size_t cp = s.find(":");
+	if( cp != std::string::npos )
+	{
+		name = s.substr(0, cp);
+		opts.level = atoi( s.substr(cp+1).c_str() );
+	}
+
+	if( name == "none" || name == "raw" )
+		opts.codec = IMGCODEC_NONE;
+	else if( name == "snappy" )
+		opts.codec = IMGCODEC_SNAPPY;
+	else if( name == "lz4" )
+		opts.codec = IMGCODEC_LZ4;
+	else if( name == "zstd" )
+		opts.codec = IMGCODEC_ZSTD;
+	else
+		throw std::runtime_error("Unknown image codec: " + s );
+
+	return opts;
+}
+
+std::string ImgCodecName( ImgCodecOptions opts )
+{
+	std::stringstream ss;
+	ss << ImgCodecName( opts.codec );
+	if( opts.level != 0 )
+		ss << ":" << opts.level;
+	if( opts.filter == IMGFILTER_SHUFFLE )
+		ss << "+shuffle";
+	else if( opts.filter == IMGFILTER_DELTA )
+		ss << "+delta";
+	return ss.str();
+}
+
+std::string ImgCodecName( imgCodec_t codec )
+{
+	switch( codec )
+	{
+		case IMGCODEC_NONE:   return "none";
+		case IMGCODEC_SNAPPY: return "snappy";
+		case IMGCODEC_LZ4:    return "lz4";
+		case IMGCODEC_ZSTD:   return "zstd";
+	}
+	return "unknown";
+}
+
+bayerPattern_t ParseBayerPattern( std::string s )
+{
+	std::transform( s.begin(), s.end(), s.begin(), ::tolower );
+	if( s == "none" )
+		return BAYER_NONE;
+	else if( s == "rggb" )
+		return BAYER_RGGB;
+	else if( s == "bggr" )
+		return BAYER_BGGR;
+	else if( s == "grbg" )
+		return BAYER_GRBG;
+	else if( s == "gbrg" )
+		return BAYER_GBRG;
+	throw std::runtime_error("Unknown Bayer pattern: " + s );
+}
+
+std::string BayerPatternName( bayerPattern_t pattern )
+{
+	switch( pattern )
+	{
+		case BAYER_NONE: return "none";
+		case BAYER_RGGB: return "rggb";
+		case BAYER_BGGR: return "bggr";
+		case BAYER_GRBG: return "grbg";
+		case BAYER_GBRG: return "gbrg";
+	}
+	return "unknown";
+}
+
+bool ImgCodecAvailable( imgCodec_t codec )
+{
+	switch( codec )
+	{
+		case IMGCODEC_NONE:
+		case IMGCODEC_SNAPPY:
+			return true;
+		case IMGCODEC_LZ4:
+			#ifdef HAVE_LZ4
+			return true;
+			#else
+			return false;
+			#endif
+		case IMGCODEC_ZSTD:
+			#ifdef HAVE_ZSTD
+			return true;
+			#else
+			return false;
+			#endif
+	}
+	return false;
+}
+
+size_t ImgCodecCompress( ImgCodecOptions opts, const char *src, size_t len, std::vector<char> &out )
+{
+	if( !ImgCodecAvailable( opts.codec ) )
+	{
+		throw std::runtime_error("ImgCodecCompress: built without support for codec: " + ImgCodecName( opts.codec ) );
+	}
+
+	size_t s = 0;
+	switch( opts.codec )
+	{
+		case IMGCODEC_NONE:
+		{
+			out.resize( len );
+			memcpy( out.data(), src, len );
+			s = len;
+			break;
+		}
+
+		case IMGCODEC_SNAPPY:
+		{
+			out.resize( snappy::MaxCompressedLength( len ) );
+			snappy::RawCompress( src, len, out.data(), &s );
+			break;
+		}
+
+		case IMGCODEC_LZ4:
+		{
+			#ifdef HAVE_LZ4
+			if( len > (size_t)LZ4_MAX_INPUT_SIZE )
+				throw std::runtime_error("ImgCodecCompress: image too big for LZ4.");
+			out.resize( LZ4_compressBound( len ) );
+			int r;
+			if( opts.level > 0 )
+				r = LZ4_compress_HC( src, out.data(), len, out.size(), opts.level );
+			else
+				r = LZ4_compress_default( src, out.data(), len, out.size() );
+			if( r <= 0 )
+				throw std::runtime_error("ImgCodecCompress: LZ4 compression failed.");
+			s = r;
+			#endif
+			break;
+		}
+
+		case IMGCODEC_ZSTD:
+		{
+			#ifdef HAVE_ZSTD
+			out.resize( ZSTD_compressBound( len ) );
+			s = ZSTD_compress( out.data(), out.size(), src, len, opts.level );
+			if( ZSTD_isError(s) )
+				throw std::runtime_error(std::string("ImgCodecCompress: zstd error: ") + ZSTD_getErrorName(s) );
+			#endif
+			break;
+		}
+	}
+
+	out.resize( s );
+	return s;
+}
+
+bool ImgCodecDecompress( imgCodec_t codec, const char *src, size_t len, char *dst, size_t dstLen )
+{
+	if( !ImgCodecAvailable( codec ) )
+	{
+		throw std::runtime_error("ImgCodecDecompress: built without support for codec: " + ImgCodecName( codec ) );
+	}
+
+	switch( codec )
+	{
+		case IMGCODEC_NONE:
+		{
+			if( len != dstLen )
+				return false;
+			memcpy( dst, src, len );
+			return true;
+		}
+
+		case IMGCODEC_SNAPPY:
+		{
+			size_t ulen;
+			if( !snappy::GetUncompressedLength( src, len, &ulen ) || ulen != dstLen )
+				return false;
+			return snappy::RawUncompress( src, len, dst );
+		}
+
+		case IMGCODEC_LZ4:
+		{
+			#ifdef HAVE_LZ4
+			if( len > INT_MAX || dstLen > INT_MAX )
+				return false;
+			int r = LZ4_decompress_safe( src, dst, len, dstLen );
+			return r >= 0 && (size_t)r == dstLen;
+			#else
+			return false;
+			#endif
+		}
+
+		case IMGCODEC_ZSTD:
+		{
+			#ifdef HAVE_ZSTD
+			size_t r = ZSTD_decompress( dst, dstLen, src, len );
+			return !ZSTD_isError(r) && r == dstLen;
+			#else
+			return false;
+			#endif
+		}
+	}
+	return false;
+}
+
+
+
+//
+// Byte shuffle of 4 byte elements: byte b of element i goes to dst[ b*n + i ].
+// With SSE2 we do 16 elements at a time with a byte transpose.
+//
+static void Shuffle4( const uint8_t *src, uint8_t *dst, size_t n )
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	for( ; i + 16 <= n; i += 16 )
+	{
+		__m128i v0 = _mm_loadu_si128( (const __m128i*)( src + 4*i      ) );
+		__m128i v1 = _mm_loadu_si128( (const __m128i*)( src + 4*i + 16 ) );
+		__m128i v2 = _mm_loadu_si128( (const __m128i*)( src + 4*i + 32 ) );
+		__m128i v3 = _mm_loadu_si128( (const __m128i*)( src + 4*i + 48 ) );
+		
+		// three rounds of interleaving gets the bytes of each plane
+		// into order, one half in each of two registers...
+		__m128i t0 = _mm_unpacklo_epi8( v0, v1 );
+		__m128i t1 = _mm_unpackhi_epi8( v0, v1 );
+		__m128i t2 = _mm_unpacklo_epi8( v2, v3 );
+		__m128i t3 = _mm_unpackhi_epi8( v2, v3 );
+		
+		__m128i u0 = _mm_unpacklo_epi8( t0, t1 );
+		__m128i u1 = _mm_unpackhi_epi8( t0, t1 );
+		__m128i u2 = _mm_unpacklo_epi8( t2, t3 );
+		__m128i u3 = _mm_unpackhi_epi8( t2, t3 );
+		
+		__m128i w0 = _mm_unpacklo_epi8( u0, u1 );
+		__m128i w1 = _mm_unpackhi_epi8( u0, u1 );
+		__m128i w2 = _mm_unpacklo_epi8( u2, u3 );
+		__m128i w3 = _mm_unpackhi_epi8( u2, u3 );
+		
+		// ... which we then join up.
+		_mm_storeu_si128( (__m128i*)( dst       + i ), _mm_unpacklo_epi64( w0, w2 ) );
+		_mm_storeu_si128( (__m128i*)( dst +   n + i ), _mm_unpackhi_epi64( w0, w2 ) );
+		_mm_storeu_si128( (__m128i*)( dst + 2*n + i ), _mm_unpacklo_epi64( w1, w3 ) );
+		_mm_storeu_si128( (__m128i*)( dst + 3*n + i ), _mm_unpackhi_epi64( w1, w3 ) );
+	}
+#endif
+	for( ; i < n; ++i )
+	{
+		dst[      i ] = src[ 4*i     ];
+		dst[  n + i ] = src[ 4*i + 1 ];
+		dst[2*n + i ] = src[ 4*i + 2 ];
+		dst[3*n + i ] = src[ 4*i + 3 ];
+	}
+}
+
+static void Unshuffle4( const uint8_t *src, uint8_t *dst, size_t n )
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	for( ; i + 16 <= n; i += 16 )
+	{
+		__m128i p0 = _mm_loadu_si128( (const __m128i*)( src       + i ) );
+		__m128i p1 = _mm_loadu_si128( (const __m128i*)( src +   n + i ) );
+		__m128i p2 = _mm_loadu_si128( (const __m128i*)( src + 2*n + i ) );
+		__m128i p3 = _mm_loadu_si128( (const __m128i*)( src + 3*n + i ) );
+		
+		__m128i a0 = _mm_unpacklo_epi8( p0, p1 );
+		__m128i a1 = _mm_unpackhi_epi8( p0, p1 );
+		__m128i a2 = _mm_unpacklo_epi8( p2, p3 );
+		__m128i a3 = _mm_unpackhi_epi8( p2, p3 );
+		
+		_mm_storeu_si128( (__m128i*)( dst + 4*i      ), _mm_unpacklo_epi16( a0, a2 ) );
+		_mm_storeu_si128( (__m128i*)( dst + 4*i + 16 ), _mm_unpackhi_epi16( a0, a2 ) );
+		_mm_storeu_si128( (__m128i*)( dst + 4*i + 32 ), _mm_unpacklo_epi16( a1, a3 ) );
+		_mm_storeu_si128( (__m128i*)( dst + 4*i + 48 ), _mm_unpackhi_epi16( a1, a3 ) );
+	}
+#endif
+	for( ; i < n; ++i )
+	{
+		dst[ 4*i     ] = src[       i ];
+		dst[ 4*i + 1 ] = src[   n + i ];
+		dst[ 4*i + 2 ] = src[ 2*n + i ];
+		dst[ 4*i + 3 ] = src[ 3*n + i ];
+	}
+}
+
+// difference of each element from the one stride before it, along each row.
+static void Delta4( const uint32_t *src, uint32_t *dst, size_t rows, size_t rowElems, unsigned stride )
+{
+	for( size_t rc = 0; rc < rows; ++rc )
+	{
+		const uint32_t *s = src + rc * rowElems;
+		uint32_t       *d = dst + rc * rowElems;
+		size_t i = 0;
+		for( ; i < stride && i < rowElems; ++i )
+			d[i] = s[i];
+#ifdef __SSE2__
+		for( ; i + 4 <= rowElems; i += 4 )
+		{
+			__m128i a = _mm_loadu_si128( (const __m128i*)( s + i ) );
+			__m128i b = _mm_loadu_si128( (const __m128i*)( s + i - stride ) );
+			_mm_storeu_si128( (__m128i*)( d + i ), _mm_sub_epi32( a, b ) );
+		}
+#endif
+		for( ; i < rowElems; ++i )
+			d[i] = s[i] - s[i-stride];
+	}
+}
+
+// undo the delta - a running sum along each row, done in place.
+static void Undelta4( uint32_t *data, size_t rows, size_t rowElems, unsigned stride )
+{
+	for( size_t rc = 0; rc < rows; ++rc )
+	{
+		uint32_t *d = data + rc * rowElems;
+		for( size_t i = stride; i < rowElems; ++i )
+			d[i] += d[i-stride];
+	}
+}
+
+void ImgFilterEncode( imgFilter_t filter, const char *src, char *dst, size_t rows, size_t rowElems, unsigned stride )
+{
+	size_t n = rows * rowElems;
+	stride = std::max( 1u, stride );
+	switch( filter )
+	{
+		case IMGFILTER_NONE:
+			memcpy( dst, src, n * 4 );
+			break;
+		
+		case IMGFILTER_SHUFFLE:
+			Shuffle4( (const uint8_t*)src, (uint8_t*)dst, n );
+			break;
+		
+		case IMGFILTER_DELTA:
+		{
+			thread_local std::vector<uint32_t> tmp;
+			tmp.resize( n );
+			Delta4( (const uint32_t*)src, tmp.data(), rows, rowElems, stride );
+			Shuffle4( (const uint8_t*)tmp.data(), (uint8_t*)dst, n );
+			break;
+		}
+		
+		default:
+			throw std::runtime_error("ImgFilterEncode: unknown filter.");
+	}
+}
+
+void ImgFilterDecode( imgFilter_t filter, const char *src, char *dst, size_t rows, size_t rowElems, unsigned stride )
+{
+	size_t n = rows * rowElems;
+	stride = std::max( 1u, stride );
+	switch( filter )
+	{
+		case IMGFILTER_NONE:
+			memcpy( dst, src, n * 4 );
+			break;
+		
+		case IMGFILTER_SHUFFLE:
+			Unshuffle4( (const uint8_t*)src, (uint8_t*)dst, n );
+			break;
+		
+		case IMGFILTER_DELTA:
+			Unshuffle4( (const uint8_t*)src, (uint8_t*)dst, n );
+			Undelta4( (uint32_t*)dst, rows, rowElems, stride );
+			break;
+		
+		default:
+			throw std::runtime_error("ImgFilterDecode: unknown filter.");
+	}
+}
+
+size_t ImgEncodePayload( ImgCodecOptions opts, const char *src, size_t rows, size_t rowElems, unsigned stride, unsigned elemSize, std::vector<char> &out )
+{
+	size_t len = rows * rowElems * elemSize;
+	if( opts.filter == IMGFILTER_NONE )
+		return ImgCodecCompress( opts, src, len, out );
+	
+	if( elemSize != 4 )
+		throw std::runtime_error("ImgEncodePayload: filters only work on 4 byte data.");
+	
+	thread_local std::vector<char> filtered;
+	filtered.resize( len );
+	ImgFilterEncode( opts.filter, src, filtered.data(), rows, rowElems, stride );
+	return ImgCodecCompress( opts, filtered.data(), len, out );
+}
+
+bool ImgDecodePayload( imgCodec_t codec, imgFilter_t filter, const char *src, size_t len, char *dst, size_t rows, size_t rowElems, unsigned stride, unsigned elemSize )
+{
+	size_t dstLen = rows * rowElems * elemSize;
+	if( filter == IMGFILTER_NONE )
+		return ImgCodecDecompress( codec, src, len, dst, dstLen );
+	
+	if( elemSize != 4 || filter > IMGFILTER_DELTA )
+		return false;
+	
+	thread_local std::vector<char> filtered;
+	filtered.resize( dstLen );
+	if( !ImgCodecDecompress( codec, src, len, filtered.data(), dstLen ) )
+		return false;
+	ImgFilterDecode( filter, filtered.data(), dst, rows, rowElems, stride );
+	return true;
+}
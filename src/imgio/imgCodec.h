@@ -0,0 +1,131 @@
+#ifndef MC_IMG_CODEC_H
+#define MC_IMG_CODEC_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//
+// The .charImg and .floatImg formats were originally always snappy compressed.
+// Now the compressor can be chosen per file, so that we can trade CPU for disk
+// bandwidth depending on the dataset - zstd for archiving, LZ4 for the fastest
+// decode, or no compression at all when working on a RAM disk.
+//
+// LZ4 and zstd are only available if the library was built with HAVE_LZ4 / HAVE_ZSTD.
+//
+enum imgCodec_t
+{
+	IMGCODEC_NONE   = 0,
+	IMGCODEC_SNAPPY = 1,
+	IMGCODEC_LZ4    = 2,
+	IMGCODEC_ZSTD   = 3
+};
+
+//
+// Float data barely compresses as it is, because the exponent and mantissa bytes
+// are interleaved and look like noise to the compressor. So, before compressing
+// float data we can optionally:
+//  - IMGFILTER_SHUFFLE:  group all the first bytes of each float together, then all 
+//                        the second bytes, etc. (as blosc does)
+//  - IMGFILTER_DELTA:    store each value's difference from its neighbour along the row
+//                        (in the same channel) then shuffle. The difference is taken on
+//                        the bit pattern so it is exactly reversible.
+// Both are lossless. The filters only apply to 4 byte (float) data.
+//
+enum imgFilter_t
+{
+	IMGFILTER_NONE    = 0,
+	IMGFILTER_SHUFFLE = 1,
+	IMGFILTER_DELTA   = 2
+};
+
+struct ImgCodecOptions
+{
+	ImgCodecOptions() : codec( IMGCODEC_SNAPPY ), level(0), filter( IMGFILTER_NONE ) {}
+	ImgCodecOptions( imgCodec_t c, int l = 0, imgFilter_t f = IMGFILTER_NONE ) : codec(c), level(l), filter(f) {}
+
+	imgCodec_t codec;
+
+	// zstd compression level (0 for zstd's default) or for LZ4,
+	// anything above 0 uses LZ4HC at that level.
+	int level;
+
+	imgFilter_t filter;
+};
+
+// parse "none", "snappy", "lz4", "lz4:9", "zstd", "zstd:19" etc.
+// and optionally a filter on the end: "zstd:3+delta", "snappy+shuffle"
+ImgCodecOptions ParseImgCodec( std::string s );
+std::string ImgCodecName( ImgCodecOptions opts );
+std::string ImgCodecName( imgCodec_t codec );
+bool ImgCodecAvailable( imgCodec_t codec );
+
+// compress len bytes of src into out, resizing out to fit. Returns the compressed size.
+size_t ImgCodecCompress( ImgCodecOptions opts, const char *src, size_t len, std::vector<char> &out );
+
+// decompress into dst, which must be exactly dstLen bytes - the size of the original data.
+// Returns false if the data could not be decompressed.
+bool ImgCodecDecompress( imgCodec_t codec, const char *src, size_t len, char *dst, size_t dstLen );
+
+// Apply / undo the filter on 4 byte data laid out as rows of rowElems elements, where
+// the delta filter works between elements that are stride apart (i.e. stride is the
+// number of channels). src and dst must not overlap.
+void ImgFilterEncode( imgFilter_t filter, const char *src, char *dst, size_t rows, size_t rowElems, unsigned stride );
+void ImgFilterDecode( imgFilter_t filter, const char *src, char *dst, size_t rows, size_t rowElems, unsigned stride );
+
+// filter (if any) then compress.
+size_t ImgEncodePayload( ImgCodecOptions opts, const char *src, size_t rows, size_t rowElems, unsigned stride, unsigned elemSize, std::vector<char> &out );
+
+// decompress then undo the filter (if any), into dst, which must be rows*rowElems*elemSize bytes.
+bool ImgDecodePayload( imgCodec_t codec, imgFilter_t filter, const char *src, size_t len, char *dst, size_t rows, size_t rowElems, unsigned stride, unsigned elemSize );
+
+
+//
+// Camera rigs mostly capture raw Bayer data, which is a third of the size of the
+// demosaiced BGR image. A single channel 8 bit image can be stored as the raw mosaic,
+// with the colour of its top left 2x2 block recorded so that readers can demosaic it
+// (see DecodeBayer() in imgio/imgDecoders.h).
+//
+enum bayerPattern_t
+{
+	BAYER_NONE = 0,
+	BAYER_RGGB = 1,
+	BAYER_BGGR = 2,
+	BAYER_GRBG = 3,
+	BAYER_GBRG = 4
+};
+
+// "rggb", "bggr", "grbg", "gbrg", or "none"
+bayerPattern_t ParseBayerPattern( std::string s );
+std::string BayerPatternName( bayerPattern_t pattern );
+
+
+//
+// The original header was just magic, width, height, channels, and the compressed
+// size. Version 2 files have their own magic numbers and record the codec, the filter
+// and the uncompressed size so we can check the data against the image before decoding.
+// .cplxImg and .fbuf files use the same header when they are filtered or use another codec.
+//
+#define IMG_MAGIC_FLOAT    820830001
+#define IMG_MAGIC_CHAR     820830002
+#define IMG_MAGIC_CPLX     820830003
+#define IMG_MAGIC_FBUF     820830004
+#define IMG_MAGIC_FLOAT_V2 820830011
+#define IMG_MAGIC_CHAR_V2  820830012
+#define IMG_MAGIC_CPLX_V2  820830013
+#define IMG_MAGIC_FBUF_V2  820830014
+
+struct ImgFileHeaderV2
+{
+	uint32_t magic;
+	uint16_t version;        // 2
+	uint8_t  codec;          // imgCodec_t
+	uint8_t  filter;         // imgFilter_t
+	uint32_t w, h, c;
+	uint32_t bayer;          // bayerPattern_t of a raw 1 channel 8 bit image, otherwise BAYER_NONE
+	uint64_t compressedSize;
+	uint64_t rawSize;
+};
+static_assert( sizeof(ImgFileHeaderV2) == 40, "ImgFileHeaderV2 must be 40 bytes" );
+
+#endif
@@ -0,0 +1,665 @@
+#include "imgio/imgDecoders.h"
+#include "imgio/loadsave.h"
+
+#include <mutex>
+#include <cstring>
+#include <csetjmp>
+#include <cstdio>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_LIBJPEG
+#include <jpeglib.h>
+#endif
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#endif
+#ifdef HAVE_LIBTIFF
+#include <tiffio.h>
+#endif
+
+
+void PrepareImageBuffer( cv::Mat &dst, int rows, int cols, int type, ImageBufferPool *pool )
+{
+	if( pool )
+	{
+		dst = pool->Get( rows, cols, type );
+		return;
+	}
+
+	// we write into the data directly, so we need it to be continuous
+	if( !dst.isContinuous() )
+		dst.release();
+	dst.create( rows, cols, type );
+}
+
+void ApplyLoadOptions( const cv::Mat &full, cv::Mat &dst, const LoadImageOptions &opts, ImageBufferPool *pool )
+{
+	cv::Rect o = opts.OutputRect( full.cols, full.rows );
+	int d = opts.scaleDenom;
+	
+	// the part of the full image that becomes the output.
+	cv::Rect src( o.x * d, o.y * d, std::min( o.width * d, full.cols - o.x * d ), std::min( o.height * d, full.rows - o.y * d ) );
+	
+	PrepareImageBuffer( dst, o.height, o.width, full.type(), pool );
+	if( d == 1 )
+		full( src ).copyTo( dst );
+	else
+		cv::resize( full( src ), dst, dst.size(), 0, 0, cv::INTER_AREA );
+}
+
+// Magick (6) decides an image is GrayscaleType by looking at the pixels, not at what the
+// file says, and LoadImage has always given a one channel image for those. So, a colour
+// image where every pixel is grey becomes one channel here too.
+static void GrayIfAllGray( cv::Mat &dst, ImageBufferPool *pool )
+{
+	if( dst.type() != CV_8UC3 )
+		return;
+	
+	for( int rc = 0; rc < dst.rows; ++rc )
+	{
+		const unsigned char *p = dst.ptr( rc );
+		for( int cc = 0; cc < dst.cols; ++cc, p += 3 )
+		{
+			// colour images usually fail on the first few pixels.
+			if( p[0] != p[1] || p[1] != p[2] )
+				return;
+		}
+	}
+	
+	cv::Mat gray;
+	PrepareImageBuffer( gray, dst.rows, dst.cols, CV_8UC1, pool );
+	cv::extractChannel( dst, gray, 0 );
+	dst = gray;
+}
+
+// where the red pixel is in each 2x2 block of the mosaic.
+static void BayerRedOffset( bayerPattern_t pattern, int &rx, int &ry )
+{
+	switch( pattern )
+	{
+		case BAYER_RGGB: rx = 0; ry = 0; return;
+		case BAYER_BGGR: rx = 1; ry = 1; return;
+		case BAYER_GRBG: rx = 1; ry = 0; return;
+		case BAYER_GBRG: rx = 0; ry = 1; return;
+		default: break;
+	}
+	throw std::runtime_error("DecodeBayer: unknown Bayer pattern: " + BayerPatternName( pattern ) );
+}
+
+static int BayerColorCode( bayerPattern_t pattern, bool gray )
+{
+	// OpenCV names the patterns after the 2x2 block starting at (1,1), not (0,0).
+	switch( pattern )
+	{
+		case BAYER_RGGB: return gray ? cv::COLOR_BayerBG2GRAY : cv::COLOR_BayerBG2BGR;
+		case BAYER_BGGR: return gray ? cv::COLOR_BayerRG2GRAY : cv::COLOR_BayerRG2BGR;
+		case BAYER_GRBG: return gray ? cv::COLOR_BayerGB2GRAY : cv::COLOR_BayerGB2BGR;
+		case BAYER_GBRG: return gray ? cv::COLOR_BayerGR2GRAY : cv::COLOR_BayerGR2BGR;
+		default: break;
+	}
+	throw std::runtime_error("DecodeBayer: unknown Bayer pattern: " + BayerPatternName( pattern ) );
+}
+
+// one output pixel from each 2x2 block: red, blue, and the mean of the greens.
+static void DemosaicBayerHalf( const cv::Mat &raw, bayerPattern_t pattern, bool gray, cv::Mat &dst )
+{
+	int rx, ry;
+	BayerRedOffset( pattern, rx, ry );
+	for( int y = 0; y < dst.rows; ++y )
+	{
+		const unsigned char *r0 = raw.ptr( 2*y );
+		const unsigned char *r1 = raw.ptr( 2*y + 1 );
+		const unsigned char *red    = ( ry ? r1 : r0 ) + rx;
+		const unsigned char *blue   = ( ry ? r0 : r1 ) + 1 - rx;
+		const unsigned char *green0 = ( ry ? r1 : r0 ) + 1 - rx;
+		const unsigned char *green1 = ( ry ? r0 : r1 ) + rx;
+		unsigned char *o = dst.ptr( y );
+		if( gray )
+		{
+			// the usual 0.299 R + 0.587 G + 0.114 B, in 8 bit fixed point.
+			for( int x = 0; x < dst.cols; ++x )
+				o[x] = ( 77 * red[2*x] + 75 * ( green0[2*x] + green1[2*x] ) + 29 * blue[2*x] + 128 ) >> 8;
+		}
+		else
+		{
+			for( int x = 0; x < dst.cols; ++x, o += 3 )
+			{
+				o[0] = blue[2*x];
+				o[1] = ( green0[2*x] + green1[2*x] + 1 ) >> 1;
+				o[2] = red[2*x];
+			}
+		}
+	}
+}
+
+void MosaicBayer( const cv::Mat &bgr, bayerPattern_t pattern, cv::Mat &raw )
+{
+	if( bgr.type() != CV_8UC3 || bgr.cols % 2 != 0 || bgr.rows % 2 != 0 )
+		throw std::runtime_error("MosaicBayer: needs an 8 bit BGR image with an even width and height.");
+	int rx, ry;
+	BayerRedOffset( pattern, rx, ry );
+	
+	raw.create( bgr.rows, bgr.cols, CV_8UC1 );
+	for( int y = 0; y < bgr.rows; ++y )
+	{
+		const unsigned char *i = bgr.ptr( y );
+		unsigned char *o = raw.ptr( y );
+		for( int x = 0; x < bgr.cols; ++x )
+		{
+			// red, blue diagonally opposite it in the 2x2 block, and green for the other two.
+			int ch = 1;
+			if( ( x & 1 ) == rx && ( y & 1 ) == ry )
+				ch = 2;
+			else if( ( x & 1 ) != rx && ( y & 1 ) != ry )
+				ch = 0;
+			o[x] = i[ 3*x + ch ];
+		}
+	}
+}
+
+void DecodeBayer( const cv::Mat &raw, bayerPattern_t pattern, cv::Mat &dst, const LoadImageOptions &opts, ImageBufferPool *pool )
+{
+	if( raw.type() != CV_8UC1 || raw.cols % 2 != 0 || raw.rows % 2 != 0 )
+		throw std::runtime_error("DecodeBayer: raw Bayer images must be 8 bit, 1 channel, with an even width and height.");
+	int type = opts.bayerGray ? CV_8UC1 : CV_8UC3;
+	
+	if( opts.scaleDenom >= 2 )
+	{
+		if( opts.scaleDenom == 2 && opts.roi.area() == 0 )
+		{
+			PrepareImageBuffer( dst, raw.rows/2, raw.cols/2, type, pool );
+			DemosaicBayerHalf( raw, pattern, opts.bayerGray, dst );
+			return;
+		}
+		
+		// get the half resolution image, then the rest of the way is the same
+		// as any other image with the options adjusted to match.
+		thread_local cv::Mat half;
+		PrepareImageBuffer( half, raw.rows/2, raw.cols/2, type, NULL );
+		DemosaicBayerHalf( raw, pattern, opts.bayerGray, half );
+		
+		LoadImageOptions hopts = opts;
+		hopts.scaleDenom = opts.scaleDenom / 2;
+		if( opts.roi.area() > 0 )
+		{
+			int x0 = opts.roi.x / 2;
+			int y0 = opts.roi.y / 2;
+			int x1 = ( opts.roi.x + opts.roi.width  + 1 ) / 2;
+			int y1 = ( opts.roi.y + opts.roi.height + 1 ) / 2;
+			hopts.roi = cv::Rect( x0, y0, x1 - x0, y1 - y0 );
+		}
+		ApplyLoadOptions( half, dst, hopts, pool );
+		return;
+	}
+	
+	int code = BayerColorCode( pattern, opts.bayerGray );
+	if( opts.roi.area() == 0 )
+	{
+		PrepareImageBuffer( dst, raw.rows, raw.cols, type, pool );
+		cv::cvtColor( raw, dst, code );
+		return;
+	}
+	
+	// only demosaic the roi, with a small border so that its edges come out as they would
+	// for the whole image, and starting on an even pixel so the pattern is the same.
+	cv::Rect o = opts.OutputRect( raw.cols, raw.rows );
+	int x0 = std::max( 0, o.x - 2 ) & ~1;
+	int y0 = std::max( 0, o.y - 2 ) & ~1;
+	int x1 = std::min( raw.cols, o.x + o.width  + 2 );
+	int y1 = std::min( raw.rows, o.y + o.height + 2 );
+	thread_local cv::Mat part;
+	cv::cvtColor( raw( cv::Rect( x0, y0, x1 - x0, y1 - y0 ) ), part, code );
+	PrepareImageBuffer( dst, o.height, o.width, type, pool );
+	part( cv::Rect( o.x - x0, o.y - y0, o.width, o.height ) ).copyTo( dst );
+}
+
+std::vector<char>& ReadWholeFile( std::string filename, size_t &got )
+{
+	int fd = open( filename.c_str(), O_RDONLY );
+	if( fd < 0 )
+	{
+		throw std::runtime_error("Could not open file: " + filename );
+	}
+
+	struct stat st;
+	fstat( fd, &st );
+
+	thread_local std::vector<char> fileBuf;
+	if( fileBuf.size() < (size_t)st.st_size )
+		fileBuf.resize( st.st_size );
+
+	got = 0;
+	while( got < (size_t)st.st_size )
+	{
+		ssize_t r = pread( fd, &fileBuf[got], st.st_size - got, got );
+		if( r <= 0 )
+			break;
+		got += r;
+	}
+	close( fd );
+	return fileBuf;
+}
+
+
+//
+// JPEG
+//
+#ifdef HAVE_LIBJPEG
+static bool IsJPEG( const unsigned char *head, size_t len )
+{
+	return len >= 3 && head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF;
+}
+
+// libjpeg's default error handling is to exit(), so we jump back out instead.
+struct JpegErrorMgr
+{
+	jpeg_error_mgr mgr;
+	jmp_buf        jb;
+};
+static void JpegErrorExit( j_common_ptr cinfo )
+{
+	longjmp( ((JpegErrorMgr*)cinfo->err)->jb, 1 );
+}
+static void JpegOutputMessage( j_common_ptr cinfo )
+{
+	// be quiet about warnings.
+}
+
+static bool DecodeJPEG( const char *data, size_t len, const std::string &filename, cv::Mat &dst, ImageBufferPool *pool, const LoadImageOptions &opts )
+{
+	jpeg_decompress_struct cinfo;
+	JpegErrorMgr jerr;
+	cinfo.err = jpeg_std_error( &jerr.mgr );
+	jerr.mgr.error_exit     = JpegErrorExit;
+	jerr.mgr.output_message = JpegOutputMessage;
+
+	if( setjmp( jerr.jb ) )
+	{
+		// let Magick have a go, and give a proper error if it can't either.
+		jpeg_destroy_decompress( &cinfo );
+		return false;
+	}
+
+	jpeg_create_decompress( &cinfo );
+	jpeg_mem_src( &cinfo, (unsigned char*)data, len );
+	jpeg_read_header( &cinfo, TRUE );
+
+	int type, channels;
+	if( cinfo.jpeg_color_space == JCS_GRAYSCALE )
+	{
+		cinfo.out_color_space = JCS_GRAYSCALE;
+		type = CV_8UC1;
+		channels = 1;
+	}
+	else if( cinfo.num_components == 3 )
+	{
+#ifdef JCS_EXTENSIONS
+		cinfo.out_color_space = JCS_EXT_BGR;
+#else
+		cinfo.out_color_space = JCS_RGB;
+#endif
+		type = CV_8UC3;
+		channels = 3;
+	}
+	else
+	{
+		// CMYK and friends.
+		jpeg_destroy_decompress( &cinfo );
+		return false;
+	}
+	
+	// JPEG can decode straight to 1/2, 1/4 or 1/8 size by only using
+	// some of the DCT coefficients.
+	cinfo.scale_num   = 1;
+	cinfo.scale_denom = opts.scaleDenom;
+	
+	jpeg_start_decompress( &cinfo );
+	
+	cv::Rect o = opts.OutputRect( cinfo.image_width, cinfo.image_height );
+	if( (int)cinfo.output_width  < o.x + o.width || (int)cinfo.output_height < o.y + o.height )
+	{
+		// not the size we expected, so leave it to the general case.
+		jpeg_destroy_decompress( &cinfo );
+		return false;
+	}
+	
+	PrepareImageBuffer( dst, o.height, o.width, type, pool );
+	
+	if( o.width == (int)cinfo.output_width && o.height == (int)cinfo.output_height )
+	{
+		// the whole (possibly scaled) image, directly into dst.
+		JSAMPROW rows[8];
+		while( cinfo.output_scanline < cinfo.output_height )
+		{
+			unsigned n = std::min( 8u, cinfo.output_height - cinfo.output_scanline );
+			for( unsigned rc = 0; rc < n; ++rc )
+				rows[rc] = dst.ptr( cinfo.output_scanline + rc );
+			jpeg_read_scanlines( &cinfo, rows, n );
+		}
+		jpeg_finish_decompress( &cinfo );
+	}
+	else
+	{
+		// just a region. libjpeg-turbo can skip the columns and rows
+		// we don't want, but only in whole blocks, so the region it decodes
+		// can start a little to the left of what we asked for.
+		JDIMENSION xoff  = o.x;
+		JDIMENSION width = o.width;
+#ifdef LIBJPEG_TURBO_VERSION
+		if( o.width < (int)cinfo.output_width )
+			jpeg_crop_scanline( &cinfo, &xoff, &width );
+		if( o.y > 0 )
+			jpeg_skip_scanlines( &cinfo, o.y );
+#else
+		xoff = 0;
+#endif
+		thread_local std::vector<unsigned char> line;
+		line.resize( cinfo.output_width * channels );
+		unsigned lineOffset = ( o.x - xoff ) * channels;
+		
+		while( (int)cinfo.output_scanline < o.y + o.height )
+		{
+			int row = cinfo.output_scanline;
+			JSAMPROW lp = line.data();
+			jpeg_read_scanlines( &cinfo, &lp, 1 );
+			if( row >= o.y )
+				memcpy( dst.ptr( row - o.y ), line.data() + lineOffset, o.width * channels );
+		}
+		
+		// don't need the rest of the image.
+		jpeg_abort_decompress( &cinfo );
+	}
+	jpeg_destroy_decompress( &cinfo );
+
+#ifndef JCS_EXTENSIONS
+	if( type == CV_8UC3 )
+		cv::cvtColor( dst, dst, cv::COLOR_RGB2BGR );
+#endif
+	GrayIfAllGray( dst, pool );
+	return true;
+}
+#endif
+
+
+//
+// PNG
+//
+#ifdef HAVE_LIBPNG
+static bool IsPNG( const unsigned char *head, size_t len )
+{
+	const unsigned char sig[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+	return len >= 8 && memcmp( head, sig, 8 ) == 0;
+}
+
+struct PngMemSrc
+{
+	const unsigned char *data;
+	size_t len, pos;
+};
+static void PngReadMem( png_structp png, png_bytep out, png_size_t n )
+{
+	PngMemSrc *src = (PngMemSrc*)png_get_io_ptr( png );
+	if( src->pos + n > src->len )
+		png_error( png, "read past end of data" );
+	memcpy( out, src->data + src->pos, n );
+	src->pos += n;
+}
+static void PngWarning( png_structp png, png_const_charp msg )
+{
+	// be quiet about warnings.
+}
+
+static bool DecodePNG( const char *data, size_t len, const std::string &filename, cv::Mat &dst, ImageBufferPool *pool, const LoadImageOptions &opts )
+{
+	png_structp png = png_create_read_struct( PNG_LIBPNG_VER_STRING, NULL, NULL, PngWarning );
+	if( !png )
+		return false;
+	png_infop info = png_create_info_struct( png );
+
+	std::vector< png_bytep > rowPtrs;
+	if( !info || setjmp( png_jmpbuf(png) ) )
+	{
+		png_destroy_read_struct( &png, &info, NULL );
+		return false;
+	}
+
+	PngMemSrc src;
+	src.data = (const unsigned char*)data;
+	src.len  = len;
+	src.pos  = 0;
+	png_set_read_fn( png, &src, PngReadMem );
+	png_read_info( png, info );
+
+	unsigned w = png_get_image_width( png, info );
+	unsigned h = png_get_image_height( png, info );
+	int bitDepth  = png_get_bit_depth( png, info );
+	int colorType = png_get_color_type( png, info );
+
+	// Anything more than 8 bits, and palette images, Magick deals with
+	// in its own way, and we want the same results as always.
+	if( bitDepth > 8 || colorType == PNG_COLOR_TYPE_PALETTE )
+	{
+		png_destroy_read_struct( &png, &info, NULL );
+		return false;
+	}
+
+	int type;
+	if( colorType == PNG_COLOR_TYPE_GRAY )
+	{
+		if( bitDepth < 8 )
+			png_set_expand_gray_1_2_4_to_8( png );
+		type = CV_8UC1;
+	}
+	else
+	{
+		if( colorType == PNG_COLOR_TYPE_GRAY_ALPHA )
+			png_set_gray_to_rgb( png );
+		if( colorType & PNG_COLOR_MASK_ALPHA )
+			png_set_strip_alpha( png );
+		png_set_bgr( png );
+		type = CV_8UC3;
+	}
+	png_set_interlace_handling( png );
+	png_read_update_info( png, info );
+
+	PrepareImageBuffer( dst, h, w, type, pool );
+	rowPtrs.resize( h );
+	for( unsigned rc = 0; rc < h; ++rc )
+		rowPtrs[rc] = dst.ptr( rc );
+	png_read_image( png, rowPtrs.data() );
+	png_read_end( png, NULL );
+	png_destroy_read_struct( &png, &info, NULL );
+	GrayIfAllGray( dst, pool );
+	return true;
+}
+#endif
+
+
+//
+// TIFF
+//
+#ifdef HAVE_LIBTIFF
+static bool IsTIFF( const unsigned char *head, size_t len )
+{
+	return len >= 4 && ( ( head[0] == 'I' && head[1] == 'I' && head[2] == 42 && head[3] == 0 ) ||
+	                     ( head[0] == 'M' && head[1] == 'M' && head[2] == 0  && head[3] == 42 ) );
+}
+
+struct TiffMemSrc
+{
+	const char *data;
+	size_t len, pos;
+};
+static tmsize_t TiffRead( thandle_t h, void *buf, tmsize_t n )
+{
+	TiffMemSrc *src = (TiffMemSrc*)h;
+	size_t avail = src->pos < src->len ? src->len - src->pos : 0;
+	size_t c = std::min( (size_t)n, avail );
+	memcpy( buf, src->data + src->pos, c );
+	src->pos += c;
+	return c;
+}
+static tmsize_t TiffWrite( thandle_t h, void *buf, tmsize_t n )
+{
+	return 0;
+}
+static toff_t TiffSeek( thandle_t h, toff_t off, int whence )
+{
+	TiffMemSrc *src = (TiffMemSrc*)h;
+	if( whence == SEEK_SET )
+		src->pos = off;
+	else if( whence == SEEK_CUR )
+		src->pos += off;
+	else if( whence == SEEK_END )
+		src->pos = src->len + off;
+	return src->pos;
+}
+static int TiffClose( thandle_t h )
+{
+	return 0;
+}
+static toff_t TiffSize( thandle_t h )
+{
+	return ((TiffMemSrc*)h)->len;
+}
+static int TiffMap( thandle_t h, void **base, toff_t *size )
+{
+	TiffMemSrc *src = (TiffMemSrc*)h;
+	*base = (void*)src->data;
+	*size = src->len;
+	return 1;
+}
+static void TiffUnmap( thandle_t h, void *base, toff_t size )
+{
+}
+
+static bool DecodeTIFF( const char *data, size_t len, const std::string &filename, cv::Mat &dst, ImageBufferPool *pool, const LoadImageOptions &opts )
+{
+	TiffMemSrc src;
+	src.data = data;
+	src.len  = len;
+	src.pos  = 0;
+	TIFF *tif = TIFFClientOpen( filename.c_str(), "rm", (thandle_t)&src, TiffRead, TiffWrite, TiffSeek, TiffClose, TiffSize, TiffMap, TiffUnmap );
+	if( !tif )
+		return false;
+
+	uint32_t w, h;
+	uint16_t bps, spp, planar, photo, fmt;
+	TIFFGetField( tif, TIFFTAG_IMAGEWIDTH, &w );
+	TIFFGetField( tif, TIFFTAG_IMAGELENGTH, &h );
+	TIFFGetFieldDefaulted( tif, TIFFTAG_BITSPERSAMPLE, &bps );
+	TIFFGetFieldDefaulted( tif, TIFFTAG_SAMPLESPERPIXEL, &spp );
+	TIFFGetFieldDefaulted( tif, TIFFTAG_PLANARCONFIG, &planar );
+	TIFFGetFieldDefaulted( tif, TIFFTAG_SAMPLEFORMAT, &fmt );
+	if( !TIFFGetField( tif, TIFFTAG_PHOTOMETRIC, &photo ) )
+		photo = spp >= 3 ? PHOTOMETRIC_RGB : PHOTOMETRIC_MINISBLACK;
+
+	// We only take the simple and common cases - 8 bit grey or RGB(A) in scanlines.
+	// Float, 16 bit, tiled, planar etc. go to Magick.
+	bool simple = bps == 8 && fmt == SAMPLEFORMAT_UINT && planar == PLANARCONFIG_CONTIG && !TIFFIsTiled( tif ) &&
+	              ( ( photo == PHOTOMETRIC_MINISBLACK && spp == 1 ) || ( photo == PHOTOMETRIC_RGB && ( spp == 3 || spp == 4 ) ) );
+	if( !simple )
+	{
+		TIFFClose( tif );
+		return false;
+	}
+
+	PrepareImageBuffer( dst, h, w, spp == 1 ? CV_8UC1 : CV_8UC3, pool );
+	std::vector<unsigned char> line( TIFFScanlineSize( tif ) );
+	for( uint32_t rc = 0; rc < h; ++rc )
+	{
+		if( TIFFReadScanline( tif, line.data(), rc, 0 ) < 0 )
+		{
+			TIFFClose( tif );
+			throw std::runtime_error("Error reading TIFF: " + filename );
+		}
+		unsigned char *out = dst.ptr( rc );
+		if( spp == 1 )
+		{
+			memcpy( out, line.data(), w );
+		}
+		else
+		{
+			// RGB(A) -> BGR
+			const unsigned char *in = line.data();
+			for( uint32_t cc = 0; cc < w; ++cc )
+			{
+				out[0] = in[2];
+				out[1] = in[1];
+				out[2] = in[0];
+				out += 3;
+				in  += spp;
+			}
+		}
+	}
+	TIFFClose( tif );
+	GrayIfAllGray( dst, pool );
+	return true;
+}
+#endif
+
+
+//
+// AVIF
+//
+static bool IsAVIF( const unsigned char *head, size_t len )
+{
+	return len >= 12 && ( memcmp( head + 4, "ftypavif", 8 ) == 0 || memcmp( head + 4, "ftypavis", 8 ) == 0 );
+}
+
+static bool DecodeAVIF( const char *data, size_t len, const std::string &filename, cv::Mat &dst, ImageBufferPool *pool, const LoadImageOptions &opts )
+{
+	//
+	// Most of the time, the imagemagick stuff loads and works with .avif files fine
+	// _except_ when I run calibration and something goes awry. Well, it does on
+	// one of my servers.
+	// NOTE: This will lose any higher bit-depths.
+	dst = cv::imread( filename );
+	return !dst.empty();
+}
+
+
+
+static std::mutex decoderMutex;
+static std::vector< ImageDecoder >& Decoders()
+{
+	static std::vector< ImageDecoder > decoders = {
+#ifdef HAVE_LIBJPEG
+		{ "jpeg", IsJPEG, DecodeJPEG, true  },
+#endif
+#ifdef HAVE_LIBPNG
+		{ "png",  IsPNG,  DecodePNG,  false },
+#endif
+#ifdef HAVE_LIBTIFF
+		{ "tiff", IsTIFF, DecodeTIFF, false },
+#endif
+		{ "avif", IsAVIF, DecodeAVIF, false }
+	};
+	return decoders;
+}
+
+void RegisterImageDecoder( ImageDecoder dec )
+{
+	std::unique_lock<std::mutex> lock( decoderMutex );
+	std::vector< ImageDecoder > &decoders = Decoders();
+	decoders.insert( decoders.begin(), dec );
+}
+
+bool FindImageDecoder( const unsigned char *head, size_t len, ImageDecoder &dec )
+{
+	std::unique_lock<std::mutex> lock( decoderMutex );
+	std::vector< ImageDecoder > &decoders = Decoders();
+	for( unsigned dc = 0; dc < decoders.size(); ++dc )
+	{
+		if( decoders[dc].matches( head, len ) )
+		{
+			dec = decoders[dc];
+			return true;
+		}
+	}
+	return false;
+}
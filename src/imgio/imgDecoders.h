@@ -0,0 +1,71 @@
+#ifndef MC_IMG_DECODERS_H
+#define MC_IMG_DECODERS_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "imgio/imgCodec.h"
+
+class ImageBufferPool;
+struct LoadImageOptions;
+
+//
+// LoadImage() reads the file into memory and then picks a decoder by looking at the
+// first few bytes of the file (the signature) rather than the file extension.
+// JPEG, PNG and TIFF are decoded directly with libjpeg(-turbo), libpng and libtiff
+// when we have them, straight into the output image. Anything no decoder claims, or
+// that a decoder declines, goes to Magick++ as before.
+//
+// Decoders return false if they can't handle this particular file (e.g. a 16 bit PNG)
+// so that we fall back to Magick, and throw if the file is broken. Magick hands over
+// the data we have already read rather than reading the file again.
+//
+// The JPEG, PNG and TIFF decoders give the same number of channels Magick did: one
+// for grey files, and also one for colour files where every pixel is grey, as Magick
+// decided that from the pixels. When decoding only a region of a JPEG, it is the pixels
+// of the region that decide, so a grey region of a colour image comes back with one channel.
+//
+// If a decoder can decode at reduced resolution or just a region of the image itself,
+// it sets handlesOptions and must respect the LoadImageOptions it is given. Otherwise,
+// it always gets default options and LoadImage does the cropping and scaling afterwards.
+//
+typedef bool (*imageSigFn_t)( const unsigned char *head, size_t len );
+typedef bool (*imageDecodeFn_t)( const char *data, size_t len, const std::string &filename, cv::Mat &dst, ImageBufferPool *pool, const LoadImageOptions &opts );
+
+struct ImageDecoder
+{
+	std::string     name;
+	imageSigFn_t    matches;
+	imageDecodeFn_t decode;
+	bool            handlesOptions;
+};
+
+// Add a decoder. Decoders registered later are tried first.
+void RegisterImageDecoder( ImageDecoder dec );
+
+// find the decoder for a file starting with the bytes in head. Returns false if there isn't one.
+bool FindImageDecoder( const unsigned char *head, size_t len, ImageDecoder &dec );
+
+// make dst ready to take an image of the specified size and type,
+// from the pool if we have one.
+void PrepareImageBuffer( cv::Mat &dst, int rows, int cols, int type, ImageBufferPool *pool );
+
+// crop and scale a full resolution image into dst, as asked for by opts.
+void ApplyLoadOptions( const cv::Mat &full, cv::Mat &dst, const LoadImageOptions &opts, ImageBufferPool *pool );
+
+// Demosaic a raw Bayer image (CV_8UC1, even width and height) into dst as asked for by opts:
+// BGR, or grey if opts.bayerGray. If opts.scaleDenom is 2 or more, each 2x2 block of the
+// mosaic becomes one pixel in a single pass, rather than demosaicing at full resolution
+// only to shrink it again.
+void DecodeBayer( const cv::Mat &raw, bayerPattern_t pattern, cv::Mat &dst, const LoadImageOptions &opts, ImageBufferPool *pool );
+
+// the other way: sample a BGR image (even width and height) to the mosaic a camera would
+// have given us, which is mostly useful for testing.
+void MosaicBayer( const cv::Mat &bgr, bayerPattern_t pattern, cv::Mat &raw );
+
+// Read a whole file with a single pread into a per-thread buffer, which is returned.
+// The buffer may be bigger than the file - got is how much was read.
+std::vector<char>& ReadWholeFile( std::string filename, size_t &got );
+
+#endif
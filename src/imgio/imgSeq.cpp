@@ -0,0 +1,374 @@
+#include "imgio/imgSeq.h"
+
+#include <snappy.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <sstream>
+#include <iostream>
+using std::cout;
+using std::endl;
+
+static_assert( sizeof(ImgSeqFileHeader)  == 16, "ImgSeqFileHeader must be packed" );
+static_assert( sizeof(ImgSeqFrameHeader) == 32, "ImgSeqFrameHeader must be packed" );
+static_assert( sizeof(ImgSeqIndexEntry)  == 40, "ImgSeqIndexEntry must be packed" );
+static_assert( sizeof(ImgSeqFooter)      == 24, "ImgSeqFooter must be packed" );
+
+
+bool ReadImgSeqIndex( const char *data, size_t length, std::vector< ImgSeqIndexEntry > &index, uint64_t &dataEnd )
+{
+	index.clear();
+	
+	ImgSeqFileHeader fh;
+	if( length < sizeof(fh) )
+		return false;
+	memcpy( &fh, data, sizeof(fh) );
+	if( fh.magic != IMGSEQ_FILE_MAGIC || fh.version != IMGSEQ_VERSION )
+		return false;
+	
+	// the easy way - there's a footer and an index table.
+	if( length >= sizeof(fh) + sizeof(ImgSeqFooter) )
+	{
+		ImgSeqFooter ft;
+		memcpy( &ft, data + length - sizeof(ft), sizeof(ft) );
+		uint64_t indexEnd = length - sizeof(ft);
+		if( ft.magic == IMGSEQ_FOOTER_MAGIC && ft.indexOffset >= sizeof(fh) && ft.indexOffset <= indexEnd &&
+		    ft.numFrames == (indexEnd - ft.indexOffset) / sizeof(ImgSeqIndexEntry) &&
+		    ft.indexOffset + ft.numFrames * sizeof(ImgSeqIndexEntry) == indexEnd )
+		{
+			index.resize( ft.numFrames );
+			if( ft.numFrames > 0 )
+				memcpy( index.data(), data + ft.indexOffset, ft.numFrames * sizeof(ImgSeqIndexEntry) );
+			
+			// every frame has to be in the data before the index, otherwise this footer
+			// is stale or corrupt and we can't trust any of it.
+			bool ok = true;
+			for( unsigned ic = 0; ok && ic < index.size(); ++ic )
+			{
+				const ImgSeqIndexEntry &e = index[ic];
+				ok = e.offset >= sizeof(fh) + sizeof(ImgSeqFrameHeader) && e.size <= ft.indexOffset && e.offset <= ft.indexOffset - e.size;
+			}
+			
+			if( ok )
+			{
+				dataEnd = ft.indexOffset;
+				return true;
+			}
+			index.clear();
+			cout << "imgSeq file has a bad index." << endl;
+		}
+	}
+	
+	// the hard way - the file was not closed properly, so walk through the frames.
+	cout << "imgSeq file has no index, rebuilding from frame records..." << endl;
+	uint64_t pos = sizeof(fh);
+	while( pos + sizeof(ImgSeqFrameHeader) <= length )
+	{
+		ImgSeqFrameHeader h;
+		memcpy( &h, data + pos, sizeof(h) );
+		if( h.magic != IMGSEQ_FRAME_MAGIC || h.size > length - pos - sizeof(h) )
+			break;
+		
+		ImgSeqIndexEntry e;
+		e.frameNo = h.frameNo;
+		e.offset  = pos + sizeof(h);
+		e.size    = h.size;
+		e.rows    = h.rows;
+		e.cols    = h.cols;
+		e.type    = h.type;
+		e.pad     = 0;
+		index.push_back( e );
+		
+		pos += sizeof(h) + h.size;
+	}
+	dataEnd = pos;
+	return true;
+}
+
+
+
+ImageSequenceWriter::ImageSequenceWriter( std::string outfn )
+{
+	filename = outfn;
+	fd = open( outfn.c_str(), O_RDWR | O_CREAT, 0644 );
+	if( fd < 0 )
+	{
+		throw std::runtime_error("Could not open imgSeq file for writing: " + outfn );
+	}
+	
+	struct stat st;
+	fstat( fd, &st );
+	if( st.st_size == 0 )
+	{
+		// new file, so start with the header.
+		ImgSeqFileHeader fh;
+		fh.magic    = IMGSEQ_FILE_MAGIC;
+		fh.version  = IMGSEQ_VERSION;
+		fh.reserved = 0;
+		if( pwrite( fd, &fh, sizeof(fh), 0 ) != sizeof(fh) )
+			throw std::runtime_error("Could not write imgSeq header: " + outfn );
+		dataEnd = sizeof(fh);
+	}
+	else
+	{
+		// existing file, so we append to it.
+		void *m = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+		if( m == MAP_FAILED )
+			throw std::runtime_error("Could not map existing imgSeq file: " + outfn );
+		bool ok = ReadImgSeqIndex( (const char*)m, st.st_size, index, dataEnd );
+		munmap( m, st.st_size );
+		if( !ok )
+			throw std::runtime_error("Existing file is not an imgSeq file, or is an unknown version: " + outfn );
+		
+		// New frames are written where the index is now, so get rid of the old index and footer
+		// first. Otherwise, if we die before Flush(), the old footer would still be at the end 
+		// of the file but the index it points at would be frame data.
+		if( ftruncate( fd, dataEnd ) != 0 )
+			throw std::runtime_error("Failed truncating imgSeq file for appending: " + outfn );
+		cout << "appending to " << outfn << " which has " << index.size() << " frames" << endl;
+	}
+}
+
+ImageSequenceWriter::~ImageSequenceWriter()
+{
+	// a destructor mustn't throw, which it would if the disk were full.
+	try
+	{
+		Flush();
+	}
+	catch( std::exception &e )
+	{
+		cout << "ImageSequenceWriter: failed to write the index when closing the file: " << e.what() << endl;
+	}
+	close( fd );
+}
+
+void ImageSequenceWriter::AddImage( cv::Mat &img, size_t imgNumber )
+{
+	cv::Mat cimg = img;
+	if( !cimg.isContinuous() )
+		cimg = img.clone();
+	
+	size_t rawSize = cimg.total() * cimg.elemSize();
+	compressed.resize( snappy::MaxCompressedLength( rawSize ) );
+	size_t s;
+	snappy::RawCompress( (char*)cimg.data, rawSize, compressed.data(), &s );
+	
+	ImgSeqFrameHeader h;
+	h.magic   = IMGSEQ_FRAME_MAGIC;
+	h.type    = cimg.type();
+	h.rows    = cimg.rows;
+	h.cols    = cimg.cols;
+	h.frameNo = imgNumber;
+	h.size    = s;
+	
+	// frames go at the end of the data, the index is written after them by Flush()
+	if( pwrite( fd, &h, sizeof(h), dataEnd ) != sizeof(h) ||
+	    pwrite( fd, compressed.data(), s, dataEnd + sizeof(h) ) != (ssize_t)s )
+	{
+		throw std::runtime_error("Failed writing frame to imgSeq file: " + filename );
+	}
+	
+	ImgSeqIndexEntry e;
+	e.frameNo = imgNumber;
+	e.offset  = dataEnd + sizeof(h);
+	e.size    = s;
+	e.rows    = h.rows;
+	e.cols    = h.cols;
+	e.type    = h.type;
+	e.pad     = 0;
+	index.push_back( e );
+	
+	dataEnd += sizeof(h) + s;
+}
+
+void ImageSequenceWriter::Flush()
+{
+	ImgSeqFooter ft;
+	ft.indexOffset = dataEnd;
+	ft.numFrames   = index.size();
+	ft.magic       = IMGSEQ_FOOTER_MAGIC;
+	ft.pad         = 0;
+	
+	size_t ib = index.size() * sizeof(ImgSeqIndexEntry);
+	if( ( ib > 0 && pwrite( fd, index.data(), ib, dataEnd ) != (ssize_t)ib ) ||
+	    pwrite( fd, &ft, sizeof(ft), dataEnd + ib ) != sizeof(ft) )
+	{
+		throw std::runtime_error("Failed writing index to imgSeq file: " + filename );
+	}
+	
+	// make sure the footer really is at the end of the file.
+	if( ftruncate( fd, dataEnd + ib + sizeof(ft) ) != 0 )
+	{
+		throw std::runtime_error("Failed truncating imgSeq file: " + filename );
+	}
+}
+
+
+
+
+
+
+
+ImageSequenceSource::ImageSequenceSource( std::string in_filepath, std::string in_calibPath )
+{
+	//
+	// Input filepath can be of the format:
+	// /path/to/file.imgSeq
+	// path/to/file.imgSeq:<firstframe>
+	//
+	auto a = in_filepath.rfind(":");
+	std::string filepath;
+	if( a == std::string::npos )
+	{
+		filepath = in_filepath;
+		currentFrameNo = 0;
+	}
+	else
+	{
+		filepath = std::string( in_filepath.begin(), in_filepath.begin()+a );
+		std::string numStr( in_filepath.begin()+a+1, in_filepath.end() );
+		currentFrameNo = std::atoi( numStr.c_str() );
+	}
+	
+	cout << "opening: " << filepath << endl;
+	fd = open( filepath.c_str(), O_RDONLY );
+	if( fd < 0 )
+		throw std::runtime_error("Could not open imgSeq file: " + filepath );
+	
+	struct stat st;
+	fstat( fd, &st );
+	dataLength = st.st_size;
+	void *m = mmap( NULL, dataLength, PROT_READ, MAP_SHARED, fd, 0 );
+	if( m == MAP_FAILED )
+	{
+		close( fd );
+		throw std::runtime_error("Could not map imgSeq file: " + filepath );
+	}
+	data = (const char*)m;
+	
+	uint64_t dataEnd;
+	if( !ReadImgSeqIndex( data, dataLength, index, dataEnd ) || index.size() == 0 )
+	{
+		munmap( (void*)data, dataLength );
+		close( fd );
+		throw std::runtime_error("Not an imgSeq file, or file has no frames: " + filepath );
+	}
+	
+	// sort by frame number so we can binary search for frames. Frame numbers can be
+	// sparse and large, so a direct lookup table could be huge. If a frame was written
+	// more than once, the stable sort keeps the copies in the order they were written.
+	std::stable_sort( index.begin(), index.end(), []( const ImgSeqIndexEntry &a, const ImgSeqIndexEntry &b ) { return a.frameNo < b.frameNo; } );
+	minFrame = index.front().frameNo;
+	maxFrame = index.back().frameNo;
+	
+	// for the frames we don't have.
+	blank = cv::Mat( index[0].rows, index[0].cols, index[0].type, cv::Scalar(0) );
+	
+	calibPath = in_calibPath;
+	if( calibPath.compare("none") == 0 )
+	{
+		calibPath = filepath + ".calib";
+	}
+	calibration.Read( calibPath );
+	
+	FindImage();
+}
+
+ImageSequenceSource::~ImageSequenceSource()
+{
+	munmap( (void*)data, dataLength );
+	close( fd );
+}
+
+const ImgSeqIndexEntry* ImageSequenceSource::FindEntry( unsigned frame )
+{
+	// the last copy of the frame is the one that counts.
+	auto i = std::upper_bound( index.begin(), index.end(), frame, []( unsigned f, const ImgSeqIndexEntry &e ) { return f < e.frameNo; } );
+	if( i == index.begin() || (i-1)->frameNo != frame )
+		return NULL;
+	return &(*(i-1));
+}
+
+cv::Mat ImageSequenceSource::GetFrame( unsigned frame )
+{
+	const ImgSeqIndexEntry *ep = FindEntry( frame );
+	if( !ep )
+		return blank.clone();
+	
+	const ImgSeqIndexEntry &e = *ep;
+	
+	// decompress straight from the mapped file into the image.
+	cv::Mat img( e.rows, e.cols, e.type );
+	size_t ulen;
+	const char *src = data + e.offset;
+	if( !snappy::GetUncompressedLength( src, e.size, &ulen ) || ulen != img.total() * img.elemSize() ||
+	    !snappy::RawUncompress( src, e.size, (char*)img.data ) )
+	{
+		std::stringstream ss;
+		ss << "imgSeq: could not uncompress frame " << frame;
+		throw std::runtime_error( ss.str() );
+	}
+	return img;
+}
+
+void ImageSequenceSource::FindImage()
+{
+	current = GetFrame( currentFrameNo );
+}
+
+cv::Mat ImageSequenceSource::GetCurrent()
+{
+	return current;
+}
+
+bool ImageSequenceSource::Advance()
+{
+	if( currentFrameNo < maxFrame )
+	{
+		++currentFrameNo;
+		FindImage();
+		return true;
+	}
+	else return false;
+}
+
+bool ImageSequenceSource::Regress()
+{
+	if( currentFrameNo > 0 )
+	{
+		--currentFrameNo;
+		FindImage();
+		return true;
+	}
+	else return false;
+}
+
+unsigned ImageSequenceSource::GetCurrentFrameID()
+{
+	return currentFrameNo;
+}
+
+frameTime_t ImageSequenceSource::GetCurrentFrameTime()
+{
+	return 0;
+}
+
+int ImageSequenceSource::GetNumImages()
+{
+	// as with other frame number based sources, frames start at 0.
+	return maxFrame + 1;
+}
+
+bool ImageSequenceSource::JumpToFrame(unsigned frame)
+{
+	if( frame > maxFrame )
+		return false;
+	currentFrameNo = frame;
+	FindImage();
+	return true;
+}
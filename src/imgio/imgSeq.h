@@ -0,0 +1,152 @@
+#ifndef MC_DEV_IMGSEQ_H
+#define MC_DEV_IMGSEQ_H
+
+#include "imgio/imagesource.h"
+
+//
+// Directories of hundreds of thousands of small .charImg / .floatImg files are slow to list,
+// slow to open one-by-one, and are very hard work for network filesystems. So, the .imgSeq
+// format packs a whole sequence (e.g. one camera of a take) into a single file.
+//
+// The file layout is:
+//   - file header
+//   - frame records, each of which is a small frame header followed by the snappy compressed pixels.
+//   - an index table with the frame number, shape, type and offset of every frame
+//   - a footer which says where the index table is.
+//
+// Writing is append only: opening an existing file for writing reads the index and cuts the old index and
+// footer off the end of the file. The index and footer are written again after the new frames whenever the 
+// writer is flushed or closed. If a writer dies before writing the index, the reader (and the writer) can 
+// rebuild it by walking the frame records. An index is only used if every frame it lists is in the data
+// before it, otherwise it is rebuilt the same way.
+//
+// The reader mmaps the file, so any frame can be got at directly, and is decompressed straight
+// into the output image.
+//
+
+#define IMGSEQ_FILE_MAGIC   820830006
+#define IMGSEQ_FRAME_MAGIC  820830007
+#define IMGSEQ_FOOTER_MAGIC 820830008
+
+// files of any other version are refused.
+#define IMGSEQ_VERSION      1
+
+struct ImgSeqFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t reserved;
+};
+
+struct ImgSeqFrameHeader
+{
+	uint32_t magic;
+	int32_t  type;          // OpenCV type of the image
+	uint32_t rows;
+	uint32_t cols;
+	uint64_t frameNo;
+	uint64_t size;          // compressed size of the data following this header
+};
+
+struct ImgSeqIndexEntry
+{
+	uint64_t frameNo;
+	uint64_t offset;        // offset of the compressed data from the start of the file
+	uint64_t size;          // size of the compressed data
+	uint32_t rows;
+	uint32_t cols;
+	int32_t  type;
+	uint32_t pad;
+};
+
+struct ImgSeqFooter
+{
+	uint64_t indexOffset;
+	uint64_t numFrames;
+	uint32_t magic;
+	uint32_t pad;
+};
+
+
+//
+// Write images to an .imgSeq file.
+//
+class ImageSequenceWriter
+{
+public:
+	// if the file exists, new frames are appended to it.
+	ImageSequenceWriter( std::string outfn );
+	~ImageSequenceWriter();
+	
+	void AddImage( cv::Mat &img, size_t imgNumber );
+	
+	// write the index so that the file is complete.
+	void Flush();
+	
+protected:
+	
+	int fd;
+	std::string filename;
+	uint64_t dataEnd;
+	std::vector< ImgSeqIndexEntry > index;
+	std::vector< char > compressed;
+};
+
+
+//
+// Image source for reading .imgSeq files.
+// As with the HDF5Source, frames that aren't in the file come back as black images.
+//
+class ImageSequenceSource : public ImageSource, public FrameProvider
+{
+public:
+	ImageSequenceSource( std::string in_filepath, std::string in_calibPath );
+	~ImageSequenceSource();
+	
+	cv::Mat GetCurrent();
+	bool Advance();
+	bool Regress();
+	
+	unsigned GetCurrentFrameID();
+	frameTime_t GetCurrentFrameTime();
+	int GetNumImages();
+	bool JumpToFrame(unsigned frame);
+	
+	void SaveCalibration()
+	{
+		calibration.Write( calibPath );
+	}
+	
+	// decode any frame, without changing the current frame. The file is
+	// mapped read-only, so this is fine from any thread.
+	cv::Mat GetFrame( unsigned frame );
+	
+protected:
+	
+	void FindImage();
+	
+	// index entry of a frame, or NULL if we don't have it.
+	const ImgSeqIndexEntry* FindEntry( unsigned frame );
+	
+	int fd;
+	const char *data;
+	size_t dataLength;
+	
+	// sorted by frame number.
+	std::vector< ImgSeqIndexEntry > index;
+	unsigned minFrame, maxFrame;
+	cv::Mat blank;
+	
+	unsigned currentFrameNo;
+	cv::Mat current;
+	
+	std::string calibPath;
+};
+
+
+// read the index of an .imgSeq file from memory, rebuilding it from the frame records if need be.
+// dataEnd is set to the end of the last frame record. Returns false if this isn't an .imgSeq file
+// of a version we know.
+bool ReadImgSeqIndex( const char *data, size_t length, std::vector< ImgSeqIndexEntry > &index, uint64_t &dataEnd );
+
+#endif
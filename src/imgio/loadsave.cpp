@@ -12,182 +12,323 @@ using std::endl;
 // often we'll be after a very fast io rather than the best of the
 // best compression - and we want to be lossless!
 #include <snappy.h>
+#include "imgio/imgCodec.h"
+#include "imgio/imgDecoders.h"
 
-bool magickIsInitted = false;
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-// Sometimes, it's quicker or just nicer to have a custom wrapper
-// for loading / saving images and using Magick++ rather than opencv.
-cv::Mat LoadImage(std::string filename)
+// Magick needs initialising exactly once, and we might well be
+// loading or saving from several threads at the same time.
+static std::once_flag magickInitFlag;
+static void InitMagick()
+{
+	std::call_once( magickInitFlag, [](){ Magick::InitializeMagick(NULL); } );
+}
+
+
+void ImageBufferPool::SetMaxBuffers( unsigned in_maxBuffers )
 {
+	std::unique_lock<std::mutex> lock( mutex );
+	maxBuffers = in_maxBuffers;
+	if( buffers.size() > maxBuffers )
+		buffers.resize( maxBuffers );
+}
 
-	if( !magickIsInitted )
+cv::Mat ImageBufferPool::Get( int rows, int cols, int type )
+{
+	std::unique_lock<std::mutex> lock( mutex );
+	
+	// a buffer is free if the pool holds the only reference to it.
+	int spare = -1;
+	for( unsigned bc = 0; bc < buffers.size(); ++bc )
 	{
-	    Magick::InitializeMagick(NULL);
-	    magickIsInitted = true;
+		cv::Mat &b = buffers[bc];
+		if( b.u == NULL || b.u->refcount != 1 )
+			continue;
+		
+		if( b.rows == rows && b.cols == cols && b.type() == type )
+			return b;
+		spare = bc;
 	}
 	
-	//cout << "loading: " << filename << endl;
-	if( filename.find(".floatImg") != std::string::npos )
+	cv::Mat m( rows, cols, type );
+	if( buffers.size() < maxBuffers )
 	{
-		//cout << "is .floatImg" << endl;
-		// this should be an uncompressed float image.
-		std::ifstream infi;
-		infi.open( filename, std::ios::in | std::ios::binary );
+		buffers.push_back( m );
+	}
+	else if( spare >= 0 )
+	{
+		// an unused buffer of the wrong size, so swap it for one of the right size.
+		buffers[spare] = m;
+	}
+	return m;
+}
 
-		unsigned magic,w,h,c;
-		size_t s;
-		infi.read( (char*)&magic, sizeof(magic) );
 
-		if( magic != 820830001 )
-		{
-			goto jumpLabel01;
-		}
+cv::Rect LoadImageOptions::OutputRect( int fullWidth, int fullHeight ) const
+{
+	if( scaleDenom != 1 && scaleDenom != 2 && scaleDenom != 4 && scaleDenom != 8 )
+	{
+		std::stringstream ss;
+		ss << "LoadImageOptions: scaleDenom must be 1, 2, 4 or 8, not " << scaleDenom;
+		throw std::runtime_error( ss.str() );
+	}
+	
+	// same rounding as libjpeg uses for its reduced size output.
+	int d  = scaleDenom;
+	int ws = (fullWidth  + d - 1) / d;
+	int hs = (fullHeight + d - 1) / d;
+	if( roi.area() == 0 )
+		return cv::Rect( 0, 0, ws, hs );
+	
+	int x0 = std::max( 0, roi.x / d );
+	int y0 = std::max( 0, roi.y / d );
+	int x1 = std::min( ws, (roi.x + roi.width  + d - 1) / d );
+	int y1 = std::min( hs, (roi.y + roi.height + d - 1) / d );
+	if( x1 <= x0 || y1 <= y0 )
+		throw std::runtime_error( "LoadImageOptions: roi is outside of the image." );
+	return cv::Rect( x0, y0, x1-x0, y1-y0 );
+}
+
+
+// check a version 2 header against the size of the file and what we expect the data size to be.
+static void CheckHeaderV2( const ImgFileHeaderV2 &hdr, size_t got, size_t expected, std::string typeName, std::string filename )
+{
+	if( hdr.version != 2 )
+	{
+		std::stringstream ss;
+		ss << typeName << filename << " has unknown header version " << hdr.version;
+		throw std::runtime_error( ss.str() );
+	}
+	if( hdr.rawSize != expected || hdr.compressedSize > got - sizeof(hdr) )
+		throw std::runtime_error( typeName + filename + " has inconsistent sizes in its header.");
+}
 
-		infi.read( (char*)&w, sizeof(w) );
-		infi.read( (char*)&h, sizeof(h) );
-		infi.read( (char*)&c, sizeof(c) );
-		infi.read( (char*)&s, sizeof(s) );
-		std::vector<char> d(s);
-		infi.read( &d[0], s );
-		std::string uncompressed;
-		if( !snappy::Uncompress( &d[0], d.size(), &uncompressed ) )
+//
+// Decoder for our .charImg and .floatImg formats.
+// LoadImage has already read the whole file into memory and we decompress 
+// directly into the output image, so in the steady state there are no 
+// allocations and only the one copy that the decompressor has to do anyway.
+//
+// Handles both the original snappy-only files and the version 2 files that
+// say which codec they used.
+//
+// Compressed files have to be decompressed in full before we can crop or scale them,
+// but for uncompressed version 2 files we only touch the rows we actually want.
+//
+// Raw Bayer images (version 2 only) are demosaiced as the options ask, see DecodeBayer().
+//
+// returns false if the magic number didn't match.
+//
+static bool DecodeCustomImage( const char *data, size_t got, const std::string &filename, unsigned magicV1, unsigned magicV2, int depth, cv::Mat &dst, ImageBufferPool *pool, const LoadImageOptions &opts )
+{
+	unsigned magic;
+	if( got < sizeof(magic) )
+		return false;
+	memcpy( &magic, data, sizeof(magic) );
+	
+	std::string typeName = (depth == CV_32F) ? "floatImg " : "charImg ";
+	
+	if( magic == magicV2 && got >= sizeof(ImgFileHeaderV2) )
+	{
+		ImgFileHeaderV2 hdr;
+		memcpy( &hdr, data, sizeof(hdr) );
+		if( hdr.bayer != BAYER_NONE )
 		{
-			//throw std::runtime_error("Could not uncompress image (snappy error) " );
-			cout << "Could not uncompress data with snappy... perhaps this is an old file?" << endl;
-			if( c == 1 )
-			{
-				cv::Mat img(h,w, CV_32FC1);
-				memcpy(img.data, &d[0], d.size() );
-				return img;
-			}
-			else if( c == 3 )
+			if( depth != CV_8U || hdr.c != 1 )
+				throw std::runtime_error( typeName + filename + " says it is a Bayer image but isn't 8 bit, 1 channel.");
+			CheckHeaderV2( hdr, got, (size_t)hdr.w * hdr.h, typeName, filename );
+			
+			// the mosaic, straight from the file if we can.
+			cv::Mat raw;
+			if( hdr.codec == IMGCODEC_NONE && hdr.filter == IMGFILTER_NONE )
 			{
-				cv::Mat img(h,w, CV_32FC3);
-				memcpy(img.data, &d[0], d.size() );
-				return img;
+				raw = cv::Mat( hdr.h, hdr.w, CV_8UC1, (void*)(data + sizeof(hdr)) );
 			}
 			else
 			{
-				throw std::runtime_error("floatImg " + filename + " had the wrong number of channels.");
+				thread_local cv::Mat rawBuf;
+				PrepareImageBuffer( rawBuf, hdr.h, hdr.w, CV_8UC1, NULL );
+				if( !ImgDecodePayload( (imgCodec_t)hdr.codec, (imgFilter_t)hdr.filter, data + sizeof(hdr), hdr.compressedSize, 
+				                       (char*)rawBuf.data, hdr.h, hdr.w, 1, 1 ) )
+					throw std::runtime_error( typeName + filename + " could not be decompressed (" + ImgCodecName( (imgCodec_t)hdr.codec ) + ")" );
+				raw = rawBuf;
 			}
-
+			DecodeBayer( raw, (bayerPattern_t)hdr.bayer, dst, opts, pool );
+			return true;
 		}
-		else
+	}
+	
+	if( !opts.IsDefault() )
+	{
+		if( magic == magicV2 && got >= sizeof(ImgFileHeaderV2) )
 		{
-			if( c == 1 )
-			{
-				cv::Mat img(h,w, CV_32FC1);
-				memcpy(img.data, uncompressed.data(), uncompressed.size() );
-				return img;
-			}
-			else if( c == 3 )
-			{
-				cv::Mat img(h,w, CV_32FC3);
-				memcpy(img.data, uncompressed.data(), uncompressed.size() );
-				return img;
-			}
-			else
+			ImgFileHeaderV2 hdr;
+			memcpy( &hdr, data, sizeof(hdr) );
+			if( hdr.codec == IMGCODEC_NONE && hdr.filter == IMGFILTER_NONE && (hdr.c == 1 || hdr.c == 3) )
 			{
-				throw std::runtime_error("floatImg " + filename + " had the wrong number of channels.");
+				size_t elemSize = (depth == CV_32F ? sizeof(float) : 1) * hdr.c;
+				CheckHeaderV2( hdr, got, (size_t)hdr.w * hdr.h * elemSize, typeName, filename );
+				cv::Mat full( hdr.h, hdr.w, CV_MAKETYPE( depth, hdr.c ), (void*)(data + sizeof(hdr)) );
+				ApplyLoadOptions( full, dst, opts, pool );
+				return true;
 			}
 		}
+		
+		thread_local cv::Mat full;
+		if( !DecodeCustomImage( data, got, filename, magicV1, magicV2, depth, full, NULL, LoadImageOptions() ) )
+			return false;
+		ApplyLoadOptions( full, dst, opts, pool );
+		return true;
+	}
+	
+	if( magic == magicV2 )
+	{
+		ImgFileHeaderV2 hdr;
+		if( got < sizeof(hdr) )
+			throw std::runtime_error( typeName + filename + " is truncated." );
+		memcpy( &hdr, data, sizeof(hdr) );
+		
+		if( hdr.c != 1 && hdr.c != 3 )
+			throw std::runtime_error( typeName + filename + " had the wrong number of channels.");
+		
+		PrepareImageBuffer( dst, hdr.h, hdr.w, CV_MAKETYPE( depth, hdr.c ), pool );
+		CheckHeaderV2( hdr, got, dst.total() * dst.elemSize(), typeName, filename );
+		
+		if( !ImgDecodePayload( (imgCodec_t)hdr.codec, (imgFilter_t)hdr.filter, data + sizeof(hdr), hdr.compressedSize, 
+		                       (char*)dst.data, hdr.h, hdr.w * hdr.c, hdr.c, dst.elemSize1() ) )
+			throw std::runtime_error( typeName + filename + " could not be decompressed (" + ImgCodecName( (imgCodec_t)hdr.codec ) + ")" );
+		return true;
 	}
-	else if( filename.find(".charImg")  != std::string::npos)
+	
+	if( magic != magicV1 )
+		return false;
+	
+	// original header is: magic, width, height, channels, compressed size.
+	const size_t headerSize = 4*sizeof(unsigned) + sizeof(size_t);
+	if( got < headerSize )
+		return false;
+	
+	unsigned w,h,c;
+	size_t s;
+	const char *p = data + sizeof(magic);
+	memcpy( &w, p, sizeof(w) ); p += sizeof(w);
+	memcpy( &h, p, sizeof(h) ); p += sizeof(h);
+	memcpy( &c, p, sizeof(c) ); p += sizeof(c);
+	memcpy( &s, p, sizeof(s) ); p += sizeof(s);
+	s = std::min( s, got - headerSize );
+	
+	if( c != 1 && c != 3 )
 	{
-		//cout << "is .charImg..." << endl;
-		// this should be an snappy compress 8-bit image.
-		std::ifstream infi;
-		infi.open( filename, std::ios::in | std::ios::binary );
+		throw std::runtime_error( typeName + filename + " had the wrong number of channels.");
+	}
+	
+	PrepareImageBuffer( dst, h, w, CV_MAKETYPE( depth, c ), pool );
+	size_t expected = dst.total() * dst.elemSize();
+	
+	if( ImgCodecDecompress( IMGCODEC_SNAPPY, p, s, (char*)dst.data, expected ) )
+	{
+		return true;
+	}
+	
+	// Really old files were not compressed.
+	cout << "Could not uncompress data with snappy... perhaps this is an old file?" << endl;
+	memcpy( dst.data, p, std::min( s, expected ) );
+	return true;
+}
 
-		unsigned magic,w,h,c;
-		size_t s;
-		infi.read( (char*)&magic, sizeof(magic) );
 
-		if( magic != 820830002 )
-		{
-			cout << "wrong magic number for .charImg... trying with Magick instead..." << endl;
-			goto jumpLabel01;
-		}
+static bool IsCharImg( const unsigned char *head, size_t len )
+{
+	unsigned magic;
+	if( len < sizeof(magic) )
+		return false;
+	memcpy( &magic, head, sizeof(magic) );
+	return magic == IMG_MAGIC_CHAR || magic == IMG_MAGIC_CHAR_V2;
+}
+static bool DecodeCharImg( const char *data, size_t len, const std::string &filename, cv::Mat &dst, ImageBufferPool *pool, const LoadImageOptions &opts )
+{
+	return DecodeCustomImage( data, len, filename, IMG_MAGIC_CHAR, IMG_MAGIC_CHAR_V2, CV_8U, dst, pool, opts );
+}
 
-		infi.read( (char*)&w, sizeof(w) );
-		infi.read( (char*)&h, sizeof(h) );
-		infi.read( (char*)&c, sizeof(c) );
-		infi.read( (char*)&s, sizeof(s) );
-		std::vector<char> d(s);
-		infi.read( &d[0], s );
-		std::string uncompressed;
-		if( !snappy::Uncompress( &d[0], d.size(), &uncompressed ) )
-		{
-			//throw std::runtime_error("Could not uncompress image (snappy error) " );
-			cout << "Could not uncompress data with snappy..." << endl;
-			if( c == 1 )
-			{
-				cv::Mat img(h,w, CV_8UC1);
-				memcpy(img.data, &d[0], d.size() );
-				return img;
-			}
-			else if( c == 3 )
-			{
-				cv::Mat img(h,w, CV_8UC3);
-				memcpy(img.data, &d[0], d.size() );
-				return img;
-			}
-			else
-			{
-				throw std::runtime_error("charImg " + filename + " had the wrong number of channels.");
-			}
+static bool IsFloatImg( const unsigned char *head, size_t len )
+{
+	unsigned magic;
+	if( len < sizeof(magic) )
+		return false;
+	memcpy( &magic, head, sizeof(magic) );
+	return magic == IMG_MAGIC_FLOAT || magic == IMG_MAGIC_FLOAT_V2;
+}
+static bool DecodeFloatImg( const char *data, size_t len, const std::string &filename, cv::Mat &dst, ImageBufferPool *pool, const LoadImageOptions &opts )
+{
+	return DecodeCustomImage( data, len, filename, IMG_MAGIC_FLOAT, IMG_MAGIC_FLOAT_V2, CV_32F, dst, pool, opts );
+}
+
+static std::once_flag customDecodersFlag;
 
+static void LoadImageImpl( std::string filename, cv::Mat &dst, ImageBufferPool *pool, const LoadImageOptions &opts )
+{
+	std::call_once( customDecodersFlag, [](){
+		RegisterImageDecoder( { "charImg",  IsCharImg,  DecodeCharImg,  true } );
+		RegisterImageDecoder( { "floatImg", IsFloatImg, DecodeFloatImg, true } );
+	} );
+	
+	// decoders that can't crop or scale for themselves decode the full
+	// image into here and we do it afterwards.
+	thread_local cv::Mat full;
+	bool postProcess = !opts.IsDefault();
+	
+	//cout << "loading: " << filename << endl;
+	
+	// We choose how to decode the image from the first few bytes of the file, not
+	// the extension. Anything we don't have a decoder for goes to Magick.
+	size_t got;
+	std::vector<char> &fileBuf = ReadWholeFile( filename, got );
+	
+	ImageDecoder dec;
+	if( FindImageDecoder( (const unsigned char*)fileBuf.data(), got, dec ) )
+	{
+		if( dec.handlesOptions || !postProcess )
+		{
+			if( dec.decode( fileBuf.data(), got, filename, dst, pool, opts ) )
+				return;
 		}
-		else
+		else if( dec.decode( fileBuf.data(), got, filename, full, NULL, LoadImageOptions() ) )
 		{
-			if( c == 1 )
-			{
-				cv::Mat img(h,w, CV_8UC1);
-				memcpy(img.data, uncompressed.data(), uncompressed.size() );
-				return img;
-			}
-			else if( c == 3 )
-			{
-				cv::Mat img(h,w, CV_8UC3);
-				memcpy(img.data, uncompressed.data(), uncompressed.size() );
-				return img;
-			}
-			else
-			{
-				throw std::runtime_error("charImg " + filename + " had the wrong number of channels.");
-			}
+			ApplyLoadOptions( full, dst, opts, pool );
+			return;
 		}
 	}
-	if( filename.find(".avif") != std::string::npos )
+	else if( filename.find(".charImg") != std::string::npos )
 	{
-		// 
-		// Most of the time, the imagemagick stuff loads and works with .avif files fine
-		// _except_ when I run calibration and something goes awry. Well, it does on
-		// one of my servers.
-		// NOTE: This will lose any higher bit-depths.
-		return cv::imread( filename );
+		cout << "wrong magic number for .charImg... trying with Magick instead..." << endl;
 	}
 	
+	InitMagick();
 
-jumpLabel01:
-
+	// Magick can have the data we already read. The file name tells it the format
+	// of files that don't have a signature.
 	Magick::Image mimg;
-	mimg.read(filename);
+	mimg.fileName( filename );
+	mimg.read( Magick::Blob( fileBuf.data(), got ) );
+	
+	cv::Mat &out = postProcess ? full : dst;
+	ImageBufferPool *outPool = postProcess ? NULL : pool;
 
 	// TODO: Check type and colour channels of mimg...
 	if( mimg.type() == Magick::GrayscaleType)
 	{
 		if( mimg.depth() == 8 )
 		{
-			cv::Mat cvimg( mimg.rows(), mimg.columns(), CV_8UC1 );
-			mimg.write(0,0, mimg.columns(), mimg.rows(), "I", Magick::CharPixel, cvimg.data );
-			return cvimg;
+			PrepareImageBuffer( out, mimg.rows(), mimg.columns(), CV_8UC1, outPool );
+			mimg.write(0,0, mimg.columns(), mimg.rows(), "I", Magick::CharPixel, out.data );
 		}
 		else if( mimg.depth() == 32 )
 		{
-			cv::Mat cvimg( mimg.rows(), mimg.columns(), CV_32FC1 );
-			mimg.write(0,0, mimg.columns(), mimg.rows(), "I", Magick::FloatPixel, cvimg.data );
-			return cvimg;
+			PrepareImageBuffer( out, mimg.rows(), mimg.columns(), CV_32FC1, outPool );
+			mimg.write(0,0, mimg.columns(), mimg.rows(), "I", Magick::FloatPixel, out.data );
 		}
 		else
 		{
@@ -201,130 +342,241 @@ jumpLabel01:
 	{
 		if( mimg.colorMapSize() <= 256 )
 		{
-			cv::Mat cvimg( mimg.rows(), mimg.columns(), CV_8UC1 );
-			mimg.write(0,0, mimg.columns(), mimg.rows(), "I", Magick::CharPixel, cvimg.data );
-			return cvimg;
+			PrepareImageBuffer( out, mimg.rows(), mimg.columns(), CV_8UC1, outPool );
+			mimg.write(0,0, mimg.columns(), mimg.rows(), "I", Magick::CharPixel, out.data );
 		}
 		else
 		{
-			cv::Mat cvimg( mimg.rows(), mimg.columns(), CV_8UC3 );
-			mimg.write(0,0, mimg.columns(), mimg.rows(), "BGR", Magick::CharPixel, cvimg.data );
-			return cvimg;
+			PrepareImageBuffer( out, mimg.rows(), mimg.columns(), CV_8UC3, outPool );
+			mimg.write(0,0, mimg.columns(), mimg.rows(), "BGR", Magick::CharPixel, out.data );
 		}
 	}
 	else
 	{
-		cv::Mat cvimg( mimg.rows(), mimg.columns(), CV_8UC3 );
-		mimg.write(0,0, mimg.columns(), mimg.rows(), "BGR", Magick::CharPixel, cvimg.data );
-		return cvimg;
+		PrepareImageBuffer( out, mimg.rows(), mimg.columns(), CV_8UC3, outPool );
+		mimg.write(0,0, mimg.columns(), mimg.rows(), "BGR", Magick::CharPixel, out.data );
 	}
+	
+	if( postProcess )
+		ApplyLoadOptions( full, dst, opts, pool );
+}
 
+// Sometimes, it's quicker or just nicer to have a custom wrapper
+// for loading / saving images and using Magick++ rather than opencv.
+cv::Mat LoadImage(std::string filename)
+{
+	cv::Mat img;
+	LoadImageImpl( filename, img, NULL, LoadImageOptions() );
+	return img;
+}
+
+cv::Mat LoadImage(std::string filename, const LoadImageOptions &opts)
+{
+	cv::Mat img;
+	LoadImageImpl( filename, img, NULL, opts );
+	return img;
+}
 
+void LoadImage(std::string filename, cv::Mat &dst, const LoadImageOptions &opts)
+{
+	LoadImageImpl( filename, dst, NULL, opts );
 }
 
-void SaveImage(cv::Mat &img, std::string filename)
+cv::Mat LoadImage(std::string filename, ImageBufferPool &pool, const LoadImageOptions &opts)
 {
-	if( !magickIsInitted )
+	cv::Mat img;
+	LoadImageImpl( filename, img, &pool, opts );
+	return img;
+}
+
+//
+// Write the version 2 header then the payload, which is filtered and compressed
+// according to opts.
+//
+static void WriteFileV2( std::string filename, unsigned magic, unsigned w, unsigned h, unsigned c,
+                         const char *data, size_t rows, size_t rowElems, unsigned elemSize, ImgCodecOptions opts,
+                         bayerPattern_t bayer = BAYER_NONE )
+{
+	thread_local std::vector<char> compressed;
+	size_t s = ImgEncodePayload( opts, data, rows, rowElems, c, elemSize, compressed );
+	
+	ImgFileHeaderV2 hdr;
+	memset( &hdr, 0, sizeof(hdr) );
+	hdr.magic          = magic;
+	hdr.version        = 2;
+	hdr.codec          = opts.codec;
+	hdr.filter         = opts.filter;
+	hdr.w              = w;
+	hdr.h              = h;
+	hdr.c              = c;
+	hdr.bayer          = bayer;
+	hdr.compressedSize = s;
+	hdr.rawSize        = rows * rowElems * elemSize;
+	
+	std::ofstream outfi;
+	outfi.open( filename, std::ios::out | std::ios::binary );
+	if( !outfi )
 	{
-		Magick::InitializeMagick(NULL);
-		magickIsInitted = true;
+		throw std::runtime_error("Could not open " + filename + " for writing." );
 	}
+	outfi.write( (char*)&hdr, sizeof(hdr) );
+	outfi.write( compressed.data(), s );
+	if( !outfi )
+	{
+		throw std::runtime_error("Failed writing " + filename );
+	}
+}
+
+//
+// Write a .floatImg or .charImg. The default snappy compression without a filter is
+// written with the original header, so that older builds can still read the files.
+// Anything else gets the version 2 header.
+//
+static void SaveCustomImage( cv::Mat &img, std::string filename, unsigned magicV1, unsigned magicV2, ImgCodecOptions opts )
+{
+	unsigned w,h,c;
+	w = img.cols;
+	h = img.rows;
+	c = img.channels();
+	if( c != 1 && c != 3 )
+	{
+		throw std::runtime_error("SaveImage: Image had neither 1 nor 3 channels.");
+	}
+	
+	// the filters only make sense for float data.
+	if( img.elemSize1() != 4 )
+		opts.filter = IMGFILTER_NONE;
+	
+	// the compressor needs the data in one block.
+	cv::Mat cimg = img;
+	if( !cimg.isContinuous() )
+		cimg = img.clone();
+	
+	if( opts.codec != IMGCODEC_SNAPPY || opts.filter != IMGFILTER_NONE )
+	{
+		WriteFileV2( filename, magicV2, w, h, c, (char*)cimg.data, h, w*c, cimg.elemSize1(), opts );
+		return;
+	}
+	
+	thread_local std::vector<char> compressed;
+	size_t s = ImgCodecCompress( opts, (char*)cimg.data, cimg.total() * cimg.elemSize(), compressed );
+	
+	std::ofstream outfi;
+	outfi.open( filename, std::ios::out | std::ios::binary );
+	if( !outfi )
+	{
+		throw std::runtime_error("SaveImage: could not open " + filename + " for writing." );
+	}
+	
+	outfi.write( (char*)&magicV1, sizeof(magicV1) );
+	outfi.write( (char*)&w, sizeof(w) );
+	outfi.write( (char*)&h, sizeof(h) );
+	outfi.write( (char*)&c, sizeof(c) );
+	outfi.write( (char*) &s, sizeof(size_t) );
+	outfi.write( compressed.data(), s );
+	
+	if( !outfi )
+	{
+		throw std::runtime_error("SaveImage: failed writing " + filename );
+	}
+}
+
+void SaveImage(cv::Mat &img, std::string filename)
+{
+	SaveImage( img, filename, ImgCodecOptions() );
+}
+
+void SaveImage(cv::Mat &img, std::string filename, ImgCodecOptions opts)
+{
+	InitMagick();
 
 
 // 	cout << "Saving " << filename << endl;
 	if( filename.find(".floatImg") != std::string::npos)
 	{
-// 		cout << "is floatImg " << endl;
-		// this should be an uncompressed float image.
-		std::ofstream outfi;
-		outfi.open( filename, std::ios::out | std::ios::binary );
-
-		unsigned magic,w,h,c;
-		magic = 820830001;
-		w = img.cols;
-		h = img.rows;
-		if( img.type() == CV_32FC1 )
-		{
-			c = 1;
-		}
-		else if( img.type() == CV_32FC3 )
-		{
-			c = 3;
-		}
-		else
+		if( img.depth() != CV_32F )
 		{
-			throw std::runtime_error("SaveImage: Image had neither 1 nor 3 channels.");
+			throw std::runtime_error("SaveImage: .floatImg needs a CV_32F image.");
 		}
-		outfi.write( (char*)&magic, sizeof(magic) );
-		outfi.write( (char*)&w, sizeof(w) );
-		outfi.write( (char*)&h, sizeof(h) );
-		outfi.write( (char*)&c, sizeof(c) );
-
-		//outfi.write( (char*)img.data, h*w*c*sizeof(float) );
-		std::string compressed;
-		size_t s = 	snappy::Compress( (char*)img.data, w*h*c*sizeof(float), &compressed );
-		outfi.write( (char*) &s, sizeof(size_t) );
-		outfi.write( (char*)compressed.data(), compressed.size() );
-
+		SaveCustomImage( img, filename, IMG_MAGIC_FLOAT, IMG_MAGIC_FLOAT_V2, opts );
 		return;
 	}
 	else if( filename.find(".charImg") != std::string::npos)
 	{
-// 		cout << "is charImg " << endl;
-		// this should be an uncompressed float image.
-		std::ofstream outfi;
-		outfi.open( filename, std::ios::out | std::ios::binary );
-
-		unsigned magic,w,h,c;
-		magic = 820830002;
-		w = img.cols;
-		h = img.rows;
-		if( img.type() == CV_8UC1 )
-		{
-			c = 1;
-		}
-		else if( img.type() == CV_8UC3 )
+		if( img.depth() != CV_8U )
 		{
-			c = 3;
+			throw std::runtime_error("SaveImage: .charImg needs a CV_8U image.");
 		}
-		outfi.write( (char*)&magic, sizeof(magic) );
-		outfi.write( (char*)&w, sizeof(w) );
-		outfi.write( (char*)&h, sizeof(h) );
-		outfi.write( (char*)&c, sizeof(c) );
-
-		//outfi.write( (char*)img.data, h*w*c*sizeof(float) );
-		std::string compressed;
-		size_t s = 	snappy::Compress( (char*)img.data, w*h*c*sizeof(unsigned char), &compressed );
-		outfi.write( (char*) &s, sizeof(size_t) );
-		outfi.write( (char*)compressed.data(), compressed.size() );
-
+		SaveCustomImage( img, filename, IMG_MAGIC_CHAR, IMG_MAGIC_CHAR_V2, opts );
 		return;
 	}
 
 	// todo... use Magick instead of opencv. I have reasons for that... umm...
 	// honest. Probably mostly to do with OpenCV normalising things etc... maybe...
+	// scale floats into a temporary, so the caller's image isn't changed.
+	cv::Mat out = img;
 	if( img.type() == CV_32FC3 || img.type() == CV_32FC1 )
 	{
-		img *= 255;
+		img.convertTo( out, -1, 255.0 );
+	}
+	if( !cv::imwrite(filename, out) )
+	{
+		throw std::runtime_error("SaveImage: failed writing " + filename );
+	}
+}
+
+void SaveBayerImage( cv::Mat &raw, std::string filename, bayerPattern_t pattern, ImgCodecOptions opts )
+{
+	if( filename.find(".charImg") == std::string::npos )
+	{
+		throw std::runtime_error("SaveBayerImage: raw Bayer images can only be saved as .charImg");
+	}
+	if( raw.type() != CV_8UC1 || raw.cols % 2 != 0 || raw.rows % 2 != 0 )
+	{
+		throw std::runtime_error("SaveBayerImage: raw Bayer images must be 8 bit, 1 channel, with an even width and height.");
+	}
+	if( pattern == BAYER_NONE )
+	{
+		SaveImage( raw, filename, opts );
+		return;
 	}
-	cv::imwrite(filename, img);
 	
+	// always a version 2 file, as the original header has nowhere to put the pattern.
+	opts.filter = IMGFILTER_NONE;
+	cv::Mat cimg = raw.isContinuous() ? raw : raw.clone();
+	WriteFileV2( filename, IMG_MAGIC_CHAR_V2, raw.cols, raw.rows, 1, (char*)cimg.data, raw.rows, raw.cols, 1, opts, pattern );
 }
 
 void SaveCFImage( cfMatrix &img, std::string filename)
+{
+	SaveCFImage( img, filename, ImgCodecOptions() );
+}
+
+void SaveCFImage( cfMatrix &img, std::string filename, ImgCodecOptions opts )
 {
 	cout << "Saving " << filename << endl;
 	if( filename.find(".cplxImg") != std::string::npos)
 	{
 		cout << "is cplxImg " << endl;
+		
+		unsigned w,h;
+		w = img.cols();
+		h = img.rows();
+		
+		if( opts.codec != IMGCODEC_SNAPPY || opts.filter != IMGFILTER_NONE )
+		{
+			// cfMatrix is column major, so a "row" of the data is a column of the image,
+			// and each element is a real and imaginary pair.
+			WriteFileV2( filename, IMG_MAGIC_CPLX_V2, w, h, 2, (char*)img.data(), w, h*2, sizeof(float), opts );
+			return;
+		}
+		
 		// this should be an uncompressed float image.
 		std::ofstream outfi;
 		outfi.open( filename, std::ios::out | std::ios::binary );
 
-		unsigned magic,w,h,c;
-		magic = 820830003;
-		w = img.cols();
-		h = img.rows();
+		unsigned magic;
+		magic = IMG_MAGIC_CPLX;
 		
 		outfi.write( (char*)&magic, sizeof(magic) );
 		outfi.write( (char*)&w, sizeof(w) );
@@ -349,35 +601,53 @@ cfMatrix LoadCFImage(std::string filename)
 {
 	if( filename.find(".cplxImg") != std::string::npos )
 	{
-		std::ifstream infi;
-		infi.open( filename, std::ios::in | std::ios::binary );
-
-		unsigned magic,w,h,c;
+		size_t got;
+		std::vector<char> &fileBuf = ReadWholeFile( filename, got );
+		
+		unsigned magic,w,h;
 		size_t s;
-		infi.read( (char*)&magic, sizeof(magic) );
-
-		if( magic != 820830003 )
+		if( got < sizeof(magic) )
 		{
 			throw std::runtime_error("Magic number in file does not match .cmplxImg.");
 		}
-
-		infi.read( (char*)&w, sizeof(w) );
-		infi.read( (char*)&h, sizeof(h) );
-		infi.read( (char*)&s, sizeof(s) );
-		std::vector<char> d(s);
-		infi.read( &d[0], s );
-		std::string uncompressed;
-		if( !snappy::Uncompress( &d[0], d.size(), &uncompressed ) )
+		memcpy( &magic, fileBuf.data(), sizeof(magic) );
+		
+		if( magic == IMG_MAGIC_CPLX_V2 && got >= sizeof(ImgFileHeaderV2) )
 		{
-			throw std::runtime_error(std::string("Could not uncompress image (snappy error): ") +  filename );
-			cout << "Could not uncompress data with snappy... " << endl;
+			ImgFileHeaderV2 hdr;
+			memcpy( &hdr, fileBuf.data(), sizeof(hdr) );
+			cfMatrix res( hdr.h, hdr.w );
+			CheckHeaderV2( hdr, got, (size_t)hdr.w * hdr.h * 2 * sizeof(float), "cplxImg ", filename );
+			if( !ImgDecodePayload( (imgCodec_t)hdr.codec, (imgFilter_t)hdr.filter, &fileBuf[sizeof(hdr)], hdr.compressedSize,
+			                       (char*)res.data(), hdr.w, hdr.h*2, 2, sizeof(float) ) )
+			{
+				throw std::runtime_error(std::string("Could not uncompress image: ") +  filename );
+			}
+			return res;
 		}
-		else
+		
+		if( magic != IMG_MAGIC_CPLX )
 		{
-			cfMatrix res = cfMatrix::Zero( h, w );
-			memcpy( res.data(), uncompressed.data(), uncompressed.size() );
-			return res;
+			throw std::runtime_error("Magic number in file does not match .cmplxImg.");
+		}
+		
+		const size_t headerSize = 3*sizeof(unsigned) + sizeof(size_t);
+		if( got < headerSize )
+		{
+			throw std::runtime_error(std::string("cplxImg is truncated: ") + filename );
+		}
+		const char *p = fileBuf.data() + sizeof(magic);
+		memcpy( &w, p, sizeof(w) ); p += sizeof(w);
+		memcpy( &h, p, sizeof(h) ); p += sizeof(h);
+		memcpy( &s, p, sizeof(s) ); p += sizeof(s);
+		s = std::min( s, got - headerSize );
+		
+		cfMatrix res = cfMatrix::Zero( h, w );
+		if( !ImgCodecDecompress( IMGCODEC_SNAPPY, p, s, (char*)res.data(), (size_t)w*h*2*sizeof(float) ) )
+		{
+			throw std::runtime_error(std::string("Could not uncompress image (snappy error): ") +  filename );
 		}
+		return res;
 	}
 	else
 	{
@@ -389,14 +659,25 @@ cfMatrix LoadCFImage(std::string filename)
 
 
 void SaveFBuffer( int rows, int cols, int channels, std::vector<float> &inBuff, std::string fn )
+{
+	SaveFBuffer( rows, cols, channels, inBuff, fn, ImgCodecOptions() );
+}
+
+void SaveFBuffer( int rows, int cols, int channels, std::vector<float> &inBuff, std::string fn, ImgCodecOptions opts )
 {
 	assert( inBuff.size() == rows * cols * channels );
 	
+	if( opts.codec != IMGCODEC_SNAPPY || opts.filter != IMGFILTER_NONE )
+	{
+		WriteFileV2( fn, IMG_MAGIC_FBUF_V2, cols, rows, channels, (char*)&inBuff[0], rows, cols*channels, sizeof(float), opts );
+		return;
+	}
+	
 	std::ofstream outfi;
 	outfi.open( fn, std::ios::out | std::ios::binary );
 
 	unsigned magic;
-	magic = 820830004;
+	magic = IMG_MAGIC_FBUF;
 	
 	outfi.write( (char*)&magic, sizeof(magic) );
 	outfi.write( (char*)&cols, sizeof(cols) );
@@ -414,30 +695,53 @@ void SaveFBuffer( int rows, int cols, int channels, std::vector<float> &inBuff,
 
 void LoadFBuffer( std::string fn, std::vector<float> &outBuff, int &rows, int &cols, int &channels )
 {
-	std::ifstream infi;
-	infi.open( fn, std::ios::in | std::ios::binary );
+	size_t got;
+	std::vector<char> &fileBuf = ReadWholeFile( fn, got );
 	
-	unsigned magic;
-	size_t s;
+	unsigned magic = 0;
+	if( got >= sizeof(magic) )
+		memcpy( &magic, fileBuf.data(), sizeof(magic) );
 	
-	infi.read( (char*)&magic, sizeof(magic) );
-	infi.read( (char*)&cols, sizeof(cols) );
-	infi.read( (char*)&rows, sizeof(rows) );
-	infi.read( (char*)&channels, sizeof(channels) );
-	infi.read( (char*)&s, sizeof(s) );
-	assert( magic == 820830004);
+	if( magic == IMG_MAGIC_FBUF_V2 && got >= sizeof(ImgFileHeaderV2) )
+	{
+		ImgFileHeaderV2 hdr;
+		memcpy( &hdr, fileBuf.data(), sizeof(hdr) );
+		cols     = hdr.w;
+		rows     = hdr.h;
+		channels = hdr.c;
+		size_t n = (size_t)rows * cols * channels;
+		CheckHeaderV2( hdr, got, n * sizeof(float), "fbuf ", fn );
+		if( outBuff.size() != n )
+			outBuff.resize( n );
+		if( !ImgDecodePayload( (imgCodec_t)hdr.codec, (imgFilter_t)hdr.filter, &fileBuf[sizeof(hdr)], hdr.compressedSize,
+		                       (char*)&outBuff[0], rows, cols*channels, channels, sizeof(float) ) )
+		{
+			throw std::runtime_error(std::string("Could not uncompress fbuf: ") +  fn );
+		}
+		return;
+	}
 	
-	if( outBuff.size() != rows * cols * channels )
-		outBuff.resize( rows * cols * channels );
+	const size_t headerSize = 4*sizeof(unsigned) + sizeof(size_t);
+	assert( magic == IMG_MAGIC_FBUF );
+	if( magic != IMG_MAGIC_FBUF || got < headerSize )
+	{
+		throw std::runtime_error(std::string("Not an fbuf file: ") +  fn );
+	}
 	
-	std::string uncompressed;
-	std::vector<char> d(s);
-	infi.read( &d[0], s );
-	if( !snappy::Uncompress( &d[0], d.size(), &uncompressed ) )
+	size_t s;
+	const char *p = fileBuf.data() + sizeof(magic);
+	memcpy( &cols,     p, sizeof(cols) );     p += sizeof(cols);
+	memcpy( &rows,     p, sizeof(rows) );     p += sizeof(rows);
+	memcpy( &channels, p, sizeof(channels) ); p += sizeof(channels);
+	memcpy( &s,        p, sizeof(s) );        p += sizeof(s);
+	s = std::min( s, got - headerSize );
+	
+	size_t n = (size_t)rows * cols * channels;
+	if( outBuff.size() != n )
+		outBuff.resize( n );
+	
+	if( !ImgCodecDecompress( IMGCODEC_SNAPPY, p, s, (char*)&outBuff[0], n * sizeof(float) ) )
 	{
 		throw std::runtime_error(std::string("Could not uncompress image (snappy error): ") +  fn );
-		cout << "Could not uncompress data with snappy... " << endl;
 	}
-	
-	memcpy( &outBuff[0], uncompressed.data(), uncompressed.size() );
 }
@@ -2,18 +2,93 @@
 #define IMAGES_H_MC
 
 #include <string>
+#include <mutex>
 #include <opencv2/opencv.hpp>
 #include "math/mathTypes.h"
+#include "imgio/imgCodec.h"
+
+//
+// A small pool of image buffers. When a buffer is no longer referenced by anyone
+// but the pool, it can be handed out again, so that when we're loading a sequence of 
+// images of the same size we don't need to keep allocating new memory.
+//
+class ImageBufferPool
+{
+public:
+	ImageBufferPool( unsigned in_maxBuffers = 8 ) { maxBuffers = in_maxBuffers; }
+	
+	// get an image of the specified size and type. If there's no free buffer in
+	// the pool, this will be a freshly allocated image.
+	cv::Mat Get( int rows, int cols, int type );
+	
+	void SetMaxBuffers( unsigned in_maxBuffers );
+	
+protected:
+	std::mutex mutex;
+	std::vector< cv::Mat > buffers;
+	unsigned maxBuffers;
+};
+
+//
+// Often we only want a smaller version of the image, or just part of it. Asking
+// LoadImage for that means decoders that can (JPEG, our own formats) don't
+// bother decoding pixels that would just be thrown away.
+//
+struct LoadImageOptions
+{
+	LoadImageOptions() : scaleDenom(1), bayerGray(false) {}
+	
+	// decode at 1/scaleDenom of the full resolution: 1, 2, 4 or 8.
+	int scaleDenom;
+	
+	// only decode this region, in full resolution pixel coordinates. 
+	// An empty rect means the whole image.
+	cv::Rect roi;
+	
+	// raw Bayer images are normally demosaiced to BGR. With this set, they come out
+	// as grey instead, which is quicker and is all that e.g. grid detection needs.
+	// It doesn't change the size of the images, and other images aren't affected.
+	bool bayerGray;
+	
+	bool IsDefault() const { return scaleDenom == 1 && roi.area() == 0; }
+	
+	// The reduced resolution image is ceil(fullWidth/scaleDenom) x ceil(fullHeight/scaleDenom).
+	// This returns the part of that which we output, which is the roi scaled down and
+	// rounded outwards, clipped to the image.
+	cv::Rect OutputRect( int fullWidth, int fullHeight ) const;
+};
 
 cv::Mat LoadImage(std::string filename);
+cv::Mat LoadImage(std::string filename, const LoadImageOptions &opts);
+
+// load the image into dst. If dst is already the right size and type, its buffer is
+// re-used rather than allocating a new image - so make sure nobody else is using it!
+void LoadImage(std::string filename, cv::Mat &dst, const LoadImageOptions &opts = LoadImageOptions() );
+
+// load the image into a buffer from the pool.
+cv::Mat LoadImage(std::string filename, ImageBufferPool &pool, const LoadImageOptions &opts = LoadImageOptions() );
+
+// save an image. Float images in other formats are scaled up from [0,1] to [0,255].
+// Throws std::runtime_error if the image couldn't be written.
 void SaveImage(cv::Mat &img, std::string filename);
 
+// save a .charImg or .floatImg with a particular compression codec,
+// and for float images, optionally with the shuffle or delta filter.
+// For other formats the options are ignored.
+void SaveImage(cv::Mat &img, std::string filename, ImgCodecOptions opts);
+
+// save a raw Bayer image (CV_8UC1, even width and height) as a .charImg, recording
+// the pattern so that LoadImage() will demosaic it.
+void SaveBayerImage( cv::Mat &raw, std::string filename, bayerPattern_t pattern, ImgCodecOptions opts = ImgCodecOptions() );
+
 void SaveCFImage( cfMatrix &img, std::string filename );
+void SaveCFImage( cfMatrix &img, std::string filename, ImgCodecOptions opts );
 cfMatrix LoadCFImage(std::string filename);
 
 // saves a float buffer with multiple channels
 // don't provide a file extension, it will be set automatically to .fbuf
 void SaveFBuffer( int rows, int cols, int channels, std::vector<float> &inBuff, std::string fn );
+void SaveFBuffer( int rows, int cols, int channels, std::vector<float> &inBuff, std::string fn, ImgCodecOptions opts );
 void LoadFBuffer( std::string filename, std::vector<float> &outBuff, int &rows, int &cols, int &channels );
 
 #endif
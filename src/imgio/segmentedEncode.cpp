@@ -0,0 +1,207 @@
+#include "imgio/segmentedEncode.h"
+#include "imgio/vidIndex.h"
+#include "commonConfig/commonConfig.h"
+
+#include <boost/filesystem.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+using std::cout;
+using std::endl;
+
+unsigned DefaultNumSegments()
+{
+	// x265 uses a handful of cores per process quite well, so we don't need a process per core.
+	return std::max( 1u, std::thread::hardware_concurrency() / 8 );
+}
+
+std::vector< unsigned > SplitFrameRange( unsigned first, unsigned end, unsigned numSegments, std::string srcPath )
+{
+	if( end <= first )
+	{
+		throw std::runtime_error("SplitFrameRange: empty range of frames.");
+	}
+	numSegments = std::max( 1u, std::min( numSegments, end - first ) );
+
+	// only videos have keyframes.
+	VideoIndex index;
+	bool haveIndex = false;
+	boost::filesystem::path p( srcPath );
+	if( !srcPath.empty() && boost::filesystem::is_regular_file( p ) && p.extension() != ".hdf5" && p.extension() != ".imgSeq" )
+	{
+		// without the index, a segment's source can only seek approximately, and frames
+		// at the segment boundaries would be repeated or lost.
+		haveIndex = index.Open( srcPath );
+		if( !haveIndex )
+		{
+			cout << "SplitFrameRange: can't seek exactly in " << srcPath << ", so not splitting it into segments." << endl;
+			return std::vector< unsigned >{ first, end };
+		}
+	}
+
+	std::vector< unsigned > boundaries;
+	boundaries.push_back( first );
+	for( unsigned sc = 1; sc < numSegments; ++sc )
+	{
+		unsigned f = first + (unsigned)( (uint64_t)(end - first) * sc / numSegments );
+		if( haveIndex )
+			f = index.KeyframeAtOrBefore( f );
+
+		// sparse keyframes can give us fewer segments than asked for.
+		if( f > boundaries.back() && f < end )
+			boundaries.push_back( f );
+	}
+	boundaries.push_back( end );
+	return boundaries;
+}
+
+void SegmentedEncode( SegmentSourceFn makeSource, SegmentWriterFn makeWriter, const std::vector< unsigned > &boundaries, std::string outFile )
+{
+	if( boundaries.size() < 2 )
+	{
+		throw std::runtime_error("SegmentedEncode: need at least one segment.");
+	}
+	unsigned numSegs = boundaries.size() - 1;
+
+	// segment files go next to the output, with the same container.
+	boost::filesystem::path op( outFile );
+	std::string segBase = ( op.parent_path() / ( op.stem().string() + ".seg" ) ).string();
+	std::vector< std::string > segFiles;
+	for( unsigned sc = 0; sc < numSegs; ++sc )
+	{
+		std::stringstream ss;
+		ss << segBase << std::setw(3) << std::setfill('0') << sc << op.extension().string();
+		segFiles.push_back( ss.str() );
+	}
+
+	std::unique_ptr< std::atomic<unsigned>[] > done( new std::atomic<unsigned>[ numSegs ] );
+	for( unsigned sc = 0; sc < numSegs; ++sc )
+		done[sc] = 0;
+	std::vector< std::exception_ptr > errs( numSegs );
+	std::atomic<unsigned> finished(0);
+
+	auto encodeSegment = [&]( unsigned sc )
+	{
+		try
+		{
+			// no need to seek if the source already starts where we want.
+			std::shared_ptr< ImageSource > src = makeSource();
+			if( src->GetCurrentFrameID() != boundaries[sc] && !src->JumpToFrame( boundaries[sc] ) )
+			{
+				std::stringstream ss;
+				ss << "SegmentedEncode: could not get to frame " << boundaries[sc];
+				throw std::runtime_error( ss.str() );
+			}
+
+			std::shared_ptr< VidWriter > vw = makeWriter( segFiles[sc], src->GetCurrent() );
+			for( unsigned f = boundaries[sc]; f < boundaries[sc+1]; ++f )
+			{
+				if( f > boundaries[sc] && !src->Advance() )
+				{
+					std::stringstream ss;
+					ss << "SegmentedEncode: source ran out of frames at frame " << f;
+					throw std::runtime_error( ss.str() );
+				}
+				vw->Write( src->GetCurrent() );
+				done[sc] = f - boundaries[sc] + 1;
+			}
+
+			// closing the writer waits for ffmpeg to finish the file.
+			vw->Flush();
+			vw.reset();
+		}
+		catch( ... )
+		{
+			errs[sc] = std::current_exception();
+		}
+		++finished;
+	};
+
+	cout << "encoding " << boundaries.back() - boundaries.front() << " frames in " << numSegs << " segments" << endl;
+	auto t0 = std::chrono::steady_clock::now();
+	std::vector< std::thread > threads;
+	for( unsigned sc = 0; sc < numSegs; ++sc )
+	{
+		threads.push_back( std::thread( encodeSegment, sc ) );
+	}
+
+	// progress of each segment, updated in place.
+	while( finished < numSegs )
+	{
+		std::this_thread::sleep_for( std::chrono::seconds(1) );
+		unsigned total = 0;
+		std::stringstream ss;
+		for( unsigned sc = 0; sc < numSegs; ++sc )
+		{
+			unsigned d = done[sc];
+			total += d;
+			ss << " [" << sc << "] " << d << "/" << boundaries[sc+1] - boundaries[sc];
+		}
+		double secs = std::chrono::duration<double>( std::chrono::steady_clock::now() - t0 ).count();
+		cout << "\r" << ss.str() << "  (" << std::setprecision(4) << total / secs << " fps)" << std::flush;
+	}
+	cout << endl;
+
+	for( unsigned sc = 0; sc < numSegs; ++sc )
+		threads[sc].join();
+
+	auto removeSegments = [&]()
+	{
+		boost::system::error_code ec;
+		for( unsigned sc = 0; sc < numSegs; ++sc )
+			boost::filesystem::remove( segFiles[sc], ec );
+	};
+
+	for( unsigned sc = 0; sc < numSegs; ++sc )
+	{
+		if( errs[sc] )
+		{
+			removeSegments();
+			std::rethrow_exception( errs[sc] );
+		}
+	}
+
+	// join the segments - the list file goes where the segments are.
+	bool ok = ConcatVideos( segFiles, outFile, segBase + ".txt" );
+	removeSegments();
+	if( !ok )
+	{
+		throw std::runtime_error("SegmentedEncode: ffmpeg failed to join the segments into " + outFile );
+	}
+}
+
+bool ConcatVideos( const std::vector< std::string > &files, std::string outFile, std::string listFile )
+{
+	// Paths in the list are relative to the list file, and need any ' escaping.
+	{
+		std::ofstream outfi( listFile );
+		for( unsigned fc = 0; fc < files.size(); ++fc )
+		{
+			std::string fn = boost::filesystem::path( files[fc] ).filename().string();
+			std::string escaped;
+			for( char c : fn )
+			{
+				if( c == '\'' )
+					escaped += "'\\''";
+				else
+					escaped += c;
+			}
+			outfi << "file '" << escaped << "'" << endl;
+		}
+	}
+	
+	CommonConfig ccfg;
+	std::stringstream cmd;
+	cmd << ccfg.ffmpegPath << " -y -loglevel error -f concat -safe 0 -i \"" << listFile << "\" -c copy \"" << outFile << "\"";
+	cout << cmd.str() << endl;
+	int ret = system( cmd.str().c_str() );
+	
+	boost::system::error_code ec;
+	boost::filesystem::remove( listFile, ec );
+	return ret == 0;
+}
@@ -0,0 +1,57 @@
+#ifndef MC_SEGMENTED_ENCODE_H
+#define MC_SEGMENTED_ENCODE_H
+
+#include "imgio/imagesource.h"
+#include "imgio/vidWriter.h"
+
+#include <functional>
+#include <memory>
+
+//
+// One ffmpeg process encoding a long 4K take with libx265 barely dents a big machine,
+// even with ffmpeg's own threads. So, for offline exports, we split the frame range
+// into segments, encode each segment with its own source, VidWriter and ffmpeg process,
+// all at the same time, and then join the segments with ffmpeg's concat demuxer, which
+// just copies the packets.
+//
+// Every segment is encoded with the same settings (the caller's makeWriter is used for
+// all of them) so the segments can be concatenated without re-encoding. When reading
+// from a video with a keyframe index, segments start on the source's keyframes so each
+// segment's source can seek straight to its first frame.
+//
+
+// makes a new, independent source for a segment to read from.
+typedef std::function< std::shared_ptr< ImageSource >() > SegmentSourceFn;
+
+// makes the VidWriter for one segment file.
+typedef std::function< std::shared_ptr< VidWriter >( std::string filename, cv::Mat typicalImage ) > SegmentWriterFn;
+
+//
+// Split the frames [first, end) into (up to) numSegments segments, returning the
+// first frame of each segment followed by end. If srcPath is a video we'll move
+// the boundaries onto its keyframes. If the video can't be indexed, its sources can't
+// seek exactly, so we warn and return a single segment - callers may as well encode
+// it the normal way.
+//
+std::vector< unsigned > SplitFrameRange( unsigned first, unsigned end, unsigned numSegments, std::string srcPath = "" );
+
+//
+// Encode the frames [boundaries.front(), boundaries.back()) to outFile, one concurrent
+// segment per pair of boundaries. Segment files go next to outFile and are removed once
+// they have been joined. Progress for each segment is printed as we go.
+//
+// Throws if any segment fails, or if the segments can't be joined.
+//
+void SegmentedEncode( SegmentSourceFn makeSource, SegmentWriterFn makeWriter, const std::vector< unsigned > &boundaries, std::string outFile );
+
+//
+// Join videos (with the same codec and settings) into outFile without re-encoding, using
+// ffmpeg's concat demuxer. The files must all be in the same directory as listFile, which
+// is a scratch file for the list of inputs. Returns false if ffmpeg failed.
+//
+bool ConcatVideos( const std::vector< std::string > &files, std::string outFile, std::string listFile );
+
+// a sensible number of segments for this machine.
+unsigned DefaultNumSegments();
+
+#endif
@@ -1,4 +1,7 @@
 #include "sourceFactory.h"
+#include "imgio/transformSource.h"
+#include "imgio/dirManifest.h"
+#include "commonConfig/commonConfig.h"
 #include <boost/filesystem.hpp>
 #include <map>
 
@@ -15,17 +18,73 @@ std::string GetBotLevelFile( std::string in )
 	return p.stem().string();
 }
 
+// split a list of transforms off the end of a source string (see imgio/transformSource.h).
+static std::string SplitTransforms( std::string input, std::vector< SourceTransform > &transforms )
+{
+	transforms.clear();
+	size_t a = input.rfind(":");
+	if( a != std::string::npos && ParseSourceTransforms( input.substr( a+1 ), transforms ) )
+		return input.substr( 0, a );
+	return input;
+}
+
+void PrepareSources( const std::vector< std::string > &inputs )
+{
+	CommonConfig ccfg;
+	if( !ccfg.imgDirManifest )
+		return;
+	
+	// the same rules as CreateSource for spotting directory and fndir sources.
+	std::vector< std::string > dirs;
+	for( unsigned ic = 0; ic < inputs.size(); ++ic )
+	{
+		std::vector< SourceTransform > transforms;
+		std::string input = SplitTransforms( inputs[ic], transforms );
+		size_t a = input.rfind(":");
+		if( a == std::string::npos )
+		{
+			if( boost::filesystem::is_directory( input ) )
+				dirs.push_back( input );
+		}
+		else if( std::string( input.begin()+a+1, input.end() ).compare("fndir") == 0 )
+		{
+			std::string info( input.begin(), input.begin()+a );
+			dirs.push_back( std::string( info.begin(), info.begin() + std::min( info.find(":"), info.size() ) ) );
+		}
+	}
+	
+	if( dirs.size() > 1 )
+		PrepareDirectoryManifests( dirs );
+}
+
 SourceHandle CreateSource( std::string input, std::string calibFile )
 {
 	//
 	// input is a string, and the acceptable format of that string is:
 	//   - /path/to/directory/
 	//   - /path/to/video.file
+	//   - /path/to/sequence.imgSeq
 	//   - <info>:<tag>
+	//   - <any of the above>:<transforms>
 	//
 	// where <tag> can be one of:
 	//   - fndir : create an image directory source where image filenames indicate the actual frame number
 	//
+	// and <transforms> is a list of things to do to every frame, such as gray,scale=0.5
+	// (see imgio/transformSource.h)
+	//
+	std::vector< SourceTransform > transforms;
+	std::string inner = SplitTransforms( input, transforms );
+	if( transforms.size() > 0 )
+	{
+		SourceHandle retval = CreateSource( inner, calibFile );
+		std::shared_ptr< TransformSource > ts( new TransformSource( retval.source, transforms ) );
+		retval.source = ts;
+		if( retval.frames )
+			retval.frames = ts;
+		return retval;
+	}
+	
 	SourceHandle retval;
 	retval.isDirectorySource = false;
 	
@@ -58,6 +117,10 @@ SourceHandle CreateSource( std::string input, std::string calibFile )
 				throw std::runtime_error("Can't open an hdf5 image source because not compiled with high five library");
 #endif
 			}
+			else if( inpth.extension().compare(".imgSeq") == 0 )
+			{
+				retval.source.reset( new ImageSequenceSource( input, calibFile ) );
+			}
 			else
 			{
 				if( calibFile.compare( "none" ) == 0 )
@@ -105,6 +168,10 @@ SourceHandle CreateSource( std::string input, std::string calibFile )
 			throw std::runtime_error("Can't open an hdf5 image source because not compiled with high five library");
 			#endif
 		}
+		else if( info.find(".imgSeq") != std::string::npos ) // path/to/file.imgSeq:<firstframe>
+		{
+			retval.source.reset( new ImageSequenceSource( input, calibFile ) );
+		}
 		else
 		{
 			cout << "unknown tag in <tag>:<info> format image source" << endl;
@@ -113,6 +180,8 @@ SourceHandle CreateSource( std::string input, std::string calibFile )
 		}
 	}
 	
+	retval.frames = std::dynamic_pointer_cast< FrameProvider >( retval.source );
+	
 	return retval;
 	
 }
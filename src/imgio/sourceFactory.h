@@ -6,6 +6,7 @@
 #include "imgio/vidsrc.h"
 #include "imgio/fnDirSrc.h"
 #include "imgio/hdf5source.h"
+#include "imgio/imgSeq.h"
 
 
 
@@ -22,9 +23,17 @@ struct SourceHandle
 	
 	// path to source without any tags
 	std::string path;
+	
+	// the same source, for getting at any frame from many threads at once (see imgio/imagesource.h).
+	// NULL if the source can't do that.
+	std::shared_ptr< FrameProvider > frames;
 };
 
 SourceHandle CreateSource( std::string input, std::string calibFile = "none" );
 
+// Before creating several sources, list any image directories amongst them in parallel
+// (see imgio/dirManifest.h) so that each CreateSource() is then quick.
+void PrepareSources( const std::vector< std::string > &inputs );
+
 #endif
 
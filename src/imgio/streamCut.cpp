@@ -0,0 +1,160 @@
+#include "imgio/streamCut.h"
+#include "imgio/vidIndex.h"
+#include "imgio/vidsrc.h"
+#include "imgio/vidWriter.h"
+#include "imgio/segmentedEncode.h"
+#include "commonConfig/commonConfig.h"
+
+#include <boost/filesystem.hpp>
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+using std::cout;
+using std::endl;
+
+// decode frames [first, end) of the video and encode them into fn.
+static void EncodePart( VideoSource &src, unsigned first, unsigned end, std::string fn, std::string encoder, int fps )
+{
+	if( !src.JumpToFrame( first ) )
+	{
+		std::stringstream ss;
+		ss << "StreamCopyCut: could not get to frame " << first;
+		throw std::runtime_error( ss.str() );
+	}
+
+	VidWriter vw( fn, encoder, src.GetCurrent(), fps );
+	for( unsigned f = first; f < end; ++f )
+	{
+		if( f > first && !src.Advance() )
+		{
+			std::stringstream ss;
+			ss << "StreamCopyCut: video ran out of frames at frame " << f;
+			throw std::runtime_error( ss.str() );
+		}
+		vw.Write( src.GetCurrent() );
+	}
+	vw.Flush();
+}
+
+bool StreamCopyCut( std::string vidPath, unsigned first, unsigned end, std::string outFile, int fps, int crf )
+{
+	std::string codec, pixFmt;
+	if( !VideoIndex::ProbeStream( vidPath, codec, pixFmt ) )
+		return false;
+
+	// the encoder for the edges, and the filter that puts the parameter sets into every packet
+	// stream so that the parts still decode once they are joined.
+	std::string encoder, bsf;
+	if( codec == "h264" )
+	{
+		encoder = "libx264";
+		bsf     = "h264_mp4toannexb";
+	}
+	else if( codec == "hevc" )
+	{
+		encoder = "libx265";
+		bsf     = "hevc_mp4toannexb";
+	}
+	else
+	{
+		cout << "can't stream copy " << codec << " video, will re-encode instead." << endl;
+		return false;
+	}
+
+	VideoIndex index;
+	if( !index.Open( vidPath ) )
+		return false;
+
+	end = std::min( end, index.NumFrames() );
+	if( end <= first )
+	{
+		throw std::runtime_error("StreamCopyCut: empty range of frames.");
+	}
+
+	// The part we can copy is [k0,k1), which has to start on an IDR so that it doesn't need any
+	// frames from before the cut, and has to end on one so that the encoded end doesn't follow frames
+	// that could refer past it. Other keyframes (e.g. the CRAs of x265's open GOPs) won't do. If there
+	// aren't two such IDRs in the cut, we have to encode the lot.
+	unsigned k0 = index.IDRAtOrAfter( first );
+	unsigned k1 = ( end == index.NumFrames() ) ? end : index.IDRAtOrBefore( end );
+	if( k0 >= k1 || k1 > end )
+	{
+		if( index.KeyframeAtOrAfter( first ) < index.KeyframeAtOrBefore( end ) )
+			cout << "\t the keyframes in the cut aren't IDR frames, so can't copy any of it." << endl;
+		k0 = k1 = end;
+	}
+	cout << "\t copying " << k1 - k0 << " frames, encoding " << (k0 - first) + (end - k1) << " frames" << endl;
+
+	boost::filesystem::path op( outFile );
+	std::string partBase = ( op.parent_path() / ( op.stem().string() + ".part" ) ).string();
+	std::vector< std::string > parts;
+	auto partName = [&]()
+	{
+		std::stringstream ss;
+		ss << partBase << parts.size() << ".ts";
+		return ss.str();
+	};
+	auto removeParts = [&]()
+	{
+		boost::system::error_code ec;
+		for( unsigned pc = 0; pc < parts.size(); ++pc )
+			boost::filesystem::remove( parts[pc], ec );
+	};
+
+	std::stringstream encss;
+	encss << "-c:v " << encoder << " -pix_fmt " << pixFmt << " -crf " << crf << " -f mpegts";
+
+	try
+	{
+		std::shared_ptr< VideoSource > src;
+		if( first < k0 || k1 < end )
+			src.reset( new VideoSource( vidPath, "none", 0 ) );
+
+		if( first < k0 )
+		{
+			parts.push_back( partName() );
+			EncodePart( *src, first, k0, parts.back(), encss.str(), fps );
+		}
+
+		if( k0 < k1 )
+		{
+			// Seeking puts us on the keyframe at or before the time we ask for, so ask for a time
+			// between k0 and the next frame, which can't be mistaken for the previous keyframe.
+			double t = index.FrameTime( k0 );
+			if( k0 + 1 < index.NumFrames() )
+				t = 0.5 * ( t + index.FrameTime( k0 + 1 ) );
+
+			parts.push_back( partName() );
+			CommonConfig ccfg;
+			std::stringstream cmd;
+			cmd << ccfg.ffmpegPath << " -y -loglevel error -ss " << std::fixed << std::setprecision(6) << t / 1000.0
+			    << " -i \"" << vidPath << "\" -map 0:v:0 -an -frames:v " << k1 - k0
+			    << " -c:v copy -bsf:v " << bsf << " -f mpegts \"" << parts.back() << "\"";
+			cout << cmd.str() << endl;
+			if( system( cmd.str().c_str() ) != 0 )
+			{
+				throw std::runtime_error("StreamCopyCut: ffmpeg failed to copy frames from " + vidPath );
+			}
+		}
+
+		if( k1 < end )
+		{
+			parts.push_back( partName() );
+			EncodePart( *src, k1, end, parts.back(), encss.str(), fps );
+		}
+
+		if( !ConcatVideos( parts, outFile, partBase + ".txt" ) )
+		{
+			throw std::runtime_error("StreamCopyCut: ffmpeg failed to join the parts into " + outFile );
+		}
+	}
+	catch( ... )
+	{
+		removeParts();
+		throw;
+	}
+
+	removeParts();
+	return true;
+}
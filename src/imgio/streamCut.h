@@ -0,0 +1,35 @@
+#ifndef MC_STREAM_CUT_H
+#define MC_STREAM_CUT_H
+
+#include <string>
+
+//
+// Cutting a section out of a video by decoding and re-encoding every frame is slow, and
+// every re-encode loses a bit more quality. If the video is H.264 or H.265 then the whole
+// GOPs inside the cut can be copied packet for packet, and only the frames between each
+// cut point and the nearest keyframe need to be encoded:
+//
+//     first       k0                         k1        end
+//       |.........|==========================|.........|
+//        encoded      copied as they are       encoded
+//
+// The encoded edges use the same codec and pixel format as the source, and all the parts
+// go through MPEG-TS (so every part carries its own parameter sets) before being joined
+// with ffmpeg's concat demuxer.
+//
+// The copied part has to start and end on IDR frames, which the keyframe index finds for us.
+// Open GOP streams (x265's default) have mostly CRA keyframes, where the frames that follow can
+// refer to the GOP before, so those can't be cut at and we encode more of the cut, up to all of it.
+// As every part starts with an IDR and carries its own parameter sets, it doesn't matter that the
+// encoded edges don't use the same ones as the copied middle.
+//
+
+//
+// Cut frames [first, end) of vidPath into outFile. fps and crf are used for the encoded edges.
+// Returns false, having done nothing, if the video can't be cut like this (not H.264/H.265, or
+// we can't index it), so the caller can fall back to re-encoding everything.
+// Throws if something goes wrong part way.
+//
+bool StreamCopyCut( std::string vidPath, unsigned first, unsigned end, std::string outFile, int fps, int crf );
+
+#endif
@@ -0,0 +1,216 @@
+#include "imgio/syncedSourceGroup.h"
+
+#include <iostream>
+using std::cout;
+using std::endl;
+
+SyncedSourceGroup::SyncedSourceGroup( std::vector< std::shared_ptr<ImageSource> > in_sources, unsigned numThreads )
+{
+	sources = in_sources;
+	Init( numThreads );
+}
+
+SyncedSourceGroup::SyncedSourceGroup( std::vector< std::string > inputs, std::vector< std::string > calibFiles, unsigned numThreads )
+{
+	if( calibFiles.size() > 0 && calibFiles.size() != inputs.size() )
+		throw std::runtime_error("SyncedSourceGroup: need one calib file per source (or none at all)");
+	
+	PrepareSources( inputs );
+	
+	for( unsigned isc = 0; isc < inputs.size(); ++isc )
+	{
+		if( calibFiles.size() > 0 )
+			handles.push_back( CreateSource( inputs[isc], calibFiles[isc] ) );
+		else
+			handles.push_back( CreateSource( inputs[isc] ) );
+		sources.push_back( handles.back().source );
+	}
+	Init( numThreads );
+}
+
+void SyncedSourceGroup::Init( unsigned numThreads )
+{
+	if( sources.size() == 0 )
+		throw std::runtime_error("SyncedSourceGroup: no sources.");
+	
+	// we go with the frame of the first source.
+	frameIdx = sources[0]->GetCurrentFrameID();
+	
+	images.resize( sources.size() );
+	frameIDs.resize( sources.size() );
+	valid.assign( sources.size(), 1 );
+	inStep.assign( sources.size(), 1 );
+	blanks.resize( sources.size() );
+	for( unsigned isc = 0; isc < sources.size(); ++isc )
+	{
+		images[isc]   = sources[isc]->GetCurrent();
+		frameIDs[isc] = sources[isc]->GetCurrentFrameID();
+		blanks[isc]   = cv::Mat( images[isc].rows, images[isc].cols, images[isc].type(), cv::Scalar(0) );
+	}
+	nextImages   = images;
+	nextFrameIDs = frameIDs;
+	nextValid    = valid;
+	
+	if( numThreads == 0 )
+		numThreads = std::thread::hardware_concurrency();
+	numThreads = std::max( 1u, std::min( numThreads, (unsigned)sources.size() ) );
+	
+	opGen      = 0;
+	pending    = 0;
+	threadQuit = false;
+	for( unsigned tc = 0; tc < numThreads; ++tc )
+	{
+		// the thread mustn't read opGen itself once it is running, as the first
+		// operation might already have started, and it would never see it.
+		workers.push_back( std::thread( &SyncedSourceGroup::WorkerThread, this, tc, opGen ) );
+	}
+}
+
+SyncedSourceGroup::~SyncedSourceGroup()
+{
+	std::unique_lock<std::mutex> lock( pool_mutex );
+	threadQuit = true;
+	lock.unlock();
+	work_cv.notify_all();
+	
+	for( unsigned tc = 0; tc < workers.size(); ++tc )
+		workers[tc].join();
+}
+
+void SyncedSourceGroup::WorkerThread( unsigned tid, unsigned long seen )
+{
+	std::unique_lock<std::mutex> lock( pool_mutex );
+	while( true )
+	{
+		while( opGen == seen && !threadQuit )
+			work_cv.wait( lock );
+		if( threadQuit )
+			return;
+		
+		seen = opGen;
+		Operation op    = currentOp;
+		unsigned target = opTarget;
+		lock.unlock();
+		
+		for( unsigned isc = tid; isc < sources.size(); isc += workers.size() )
+		{
+			DoOperation( isc, op, target );
+		}
+		
+		lock.lock();
+		--pending;
+		if( pending == 0 )
+			done_cv.notify_all();
+	}
+}
+
+void SyncedSourceGroup::DoOperation( unsigned isc, Operation op, unsigned target )
+{
+	bool ok = false;
+	try
+	{
+		switch( op )
+		{
+			case OP_ADVANCE:
+				// a source that has already run out won't get any further.
+				if( inStep[isc] )
+					ok = sources[isc]->Advance();
+				break;
+			case OP_REGRESS:
+				if( inStep[isc] )
+				{
+					ok = sources[isc]->Regress();
+					break;
+				}
+				// otherwise, we need to jump back to the group.
+				[[fallthrough]];
+			case OP_JUMP:
+				ok = sources[isc]->JumpToFrame( target );
+				break;
+		}
+	}
+	catch( std::exception &e )
+	{
+		cout << "SyncedSourceGroup: source " << isc << " failed: " << e.what() << endl;
+		ok = false;
+	}
+	
+	if( ok )
+	{
+		nextImages[isc]   = sources[isc]->GetCurrent();
+		nextFrameIDs[isc] = sources[isc]->GetCurrentFrameID();
+		nextValid[isc]    = 1;
+	}
+	else
+	{
+		nextImages[isc]   = blanks[isc];
+		nextFrameIDs[isc] = target;
+		nextValid[isc]    = 0;
+	}
+}
+
+bool SyncedSourceGroup::RunOperation( Operation op, unsigned target )
+{
+	std::unique_lock<std::mutex> lock( pool_mutex );
+	currentOp = op;
+	opTarget  = target;
+	pending   = workers.size();
+	++opGen;
+	work_cv.notify_all();
+	while( pending > 0 )
+		done_cv.wait( lock );
+	lock.unlock();
+	
+	// if none of the sources managed it, stay where we are.
+	bool any = false;
+	for( unsigned isc = 0; isc < sources.size(); ++isc )
+		any = any || nextValid[isc];
+	if( !any )
+		return false;
+	
+	frameIdx = target;
+	images   = nextImages;
+	frameIDs = nextFrameIDs;
+	valid    = nextValid;
+	inStep   = nextValid;
+	return true;
+}
+
+bool SyncedSourceGroup::Advance()
+{
+	return RunOperation( OP_ADVANCE, frameIdx + 1 );
+}
+
+bool SyncedSourceGroup::Regress()
+{
+	if( frameIdx == 0 )
+		return false;
+	return RunOperation( OP_REGRESS, frameIdx - 1 );
+}
+
+bool SyncedSourceGroup::JumpToFrame( unsigned frame )
+{
+	return RunOperation( OP_JUMP, frame );
+}
+
+SyncedFrameSet SyncedSourceGroup::GetCurrent()
+{
+	SyncedFrameSet fs;
+	fs.frame    = frameIdx;
+	fs.images   = images;
+	fs.frameIDs = frameIDs;
+	fs.valid.assign( valid.begin(), valid.end() );
+	return fs;
+}
+
+int SyncedSourceGroup::GetNumImages()
+{
+	int n = -1;
+	for( unsigned isc = 0; isc < sources.size(); ++isc )
+	{
+		int m = sources[isc]->GetNumImages();
+		if( m >= 0 && ( n < 0 || m < n ) )
+			n = m;
+	}
+	return n;
+}
@@ -0,0 +1,104 @@
+#ifndef MC_SYNCED_SOURCE_GROUP_H
+#define MC_SYNCED_SOURCE_GROUP_H
+
+#include "imgio/sourceFactory.h"
+
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//
+// Many of our tools hold a set of synchronised sources (one per camera) and step them
+// all forward together. Doing that in series means each step costs the sum of all the decodes.
+// A SyncedSourceGroup steps all of its sources at once on a small pool of threads, so
+// the cost of a step scales with the number of cores rather than the number of cameras.
+//
+// Following the convention of the HDF5Source and FNImageDirectory, if a source doesn't
+// have the frame we ask for (e.g. it is shorter than the others) it provides a black
+// frame of the right size instead.
+//
+
+// the images from all the sources for one frame.
+struct SyncedFrameSet
+{
+	unsigned frame;                   // the frame the group is on.
+	std::vector< cv::Mat > images;    // one image per source
+	std::vector< unsigned > frameIDs; // GetCurrentFrameID() of each source.
+	std::vector< bool > valid;        // false if the source didn't have this frame (and the image is black)
+};
+
+class SyncedSourceGroup
+{
+public:
+	// group some sources that already exist. numThreads of 0 means as many as is sensible.
+	SyncedSourceGroup( std::vector< std::shared_ptr<ImageSource> > in_sources, unsigned numThreads = 0 );
+	
+	// create the sources with CreateSource(). calibFiles can be empty, or have one entry per source.
+	SyncedSourceGroup( std::vector< std::string > inputs, std::vector< std::string > calibFiles, unsigned numThreads = 0 );
+	
+	~SyncedSourceGroup();
+	
+	// advance all of the sources by one frame. Returns false if none of them could advance.
+	bool Advance();
+	
+	// regress all of the sources by one frame.
+	bool Regress();
+	
+	// move all of the sources to the specified frame.
+	bool JumpToFrame( unsigned frame );
+	
+	// get the images from all of the sources for the current frame.
+	SyncedFrameSet GetCurrent();
+	
+	unsigned GetCurrentFrameID() { return frameIdx; }
+	
+	// the smallest number of images of any of the (finite) sources.
+	int GetNumImages();
+	
+	size_t size() { return sources.size(); }
+	std::shared_ptr< ImageSource > GetSource( unsigned isc ) { return sources[isc]; }
+	SourceHandle& GetHandle( unsigned isc ) { return handles[isc]; }
+	
+protected:
+	
+	enum Operation { OP_ADVANCE, OP_REGRESS, OP_JUMP };
+	
+	void Init( unsigned numThreads );
+	
+	// run the operation on all of the sources, and wait for them to finish.
+	bool RunOperation( Operation op, unsigned target );
+	void DoOperation( unsigned isc, Operation op, unsigned target );
+	void WorkerThread( unsigned tid, unsigned long seen );
+	
+	std::vector< std::shared_ptr< ImageSource > > sources;
+	std::vector< SourceHandle > handles;
+	
+	// a blank image for each source, for when it doesn't have a frame.
+	std::vector< cv::Mat > blanks;
+	
+	// the current state of each source...
+	unsigned frameIdx;
+	std::vector< cv::Mat > images;
+	std::vector< unsigned > frameIDs;
+	std::vector< char > valid;       // not vector<bool>, as threads write to neighbouring elements.
+	std::vector< char > inStep;      // source is on the same frame as the group.
+	
+	// ... and what it will be after the current operation.
+	std::vector< cv::Mat > nextImages;
+	std::vector< unsigned > nextFrameIDs;
+	std::vector< char > nextValid;
+	
+	// the worker pool. Each thread always looks after the same sources.
+	std::vector< std::thread > workers;
+	std::mutex pool_mutex;
+	std::condition_variable work_cv;
+	std::condition_variable done_cv;
+	unsigned long opGen;
+	Operation currentOp;
+	unsigned opTarget;
+	unsigned pending;
+	bool threadQuit;
+};
+
+#endif
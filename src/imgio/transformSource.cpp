@@ -0,0 +1,370 @@
+#include "imgio/transformSource.h"
+#include "commonConfig/commonConfig.h"
+#include "misc/tokeniser.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+using std::cout;
+using std::endl;
+
+bool ParseSourceTransforms( std::string spec, std::vector< SourceTransform > &transforms )
+{
+	std::vector< SourceTransform > res;
+	std::vector< std::string > items = SplitLine( spec, "," );
+	if( items.size() == 0 )
+		return false;
+
+	for( unsigned ic = 0; ic < items.size(); ++ic )
+	{
+		const std::string &item = items[ic];
+		SourceTransform t;
+		t.scale = 1.0f;
+		if( item == "gray" || item == "grey" )
+		{
+			t.type = SourceTransform::GRAY;
+		}
+		else if( item == "undistort" )
+		{
+			t.type = SourceTransform::UNDISTORT;
+		}
+		else if( item.find("scale=") == 0 )
+		{
+			t.type = SourceTransform::SCALE;
+			char *end;
+			t.scale = strtof( item.c_str() + 6, &end );
+			if( *end != '\0' || !( t.scale > 0.0f ) )
+				return false;
+		}
+		else if( item.find("crop=") == 0 )
+		{
+			t.type = SourceTransform::CROP;
+			int w, h, x, y, n = 0;
+			if( sscanf( item.c_str() + 5, "%dx%d+%d+%d%n", &w, &h, &x, &y, &n ) != 4 || item[ 5 + n ] != '\0' ||
+			    w <= 0 || h <= 0 || x < 0 || y < 0 )
+				return false;
+			t.crop = cv::Rect( x, y, w, h );
+		}
+		else
+		{
+			return false;
+		}
+		res.push_back( t );
+	}
+
+	transforms = res;
+	return true;
+}
+
+TransformSource::TransformSource( std::shared_ptr< ImageSource > in_src, const std::vector< SourceTransform > &in_transforms, int prefetchDepth )
+{
+	src        = in_src;
+	transforms = in_transforms;
+
+	// shrinking by 2, 4 or 8 is much cheaper if the decoder does it, and then the
+	// source has already sorted out its calibration too.
+	LoadImageOptions opts = src->GetDecodeOptions();
+	bool scaleInDecoder = false;
+	if( transforms.size() > 0 && transforms[0].type == SourceTransform::SCALE && opts.IsDefault() )
+	{
+		int d = (int)round( 1.0 / transforms[0].scale );
+		if( ( d == 2 || d == 4 || d == 8 ) && fabs( transforms[0].scale * d - 1.0 ) < 1e-6 )
+		{
+			opts.scaleDenom = d;
+			scaleInDecoder  = true;
+		}
+	}
+	
+	// raw Bayer images can be decoded straight to grey without demosaicing. None of the
+	// other transforms care about colour, so it doesn't matter where the gray is in the list.
+	bool grayInDecoder = false;
+	for( unsigned tc = 0; tc < transforms.size(); ++tc )
+	{
+		if( transforms[tc].type == SourceTransform::GRAY && !opts.bayerGray )
+		{
+			opts.bayerGray = true;
+			grayInDecoder  = true;
+		}
+	}
+	
+	if( ( scaleInDecoder || grayInDecoder ) && src->SetDecodeOptions( opts ) && scaleInDecoder )
+		transforms.erase( transforms.begin() );
+
+	//
+	// Work through the transforms to get the calibration of the images we'll give out,
+	// and set up anything each transform needs.
+	//
+	calibration = src->calibration;
+	cv::Size sz = src->GetCurrent().size();
+	if( calibration.width <= 0 || calibration.height <= 0 )
+	{
+		calibration.width  = sz.width;
+		calibration.height = sz.height;
+	}
+
+	for( unsigned tc = 0; tc < transforms.size(); ++tc )
+	{
+		const SourceTransform &t = transforms[tc];
+		stageCalibs.push_back( calibration );
+		switch( t.type )
+		{
+			case SourceTransform::GRAY:
+				break;
+
+			case SourceTransform::SCALE:
+				sz = cv::Size( round( sz.width * t.scale ), round( sz.height * t.scale ) );
+				if( sz.width < 1 || sz.height < 1 )
+				{
+					throw std::runtime_error("TransformSource: scale makes the images empty.");
+				}
+				calibration.RescaleImage( sz.width, sz.height );
+				break;
+
+			case SourceTransform::UNDISTORT:
+				if( calibration.K(2,2) == 0 )
+				{
+					throw std::runtime_error("TransformSource: can't undistort a source without a calibration.");
+				}
+				calibration.distParams.assign( 5, 0 );
+				break;
+
+			case SourceTransform::CROP:
+				if( ( t.crop & cv::Rect( 0, 0, sz.width, sz.height ) ) != t.crop )
+				{
+					throw std::runtime_error("TransformSource: crop is outside of the image.");
+				}
+				calibration.CropImage( t.crop.x, t.crop.y, t.crop.width, t.crop.height );
+				sz = t.crop.size();
+				break;
+		}
+	}
+
+	frameIdx  = src->GetCurrentFrameID();
+	frameTime = src->GetCurrentFrameTime();
+	current   = Apply( src->GetCurrent() );
+
+	if( prefetchDepth < 0 )
+	{
+		CommonConfig ccfg;
+		prefetchDepth = ccfg.imgDirPrefetchDepth;
+	}
+	depth      = prefetchDepth;
+	srcEOF     = false;
+	threadQuit = false;
+	if( depth > 0 )
+	{
+		prefetchThread = std::thread( &TransformSource::PrefetchThread, this );
+	}
+}
+
+TransformSource::~TransformSource()
+{
+	if( prefetchThread.joinable() )
+	{
+		std::unique_lock<std::mutex> lock( queue_mutex );
+		threadQuit = true;
+		lock.unlock();
+		space_cv.notify_all();
+		prefetchThread.join();
+	}
+}
+
+cv::Mat TransformSource::Apply( const cv::Mat &img ) const
+{
+	if( img.empty() )
+		return cv::Mat();
+
+	cv::Mat out = img;
+	for( unsigned tc = 0; tc < transforms.size(); ++tc )
+	{
+		const SourceTransform &t = transforms[tc];
+		cv::Mat tmp;
+		switch( t.type )
+		{
+			case SourceTransform::GRAY:
+				if( out.channels() == 3 )
+				{
+					cv::cvtColor( out, tmp, cv::COLOR_BGR2GRAY );
+					out = tmp;
+				}
+				else if( out.channels() == 4 )
+				{
+					cv::cvtColor( out, tmp, cv::COLOR_BGRA2GRAY );
+					out = tmp;
+				}
+				break;
+
+			case SourceTransform::SCALE:
+				cv::resize( out, tmp, cv::Size( round( out.cols * t.scale ), round( out.rows * t.scale ) ), 0, 0, t.scale < 1.0f ? cv::INTER_AREA : cv::INTER_LINEAR );
+				out = tmp;
+				break;
+
+			case SourceTransform::UNDISTORT:
+				stageCalibs[tc].Undistort( out, tmp );
+				out = tmp;
+				break;
+
+			case SourceTransform::CROP:
+				out = out( t.crop );
+				break;
+		}
+	}
+
+	// the wrapped source might re-use its image, so we can't hand it out as ours.
+	if( out.datastart == img.datastart )
+		out = out.clone();
+	return out;
+}
+
+void TransformSource::PrefetchThread()
+{
+	std::unique_lock<std::mutex> qlock( queue_mutex );
+	while( !threadQuit )
+	{
+		if( frameQueue.size() >= depth || srcEOF )
+		{
+			space_cv.wait( qlock );
+			continue;
+		}
+		qlock.unlock();
+
+		// the transform has to be done while we hold the source, as the
+		// source is free to re-use its image once it moves on.
+		std::unique_lock<std::mutex> slock( src_mutex );
+		PrefetchedFrame pf;
+		bool ok;
+		try
+		{
+			ok = src->Advance();
+			if( ok )
+			{
+				pf.id   = src->GetCurrentFrameID();
+				pf.time = src->GetCurrentFrameTime();
+				pf.img  = Apply( src->GetCurrent() );
+			}
+		}
+		catch( std::exception &e )
+		{
+			cout << "TransformSource: stopping after error getting frame: " << e.what() << endl;
+			ok = false;
+		}
+
+		// lock order is always source, then queue.
+		qlock.lock();
+		slock.unlock();
+
+		if( ok )
+			frameQueue.push_back( pf );
+		else
+			srcEOF = true;
+		ready_cv.notify_all();
+	}
+}
+
+void TransformSource::FlushQueue()
+{
+	// caller must hold the source mutex, so the prefetch thread
+	// can't be half way through putting something on the queue.
+	std::unique_lock<std::mutex> qlock( queue_mutex );
+	frameQueue.clear();
+	srcEOF = false;
+}
+
+cv::Mat TransformSource::GetCurrent()
+{
+	return current;
+}
+
+bool TransformSource::Advance()
+{
+	if( depth > 0 )
+	{
+		std::unique_lock<std::mutex> qlock( queue_mutex );
+		while( frameQueue.empty() && !srcEOF )
+			ready_cv.wait( qlock );
+
+		if( frameQueue.empty() )
+			return false;
+
+		current   = std::move( frameQueue.front().img );
+		frameIdx  = frameQueue.front().id;
+		frameTime = frameQueue.front().time;
+		frameQueue.pop_front();
+		qlock.unlock();
+		space_cv.notify_all();
+		return true;
+	}
+
+	std::unique_lock<std::mutex> slock( src_mutex );
+	if( !src->Advance() )
+		return false;
+	frameIdx  = src->GetCurrentFrameID();
+	frameTime = src->GetCurrentFrameTime();
+	current   = Apply( src->GetCurrent() );
+	return true;
+}
+
+bool TransformSource::Regress()
+{
+	if( frameIdx == 0 )
+		return false;
+	return JumpToFrame( frameIdx - 1 );
+}
+
+bool TransformSource::JumpToFrame( unsigned frame )
+{
+	std::unique_lock<std::mutex> slock( src_mutex );
+
+	// stepping forward onto a frame we already have needs no work.
+	if( depth > 0 && frame == frameIdx + 1 )
+	{
+		std::unique_lock<std::mutex> qlock( queue_mutex );
+		if( !frameQueue.empty() && frameQueue.front().id == frame )
+		{
+			qlock.unlock();
+			slock.unlock();
+			return Advance();
+		}
+	}
+
+	FlushQueue();
+
+	bool ok = src->JumpToFrame( frame );
+	frameIdx  = src->GetCurrentFrameID();
+	frameTime = src->GetCurrentFrameTime();
+	current   = Apply( src->GetCurrent() );
+
+	slock.unlock();
+	space_cv.notify_all();
+	return ok;
+}
+
+unsigned TransformSource::GetCurrentFrameID()
+{
+	return frameIdx;
+}
+
+frameTime_t TransformSource::GetCurrentFrameTime()
+{
+	return frameTime;
+}
+
+int TransformSource::GetNumImages()
+{
+	return src->GetNumImages();
+}
+
+void TransformSource::SaveCalibration()
+{
+	src->SaveCalibration();
+}
+
+cv::Mat TransformSource::GetFrame( unsigned frame )
+{
+	FrameProvider *fp = dynamic_cast< FrameProvider* >( src.get() );
+	if( !fp )
+		return cv::Mat();
+	return Apply( fp->GetFrame( frame ) );
+}
@@ -0,0 +1,111 @@
+#ifndef MC_TRANSFORM_SOURCE_H
+#define MC_TRANSFORM_SOURCE_H
+
+#include "imgio/imagesource.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+
+//
+// Lots of consumers do the same thing to every frame straight after GetCurrent() - convert
+// to grey, shrink, undistort, cut out a region. A TransformSource wraps another source and
+// does that work for it, on a background thread a few frames ahead of the current frame,
+// so the consumer gets frames that are ready to use. The calibration of the TransformSource
+// is changed to match the images it gives.
+//
+// The transforms are applied in order, and CreateSource() will add them if the source
+// string ends with a list of them, e.g.
+//
+//     /path/to/images:gray,scale=0.5
+//     /path/to/video.mp4:undistort,crop=1280x720+320+180
+//
+// The transforms are:
+//   - gray           : 3 or 4 channel images to 1 channel. Sources of raw Bayer images are asked
+//                      to decode straight to grey (see LoadImageOptions::bayerGray).
+//   - scale=<s>      : resize by s. If this comes first and s is 1/2, 1/4 or 1/8, sources that can
+//                      decode at reduced resolution (see ImageSource::SetDecodeOptions) do it for us.
+//   - undistort      : remove the lens distortion. The calibration then has no distortion.
+//   - crop=WxH+X+Y   : keep only the W x H region at (X,Y).
+//
+
+struct SourceTransform
+{
+	enum Type { GRAY, SCALE, UNDISTORT, CROP } type;
+	float scale;
+	cv::Rect crop;
+};
+
+// parse a comma separated list of transforms. Returns false if spec isn't one.
+bool ParseSourceTransforms( std::string spec, std::vector< SourceTransform > &transforms );
+
+class TransformSource : public ImageSource, public FrameProvider
+{
+public:
+	//
+	// prefetchDepth is how many transformed frames to keep ready ahead of the current frame.
+	// 0 does the work on the caller's thread in Advance(), and a negative value uses the
+	// imgDirPrefetchDepth from the user's CommonConfig.
+	//
+	TransformSource( std::shared_ptr< ImageSource > in_src, const std::vector< SourceTransform > &in_transforms, int prefetchDepth = -1 );
+	~TransformSource();
+
+	cv::Mat GetCurrent();
+	bool Advance();
+	bool Regress();
+	bool JumpToFrame( unsigned frame );
+
+	unsigned GetCurrentFrameID();
+	frameTime_t GetCurrentFrameTime();
+	int GetNumImages();
+
+	// The transformed calibration can't generally be turned back into one for the
+	// original images, so this saves the wrapped source's calibration.
+	void SaveCalibration();
+
+	// only useful if the wrapped source is a FrameProvider too.
+	cv::Mat GetFrame( unsigned frame );
+
+	// transform an image from the wrapped source. Safe from any thread.
+	cv::Mat Apply( const cv::Mat &img ) const;
+
+	std::shared_ptr< ImageSource > GetSource() { return src; }
+
+protected:
+
+	std::shared_ptr< ImageSource > src;
+	std::vector< SourceTransform > transforms;
+
+	// the calibration of the images going in to each transform. Undistort uses
+	// this, and it keeps the undistortion maps for us.
+	std::vector< Calibration > stageCalibs;
+
+	//
+	// prefetch, much the same as the VideoSource decode-ahead.
+	//
+	void PrefetchThread();
+	void FlushQueue();
+
+	struct PrefetchedFrame
+	{
+		unsigned id;
+		frameTime_t time;
+		cv::Mat img;
+	};
+	
+	unsigned depth;
+	bool srcEOF;
+	std::deque< PrefetchedFrame > frameQueue;
+	std::mutex src_mutex;      // held by whoever is using src
+	std::mutex queue_mutex;
+	std::condition_variable space_cv;  // tells the prefetch thread there is room in the queue
+	std::condition_variable ready_cv;  // tells Advance() there is a frame in the queue
+	std::thread prefetchThread;
+	bool threadQuit;
+
+	unsigned frameIdx;
+	frameTime_t frameTime;
+	cv::Mat current;
+};
+
+#endif
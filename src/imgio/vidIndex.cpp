@@ -0,0 +1,394 @@
+#include "imgio/vidIndex.h"
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/pixdesc.h>
+}
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <limits>
+#include <fstream>
+#include <iostream>
+using std::cout;
+using std::endl;
+
+VideoIndex::VideoIndex()
+{
+	vidSize  = 0;
+	vidMTime = 0;
+}
+
+bool VideoIndex::Open( std::string vidPath )
+{
+	boost::filesystem::path p( vidPath );
+	if( !boost::filesystem::exists(p) )
+		return false;
+	
+	uint64_t s = boost::filesystem::file_size(p);
+	int64_t  t = boost::filesystem::last_write_time(p);
+	
+	std::string fn = SidecarName( vidPath );
+	if( Read( fn ) && vidSize == s && vidMTime == t )
+	{
+		return true;
+	}
+	
+	cout << "building keyframe index for: " << vidPath << endl;
+	if( !Build( vidPath ) )
+	{
+		cout << "\t couldn't index video, seeking will be approximate." << endl;
+		return false;
+	}
+	vidSize  = s;
+	vidMTime = t;
+	cout << "\t " << frameTimes.size() << " frames, " << keyframes.size() << " keyframes" << endl;
+	
+	// not a big problem if this fails (e.g. read-only directory), we'll just
+	// have to build the index again next time.
+	if( !Write( fn ) )
+	{
+		cout << "\t couldn't write keyframe index to: " << fn << endl;
+	}
+	return true;
+}
+
+//
+// Is the packet an H.264 or H.265 IDR picture? We look at the type of the first slice NAL unit.
+// lengthSize is the size of the NAL length prefixes for MP4 style packets, or 0 for
+// Annex B (start codes).
+//
+static bool PacketIsIDR( const AVPacket *pkt, int codecId, int lengthSize )
+{
+	const uint8_t *d = pkt->data;
+	size_t n = pkt->size;
+	size_t pos = 0;
+	while( pos < n )
+	{
+		// find the start and size of the next NAL unit.
+		size_t start, end;
+		if( lengthSize > 0 )
+		{
+			if( pos + lengthSize > n )
+				return false;
+			size_t len = 0;
+			for( int bc = 0; bc < lengthSize; ++bc )
+				len = ( len << 8 ) | d[pos + bc];
+			start = pos + lengthSize;
+			end   = start + len;
+			if( end > n || len == 0 )
+				return false;
+		}
+		else
+		{
+			while( pos + 3 <= n && !( d[pos] == 0 && d[pos+1] == 0 && d[pos+2] == 1 ) )
+				++pos;
+			if( pos + 3 > n )
+				return false;
+			start = pos + 3;
+			end = start;
+			while( end + 3 <= n && !( d[end] == 0 && d[end+1] == 0 && ( d[end+2] == 1 || d[end+2] == 0 ) ) )
+				++end;
+			if( end + 3 > n )
+				end = n;
+		}
+		if( start >= n )
+			return false;
+		
+		if( codecId == AV_CODEC_ID_H264 )
+		{
+			// slices are types 1 to 5, and 5 is IDR.
+			int t = d[start] & 0x1F;
+			if( t >= 1 && t <= 5 )
+				return t == 5;
+		}
+		else
+		{
+			// slices are types 0 to 31, and 19 and 20 are IDR (IDR_W_RADL and IDR_N_LP).
+			int t = ( d[start] >> 1 ) & 0x3F;
+			if( t < 32 )
+				return t == 19 || t == 20;
+		}
+		pos = end;
+	}
+	return false;
+}
+
+bool VideoIndex::Build( std::string vidPath )
+{
+	frameTimes.clear();
+	keyframes.clear();
+	idrs.clear();
+	
+	AVFormatContext *fmt = NULL;
+	if( avformat_open_input( &fmt, vidPath.c_str(), NULL, NULL ) < 0 )
+		return false;
+	
+	if( avformat_find_stream_info( fmt, NULL ) < 0 )
+	{
+		avformat_close_input( &fmt );
+		return false;
+	}
+	
+	int vs = av_find_best_stream( fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0 );
+	if( vs < 0 )
+	{
+		avformat_close_input( &fmt );
+		return false;
+	}
+	AVStream *st = fmt->streams[vs];
+	
+	// For H.264 and H.265 we note which keyframes are IDR pictures. MP4 style packets have
+	// length prefixed NAL units, with the size of the lengths in the extradata, otherwise
+	// there are start codes.
+	AVCodecParameters *par = st->codecpar;
+	bool checkIDR = par->codec_id == AV_CODEC_ID_H264 || par->codec_id == AV_CODEC_ID_HEVC;
+	int lengthSize = 0;
+	const uint8_t *ed = par->extradata;
+	if( ed && par->extradata_size >= 7 && ed[0] == 1 )
+	{
+		if( par->codec_id == AV_CODEC_ID_H264 )
+			lengthSize = ( ed[4] & 3 ) + 1;
+		else if( par->extradata_size >= 23 )
+			lengthSize = ( ed[21] & 3 ) + 1;
+	}
+	
+	// read every packet of the video stream. This doesn't decode anything so it is
+	// about as fast as reading the file. Packets arrive in decode order, which isn't 
+	// presentation order if there are B-frames, so remember the timestamps and sort later.
+	struct PacketInfo
+	{
+		int64_t ts;
+		bool key;
+		bool idr;
+		bool operator<( const PacketInfo &o ) const { return ts < o.ts; }
+	};
+	std::vector< PacketInfo > pkts;
+	AVPacket *pkt = av_packet_alloc();
+	while( av_read_frame( fmt, pkt ) >= 0 )
+	{
+		if( pkt->stream_index == vs )
+		{
+			PacketInfo pi;
+			pi.ts = pkt->pts;
+			if( pi.ts == AV_NOPTS_VALUE )
+				pi.ts = pkt->dts;
+			pi.key = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+			pi.idr = pi.key && checkIDR && PacketIsIDR( pkt, par->codec_id, lengthSize );
+			pkts.push_back( pi );
+		}
+		av_packet_unref( pkt );
+	}
+	av_packet_free( &pkt );
+	
+	// An IDR picture can still have leading pictures (RADL) which come after it in decode order
+	// but before it in presentation order. Starting from there would show those frames again,
+	// so we only count IDRs where nothing later in the stream is presented earlier.
+	int64_t minLater = std::numeric_limits<int64_t>::max();
+	for( int pc = (int)pkts.size() - 1; pc >= 0; --pc )
+	{
+		if( pkts[pc].idr && minLater < pkts[pc].ts )
+			pkts[pc].idr = false;
+		minLater = std::min( minLater, pkts[pc].ts );
+	}
+	
+	std::stable_sort( pkts.begin(), pkts.end() );
+	
+	// OpenCV reports frame times relative to the start time of the stream.
+	int64_t start = st->start_time;
+	if( start == AV_NOPTS_VALUE && pkts.size() > 0 )
+		start = pkts[0].ts;
+	double tb = av_q2d( st->time_base );
+	
+	frameTimes.resize( pkts.size() );
+	for( unsigned fc = 0; fc < pkts.size(); ++fc )
+	{
+		frameTimes[fc] = (pkts[fc].ts - start) * tb * 1000.0;
+		if( pkts[fc].key )
+			keyframes.push_back( fc );
+		if( pkts[fc].idr )
+			idrs.push_back( fc );
+	}
+	
+	avformat_close_input( &fmt );
+	
+	// a video always starts with a keyframe, even if the flags disagree.
+	if( keyframes.size() == 0 || keyframes[0] != 0 )
+		keyframes.insert( keyframes.begin(), 0 );
+	
+	return frameTimes.size() > 0;
+}
+
+bool VideoIndex::Read( std::string fn )
+{
+	frameTimes.clear();
+	keyframes.clear();
+	idrs.clear();
+	
+	std::ifstream infi( fn, std::ios::in | std::ios::binary );
+	if( !infi )
+		return false;
+	
+	// older index files don't know about IDRs, so they just get built again.
+	unsigned magic;
+	infi.read( (char*)&magic, sizeof(magic) );
+	if( magic != VIDINDEX_MAGIC )
+		return false;
+	
+	uint64_t nf, nk, ni;
+	infi.read( (char*)&vidSize,  sizeof(vidSize) );
+	infi.read( (char*)&vidMTime, sizeof(vidMTime) );
+	infi.read( (char*)&nf, sizeof(nf) );
+	infi.read( (char*)&nk, sizeof(nk) );
+	infi.read( (char*)&ni, sizeof(ni) );
+	if( !infi )
+		return false;
+	
+	// a truncated or corrupt file must not make us allocate whatever the counts say,
+	// so they have to account for exactly the rest of the file.
+	uint64_t at = infi.tellg();
+	infi.seekg( 0, std::ios::end );
+	uint64_t len = infi.tellg();
+	infi.seekg( at );
+	if( nf == 0 || nk == 0 || nk > nf || ni > nk || len < at || (len - at) / sizeof(double) < nf ||
+	    len - at != nf * sizeof(double) + ( nk + ni ) * sizeof(unsigned) )
+	{
+		return false;
+	}
+	
+	frameTimes.resize( nf );
+	keyframes.resize( nk );
+	idrs.resize( ni );
+	infi.read( (char*)frameTimes.data(), nf * sizeof(double) );
+	infi.read( (char*)keyframes.data(), nk * sizeof(unsigned) );
+	if( ni > 0 )
+		infi.read( (char*)idrs.data(), ni * sizeof(unsigned) );
+	
+	// keyframes have to be sorted frames of the video, starting at the first frame,
+	// and IDRs have to be sorted keyframes.
+	bool ok = (bool)infi && keyframes[0] == 0;
+	for( unsigned kc = 1; ok && kc < nk; ++kc )
+		ok = keyframes[kc] > keyframes[kc-1] && keyframes[kc] < nf;
+	for( unsigned ic = 0; ok && ic < ni; ++ic )
+		ok = ( ic == 0 || idrs[ic] > idrs[ic-1] ) && std::binary_search( keyframes.begin(), keyframes.end(), idrs[ic] );
+	
+	if( !ok )
+	{
+		frameTimes.clear();
+		keyframes.clear();
+		idrs.clear();
+		return false;
+	}
+	return true;
+}
+
+bool VideoIndex::Write( std::string fn )
+{
+	std::ofstream outfi( fn, std::ios::out | std::ios::binary );
+	if( !outfi )
+		return false;
+	
+	unsigned magic = VIDINDEX_MAGIC;
+	uint64_t nf = frameTimes.size();
+	uint64_t nk = keyframes.size();
+	uint64_t ni = idrs.size();
+	outfi.write( (char*)&magic, sizeof(magic) );
+	outfi.write( (char*)&vidSize,  sizeof(vidSize) );
+	outfi.write( (char*)&vidMTime, sizeof(vidMTime) );
+	outfi.write( (char*)&nf, sizeof(nf) );
+	outfi.write( (char*)&nk, sizeof(nk) );
+	outfi.write( (char*)&ni, sizeof(ni) );
+	outfi.write( (char*)frameTimes.data(), nf * sizeof(double) );
+	outfi.write( (char*)keyframes.data(), nk * sizeof(unsigned) );
+	outfi.write( (char*)idrs.data(), ni * sizeof(unsigned) );
+	return (bool)outfi;
+}
+
+unsigned VideoIndex::KeyframeAtOrBefore( unsigned frame ) const
+{
+	auto i = std::upper_bound( keyframes.begin(), keyframes.end(), frame );
+	if( i == keyframes.begin() )
+		return 0;
+	return *(i-1);
+}
+
+unsigned VideoIndex::PreviousKeyframe( unsigned keyframe ) const
+{
+	if( keyframe == 0 )
+		return 0;
+	return KeyframeAtOrBefore( keyframe - 1 );
+}
+
+unsigned VideoIndex::KeyframeAtOrAfter( unsigned frame ) const
+{
+	auto i = std::lower_bound( keyframes.begin(), keyframes.end(), frame );
+	if( i == keyframes.end() )
+		return NumFrames();
+	return *i;
+}
+
+unsigned VideoIndex::IDRAtOrAfter( unsigned frame ) const
+{
+	auto i = std::lower_bound( idrs.begin(), idrs.end(), frame );
+	if( i == idrs.end() )
+		return NumFrames();
+	return *i;
+}
+
+unsigned VideoIndex::IDRAtOrBefore( unsigned frame ) const
+{
+	auto i = std::upper_bound( idrs.begin(), idrs.end(), frame );
+	if( i == idrs.begin() )
+		return NumFrames();
+	return *(i-1);
+}
+
+bool VideoIndex::ProbeStream( std::string vidPath, std::string &codec, std::string &pixFmt )
+{
+	AVFormatContext *fmt = NULL;
+	if( avformat_open_input( &fmt, vidPath.c_str(), NULL, NULL ) < 0 )
+		return false;
+	
+	bool ok = false;
+	if( avformat_find_stream_info( fmt, NULL ) >= 0 )
+	{
+		int vs = av_find_best_stream( fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0 );
+		if( vs >= 0 )
+		{
+			AVCodecParameters *par = fmt->streams[vs]->codecpar;
+			const char *pf = av_get_pix_fmt_name( (AVPixelFormat)par->format );
+			codec  = avcodec_get_name( par->codec_id );
+			pixFmt = pf ? pf : "";
+			ok = true;
+		}
+	}
+	avformat_close_input( &fmt );
+	return ok;
+}
+
+int VideoIndex::FrameAtTime( double ms ) const
+{
+	if( frameTimes.size() == 0 )
+		return -1;
+	
+	auto i = std::lower_bound( frameTimes.begin(), frameTimes.end(), ms );
+	int f = i - frameTimes.begin();
+	
+	// lower_bound gets us the first frame at or after ms, the one before might be closer.
+	if( f == (int)frameTimes.size() || ( f > 0 && ms - frameTimes[f-1] < frameTimes[f] - ms ) )
+		f = f - 1;
+	
+	// if we're more than half a frame away from that, we don't really know what frame it is.
+	double tol = 0.5;
+	if( frameTimes.size() > 1 )
+	{
+		unsigned a = std::min( (unsigned)f, (unsigned)frameTimes.size()-2 );
+		tol = std::max( tol, 0.5 * (frameTimes[a+1] - frameTimes[a]) );
+	}
+	if( std::abs( frameTimes[f] - ms ) > tol )
+		return -1;
+	
+	return f;
+}
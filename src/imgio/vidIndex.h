@@ -0,0 +1,92 @@
+#ifndef MC_DEV_VIDINDEX
+#define MC_DEV_VIDINDEX
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//
+// OpenCV's idea of frame numbers in a video is derived from the frame timestamps and the
+// frame rate, and seeking with CAP_PROP_POS_FRAMES is not to be trusted - especially on long
+// GoPro/MP4 files. So, we scan the packets of the video once with libavformat (no decoding needed)
+// and keep a list of the presentation timestamp of every frame, and which frames are keyframes.
+//
+// With that we can always tell exactly which frame we are on from the timestamp, and we can
+// seek to the keyframe before a frame and decode forward to the exact frame we want.
+//
+// For H.264 and H.265 we also note which keyframes are IDR pictures with no leading pictures.
+// Only those are places where a stream can be cut and copied without needing anything from
+// before - x265, for one, uses open GOPs by default, so most of its keyframes are CRA pictures
+// whose following (RASL) frames refer back to the previous GOP.
+//
+// The index is stored in a sidecar file <video>.kfidx, next to the usual <video>.calib
+//
+
+// index files with any other magic number (e.g. from before we kept the IDRs) are built again.
+#define VIDINDEX_MAGIC 820830009
+
+class VideoIndex
+{
+public:
+	VideoIndex();
+	
+	// load the index from the sidecar file if it is there and up to date,
+	// otherwise build it and try to save it.
+	bool Open( std::string vidPath );
+	
+	// scan the video file to build the index.
+	bool Build( std::string vidPath );
+	
+	bool Read( std::string fn );
+	bool Write( std::string fn );
+	
+	bool IsValid() const { return frameTimes.size() > 0; }
+	
+	// exact number of frames in the video.
+	unsigned NumFrames() const { return frameTimes.size(); }
+	
+	// index of the last keyframe at or before the specified frame.
+	unsigned KeyframeAtOrBefore( unsigned frame ) const;
+	
+	// index of the keyframe before the specified keyframe.
+	unsigned PreviousKeyframe( unsigned keyframe ) const;
+	
+	// index of the first keyframe at or after the specified frame, NumFrames() if there isn't one.
+	unsigned KeyframeAtOrAfter( unsigned frame ) const;
+	
+	// the same for clean IDR keyframes. NumFrames() if there isn't one, and there never
+	// is for codecs other than H.264 and H.265.
+	unsigned IDRAtOrAfter( unsigned frame ) const;
+	unsigned IDRAtOrBefore( unsigned frame ) const;
+	
+	// presentation time of a frame in ms, relative to the start of the stream.
+	double FrameTime( unsigned frame ) const { return frameTimes[frame]; }
+	
+	// the codec and pixel format of the video stream, as ffmpeg names them (e.g. "h264", "yuv420p").
+	// returns false if we can't tell.
+	static bool ProbeStream( std::string vidPath, std::string &codec, std::string &pixFmt );
+	
+	// which frame has the presentation time (in ms, as OpenCV's CAP_PROP_POS_MSEC)?
+	// returns -1 if there's no frame close to that time.
+	int FrameAtTime( double ms ) const;
+	
+	static std::string SidecarName( std::string vidPath ) { return vidPath + ".kfidx"; }
+	
+protected:
+	
+	// presentation time of each frame, in ms relative to the start of the stream.
+	std::vector< double > frameTimes;
+	
+	// sorted list of frames which are keyframes.
+	std::vector< unsigned > keyframes;
+	
+	// sorted list of keyframes which are IDRs that a stream can be cut at.
+	std::vector< unsigned > idrs;
+	
+	// what we know about the video file when the index was built,
+	// so we can tell if the index is stale.
+	uint64_t vidSize;
+	int64_t  vidMTime;
+};
+
+#endif
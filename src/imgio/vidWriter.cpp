@@ -5,41 +5,38 @@
 
 #include <sstream>
 #include <iostream>
+#include <csignal>
 using std::cout;
 using std::endl;
 
-VidWriter::VidWriter( std::string filename, std::string codecStr, cv::Mat typicalImage, int in_fps, int in_crf, std::string pixfmt)
+std::string VidWriter::InputArgs( cv::Mat typicalImage, int in_fps )
 {
-	// build up our ffmpeg command into a stringstream
 	std::stringstream ss;
 	
-	// start with the basics - the actual ffmpeg executable.
-	CommonConfig ccfg;
-	ss << ccfg.ffmpegPath << " "; 
-	
-	// we'll just go with overwriting existing files rather than have to handle a failed ffmpeg open.
-	ss << "-y ";
-	
 	// now we specify the codec for the input
 	ss << "-f rawvideo -vcodec rawvideo ";
 	
+	// most pixel formats need an even sized image, so odd sized images get padded.
+	frameSize = cv::Size( typicalImage.cols + typicalImage.cols % 2, typicalImage.rows + typicalImage.rows % 2 );
+	
 	// now the input shape and format.
-	ss << "-s " << typicalImage.cols << "x" << typicalImage.rows << " ";
+	ss << "-s " << frameSize.width << "x" << frameSize.height << " ";
 	
-	if( typicalImage.type() == CV_8UC3 )
+	if( typicalImage.channels() == 3 && ( typicalImage.depth() == CV_8U || typicalImage.depth() == CV_32F ) )
 	{
-		frameBytes = typicalImage.rows * typicalImage.cols * 3;
+		frameType = CV_8UC3;
 		ss << "-pix_fmt bgr24 ";
 	}
-	else if( typicalImage.type() == CV_8UC1 )
+	else if( typicalImage.channels() == 1 && ( typicalImage.depth() == CV_8U || typicalImage.depth() == CV_32F ) )
 	{
-		frameBytes = typicalImage.rows * typicalImage.cols * 1;
+		frameType = CV_8UC1;
 		ss << "-pix_fmt gray8 ";
 	}
 	else
 	{
-		throw std::runtime_error("Vid writer expects typical image to be CV_8UC1 or CV_8UC3");
+		throw std::runtime_error("Vid writer expects typical image to be CV_8UC1, CV_8UC3, CV_32FC1 or CV_32FC3");
 	}
+	frameBytes = frameSize.width * frameSize.height * CV_MAT_CN( frameType );
 	
 	// input framerate.
 	fps = in_fps;
@@ -48,6 +45,57 @@ VidWriter::VidWriter( std::string filename, std::string codecStr, cv::Mat typica
 	// and that the input comes from stdin
 	ss << " -i - ";
 	
+	return ss.str();
+}
+
+void VidWriter::Open( std::string cmd, unsigned in_maxQueue )
+{
+	// open the pipe...
+	if( !(outPipe = popen(cmd.c_str(), "w")) )
+	{
+		cout << "popen error" << endl;
+		exit(1);
+	}
+	
+	// if ffmpeg dies we want an error from fwrite, not to be killed by SIGPIPE.
+	signal( SIGPIPE, SIG_IGN );
+	
+	fnum       = 0;
+	maxQueue   = std::max( 1u, in_maxQueue );
+	inFlight   = 0;
+	threadQuit = false;
+	err        = nullptr;
+	
+	// queued frames, the one being written, and a couple held by the caller.
+	pool.SetMaxBuffers( maxQueue + 3 );
+	
+	stats.written      = 0;
+	stats.stalls       = 0;
+	stats.stallSeconds = 0.0;
+	stats.pipeSeconds  = 0.0;
+	stats.elapsed      = 0.0;
+	stats.queued       = 0;
+	stats.maxQueued    = 0;
+	startTime = std::chrono::steady_clock::now();
+	
+	writerThread = std::thread( &VidWriter::WriterThread, this );
+}
+
+VidWriter::VidWriter( std::string filename, std::string codecStr, cv::Mat typicalImage, int in_fps, int in_crf, std::string pixfmt, unsigned in_maxQueue )
+{
+	// build up our ffmpeg command into a stringstream
+	std::stringstream ss;
+	
+	// start with the basics - the actual ffmpeg executable.
+	CommonConfig ccfg;
+	ss << ccfg.ffmpegPath << " "; 
+	
+	// we'll just go with overwriting existing files rather than have to handle a failed ffmpeg open.
+	ss << "-y ";
+	
+	// describe the raw frames we'll be sending.
+	ss << InputArgs( typicalImage, in_fps );
+	
 	
 	// now we specify the output codec.
 	// we'll allow a few common shortcuts.
@@ -86,20 +134,16 @@ VidWriter::VidWriter( std::string filename, std::string codecStr, cv::Mat typica
 	cout << ss.str() << endl;
 	
 	
-	// open the pipe...
-	if( !(outPipe = popen(ss.str().c_str(), "w")) )
-	{
-		cout << "popen error" << endl;
-		exit(1);
-	}
+	// open the pipe and start the writer thread.
+	Open( ss.str(), in_maxQueue );
 	
 	
 
 }
 
-VidWriter::VidWriter( std::string filename, std::string encoderStr, cv::Mat typicalImage, int in_fps )
+VidWriter::VidWriter( std::string filename, std::string encoderStr, cv::Mat typicalImage, int in_fps, unsigned in_maxQueue )
 {
-		// build up our ffmpeg command into a stringstream
+	// build up our ffmpeg command into a stringstream
 	std::stringstream ss;
 	
 	// start with the basics - the actual ffmpeg executable.
@@ -109,33 +153,8 @@ VidWriter::VidWriter( std::string filename, std::string encoderStr, cv::Mat typi
 	// we'll just go with overwriting existing files rather than have to handle a failed ffmpeg open.
 	ss << "-y ";
 	
-	// now we specify the codec for the input
-	ss << "-f rawvideo -vcodec rawvideo ";
-	
-	// now the input shape and format.
-	ss << "-s " << typicalImage.cols << "x" << typicalImage.rows << " ";
-	
-	if( typicalImage.type() == CV_8UC3 )
-	{
-		frameBytes = typicalImage.rows * typicalImage.cols * 3;
-		ss << "-pix_fmt bgr24 ";
-	}
-	else if( typicalImage.type() == CV_8UC1 )
-	{
-		frameBytes = typicalImage.rows * typicalImage.cols * 1;
-		ss << "-pix_fmt gray8 ";
-	}
-	else
-	{
-		throw std::runtime_error("Vid writer expects typical image to be CV_8UC1 or CV_8UC3");
-	}
-	
-	// input framerate.
-	fps = in_fps;
-	ss << "-r " << fps;
-	
-	// and that the input comes from stdin
-	ss << " -i - ";
+	// describe the raw frames we'll be sending.
+	ss << InputArgs( typicalImage, in_fps );
 	
 	
 	// the encoding options are passed verbatim from the user's string.
@@ -147,31 +166,202 @@ VidWriter::VidWriter( std::string filename, std::string encoderStr, cv::Mat typi
 	cout << ss.str() << endl;
 	
 	
-	// open the pipe...
-	if( !(outPipe = popen(ss.str().c_str(), "w")) )
+	// open the pipe and start the writer thread.
+	Open( ss.str(), in_maxQueue );
+}
+
+
+void VidWriter::RethrowError()
+{
+	// mutex is held by the caller.
+	if( err )
 	{
-		cout << "popen error" << endl;
-		exit(1);
+		std::exception_ptr e = err;
+		err = nullptr;
+		std::rethrow_exception( e );
 	}
 }
 
-
-void VidWriter::Write( cv::Mat img )
+void VidWriter::Write( cv::Mat img, bool copy )
 {
-	fwrite( img.data, 1, frameBytes, outPipe );
+	if( img.channels() != CV_MAT_CN( frameType ) || img.cols > frameSize.width || img.rows > frameSize.height )
+	{
+		throw std::runtime_error("VidWriter: image does not match the size or channels of the video.");
+	}
+	
+	cv::Mat frame;
+	if( copy )
+	{
+		frame = pool.Get( img.rows, img.cols, img.type() );
+		img.copyTo( frame );
+	}
+	else
+	{
+		frame = img;
+	}
+	
+	std::unique_lock<std::mutex> lock( mutex );
+	RethrowError();
+	
+	if( queue.size() >= maxQueue )
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		while( queue.size() >= maxQueue && !err )
+		{
+			space_cv.wait( lock );
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		
+		stats.stalls++;
+		stats.stallSeconds += std::chrono::duration<double>( t1 - t0 ).count();
+		
+		RethrowError();
+	}
+	
+	queue.push_back( std::move(frame) );
+	stats.maxQueued = std::max( stats.maxQueued, (unsigned)queue.size() + inFlight );
 	++fnum;
+	lock.unlock();
+	work_cv.notify_one();
+}
+
+void VidWriter::Flush()
+{
+	std::unique_lock<std::mutex> lock( mutex );
+	while( !queue.empty() || inFlight > 0 )
+	{
+		done_cv.wait( lock );
+	}
+	RethrowError();
 }
 
 void VidWriter::Finish()
 {
+	Flush();
+}
 
+VidWriterStats VidWriter::GetStats()
+{
+	std::unique_lock<std::mutex> lock( mutex );
+	VidWriterStats s = stats;
+	s.queued  = queue.size() + inFlight;
+	s.elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - startTime ).count();
+	return s;
 }
 
+const cv::Mat& VidWriter::Prepare( const cv::Mat &img )
+{
+	// float images are assumed to be in the range 0 -> 1
+	const cv::Mat *src = &img;
+	if( img.depth() != CV_8U )
+	{
+		img.convertTo( converted, frameType, 255.0f );
+		src = &converted;
+	}
+	
+	if( src->cols == frameSize.width && src->rows == frameSize.height && src->isContinuous() )
+	{
+		return *src;
+	}
+	
+	// pad with black. The padding is never written over, so it only needs
+	// clearing when the size of the images changes.
+	if( padded.empty() )
+	{
+		padded = cv::Mat( frameSize.height, frameSize.width, frameType, cv::Scalar(0,0,0) );
+	}
+	else if( src->size() != paddedFrom )
+	{
+		padded.setTo( cv::Scalar(0,0,0) );
+	}
+	paddedFrom = src->size();
+	cv::Mat roi = padded( cv::Rect( 0, 0, src->cols, src->rows ) );
+	src->copyTo( roi );
+	return padded;
+}
 
+void VidWriter::WriterThread()
+{
+	std::unique_lock<std::mutex> lock( mutex );
+	while( true )
+	{
+		if( queue.empty() )
+		{
+			if( threadQuit )
+				break;
+			work_cv.wait( lock );
+			continue;
+		}
+		
+		cv::Mat img = std::move( queue.front() );
+		queue.pop_front();
+		++inFlight;
+		bool failed = (bool)err;
+		lock.unlock();
+		space_cv.notify_one();
+		
+		// once ffmpeg has gone wrong, there's no point sending it anything else.
+		std::exception_ptr e;
+		double pipeTime = 0.0;
+		if( !failed )
+		{
+			try
+			{
+				const cv::Mat &out = Prepare( img );
+				auto t0 = std::chrono::steady_clock::now();
+				size_t w = fwrite( out.data, 1, frameBytes, outPipe );
+				pipeTime = std::chrono::duration<double>( std::chrono::steady_clock::now() - t0 ).count();
+				if( w != frameBytes )
+				{
+					throw std::runtime_error("VidWriter: failed writing frame to ffmpeg.");
+				}
+			}
+			catch( ... )
+			{
+				e = std::current_exception();
+			}
+		}
+		
+		// hands the buffer back to the pool.
+		img.release();
+		
+		lock.lock();
+		--inFlight;
+		stats.pipeSeconds += pipeTime;
+		if( e )
+		{
+			if( !err )
+				err = e;
+			space_cv.notify_all();
+		}
+		else if( !failed )
+		{
+			stats.written++;
+		}
+		done_cv.notify_all();
+	}
+}
 
 VidWriter::~VidWriter()
 {
+	// make sure everything gets written, but we can't throw from a destructor.
+	try
+	{
+		Flush();
+	}
+	catch( std::exception &e )
+	{
+		cout << "VidWriter: error while writing: " << e.what() << endl;
+	}
+	
+	{
+		std::unique_lock<std::mutex> lock( mutex );
+		threadQuit = true;
+	}
+	work_cv.notify_all();
+	writerThread.join();
+	
+	// pclose waits for ffmpeg to finish the file.
 	fflush(outPipe);
-	fclose(outPipe);
-// 	delete outPipe;
+	pclose(outPipe);
 }
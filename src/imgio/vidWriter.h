@@ -4,12 +4,37 @@
 //
 // We've previously used our own fight with the ffmpeg API to write a video - but that's
 // too much like hard work.
-// So, instead of that, we're going to try and _pipe_ the data to the ffmpeg command which 
+// So, instead of that, we're going to try and _pipe_ the data to the ffmpeg command which
 // we assume is somewhere on the system.
 //
+// Writing to the pipe blocks whenever ffmpeg is slower than whatever makes the frames,
+// so Write() only puts the frame on a bounded queue, and a writer thread converts it
+// (float images are scaled by 255 to 8 bit, odd sized images are padded to an even size)
+// and sends it to ffmpeg. The caller only waits if the queue is full.
+//
 #include <opencv2/opencv.hpp>
 #include <cstdio>
 
+#include "imgio/loadsave.h"
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <chrono>
+
+struct VidWriterStats
+{
+	unsigned long written;      // frames sent to ffmpeg
+	unsigned long stalls;       // times Write() had to wait for space in the queue
+	double        stallSeconds; // total time Write() spent waiting
+	double        pipeSeconds;  // total time the writer thread spent waiting on ffmpeg
+	double        elapsed;      // seconds since the writer was created
+	unsigned      queued;       // frames currently waiting to be written
+	unsigned      maxQueued;    // the most frames that have been waiting at once
+};
+
 class VidWriter
 {
 public:
@@ -19,29 +44,80 @@ public:
 	//
 	// Bitrate is input as kbps, and 8000 is considered a good place for 1920x1080
 	//
-	VidWriter( std::string filename, std::string   codecStr, cv::Mat typicalImage, int fps, int crf,  std::string pixfmt);
-	VidWriter( std::string filename, std::string encoderStr, cv::Mat typicalImage, int fps );
-	
+	// typicalImage can be CV_8U or CV_32F, with 1 or 3 channels. The video is the size of
+	// typicalImage, rounded up to even numbers.
+	//
+	// maxQueue is how many frames can wait to be written before Write() blocks.
+	//
+	VidWriter( std::string filename, std::string   codecStr, cv::Mat typicalImage, int fps, int crf,  std::string pixfmt, unsigned maxQueue = 8 );
+	VidWriter( std::string filename, std::string encoderStr, cv::Mat typicalImage, int fps, unsigned maxQueue = 8 );
+
 	//
 	// Write the next image to the video file.
+	// By default the image is copied (into a recycled buffer), so the caller is free to
+	// overwrite it as soon as this returns. If the caller will never touch the image data
+	// again, set copy to false to skip the copy.
+	//
+	// If writing to ffmpeg failed, the error is re-thrown from here or Flush().
+	//
+	void Write( cv::Mat img, bool copy = true );
+
+	//
+	// Wait until every frame so far has gone to ffmpeg.
 	//
-	void Write( cv::Mat img );
-	
-	
+	void Flush();
+
 	//
 	// Close the video file
-	// (depracated)
+	// (depracated - now just a Flush())
 	void Finish();
-	
-	
+
+	VidWriterStats GetStats();
+
 	~VidWriter();
-	
+
 protected:
-	
+
+	// the ffmpeg arguments describing the raw input, and sets up frameSize, frameType and frameBytes.
+	std::string InputArgs( cv::Mat typicalImage, int in_fps );
+	void Open( std::string cmd, unsigned in_maxQueue );
+
+	void WriterThread();
+
+	// turn a queued image into what we send to ffmpeg. Only called from the writer thread.
+	const cv::Mat& Prepare( const cv::Mat &img );
+
+	void RethrowError();
+
 	size_t frameBytes;
+	cv::Size frameSize;
+	int frameType;
 	int fnum;
 	int fps;
 	FILE *outPipe;
+
+	// the queue of frames to write.
+	std::deque< cv::Mat > queue;
+	unsigned maxQueue;
+	unsigned inFlight;
+	std::mutex mutex;
+	std::condition_variable work_cv;   // signals the writer thread that there is a frame
+	std::condition_variable space_cv;  // signals Write() that there is space in the queue
+	std::condition_variable done_cv;   // signals Flush() that a frame was written
+	std::thread writerThread;
+	bool threadQuit;
+	std::exception_ptr err;
+
+	// Write() copies into these, so we are not allocating for every frame.
+	ImageBufferPool pool;
+
+	// writer thread's buffers for conversion and padding.
+	cv::Mat converted;
+	cv::Mat padded;
+	cv::Size paddedFrom;
+
+	VidWriterStats stats;
+	std::chrono::steady_clock::time_point startTime;
 };
 
 
@@ -1,11 +1,13 @@
 #include "vidsrc.h"
+#include "commonConfig/commonConfig.h"
 
+#include <chrono>
 #include <iostream>
 using std::cout;
 using std::endl;
 
 
-VideoSource::VideoSource(std::string in_vidPath, std::string in_calPath)
+VideoSource::VideoSource(std::string in_vidPath, std::string in_calPath, int decodeAhead)
 {
 	cout << "Creating video source: " << in_vidPath << endl;
 	cout << "using calib file: " << in_calPath << endl;
@@ -68,16 +70,153 @@ VideoSource::VideoSource(std::string in_vidPath, std::string in_calPath)
 	cout << "video has first frame with index: " << numberOfFirstFrame << endl;
 	cout << "but don't worry, we compensate so that we're 0 indexed!" << endl;
 // 	JumpToFrame(0);	// otherwise we seem to be out of step
+	
+	// OpenCV's frame count is an estimate from the duration and frame rate,
+	// so for files on disk we get the exact count from the keyframe index.
+	numFrames = cvvc.get(cv::CAP_PROP_FRAME_COUNT);
+	if( x == std::string::npos && index.Open( in_vidPath ) )
+	{
+		numFrames = index.NumFrames();
+	}
+	
+	//
+	// Optionally, start a thread to decode frames ahead of us. Consumers that do
+	// a lot of work per frame then don't also have to wait for the decode.
+	//
+	if( decodeAhead < 0 )
+	{
+		CommonConfig ccfg;
+		decodeAhead = ccfg.vidDecodeAhead;
+	}
+	decodeDepth = decodeAhead;
+	decodeIdx   = frameIdx + 1;
+	decodeEOF   = false;
+	threadQuit  = false;
+	
+	stats.decoded       = 0;
+	stats.decodeSeconds = 0.0;
+	stats.advances      = 0;
+	stats.stalls        = 0;
+	stats.stallSeconds  = 0.0;
+	stats.flushes       = 0;
+	stats.queueDepth    = 0;
+	
+	maxDecoders = std::max( 1u, std::thread::hardware_concurrency() );
+	
+	if( decodeDepth > 0 )
+	{
+		decodeThread = std::thread( &VideoSource::DecodeThread, this );
+	}
 }
 
 VideoSource::~VideoSource()
 {
+	if( decodeThread.joinable() )
+	{
+		std::unique_lock<std::mutex> lock( queue_mutex );
+		threadQuit = true;
+		lock.unlock();
+		space_cv.notify_all();
+		decodeThread.join();
+	}
+	
 	if( cvvc.isOpened() )
 		cvvc.release();
 }
 
+void VideoSource::DecodeThread()
+{
+	std::unique_lock<std::mutex> qlock( queue_mutex );
+	while( !threadQuit )
+	{
+		if( frameQueue.size() >= decodeDepth || decodeEOF )
+		{
+			space_cv.wait( qlock );
+			continue;
+		}
+		qlock.unlock();
+		
+		// decode the next frame. We always decode into a new Mat so that 
+		// the frame can be handed over to the consumer without a copy.
+		std::unique_lock<std::mutex> clock( cap_mutex );
+		auto t0 = std::chrono::steady_clock::now();
+		cv::Mat img;
+		bool ok;
+		try
+		{
+			ok = cvvc.grab() && cvvc.retrieve(img);
+		}
+		catch(...)
+		{
+			ok = false;
+		}
+		std::chrono::duration<double> took = std::chrono::steady_clock::now() - t0;
+		unsigned idx = decodeIdx++;
+		
+		// lock order is always capture, then queue.
+		qlock.lock();
+		clock.unlock();
+		
+		if( ok )
+		{
+			frameQueue.push_back( std::make_pair( idx, img ) );
+			stats.decoded       += 1;
+			stats.decodeSeconds += took.count();
+		}
+		else
+		{
+			decodeEOF = true;
+		}
+		ready_cv.notify_all();
+	}
+}
+
+void VideoSource::FlushQueue()
+{
+	// caller must hold the capture mutex, so the decode thread
+	// can't be half way through putting something on the queue.
+	std::unique_lock<std::mutex> qlock( queue_mutex );
+	if( frameQueue.size() > 0 )
+		stats.flushes += 1;
+	frameQueue.clear();
+	decodeEOF = false;
+}
+
+VideoDecodeStats VideoSource::GetDecodeStats()
+{
+	std::unique_lock<std::mutex> qlock( queue_mutex );
+	VideoDecodeStats s = stats;
+	s.queueDepth = frameQueue.size();
+	return s;
+}
+
 bool VideoSource::Advance()
 {
+	if( decodeDepth > 0 )
+	{
+		std::unique_lock<std::mutex> qlock( queue_mutex );
+		if( frameQueue.empty() && !decodeEOF )
+		{
+			stats.stalls += 1;
+			auto t0 = std::chrono::steady_clock::now();
+			while( frameQueue.empty() && !decodeEOF )
+				ready_cv.wait( qlock );
+			std::chrono::duration<double> waited = std::chrono::steady_clock::now() - t0;
+			stats.stallSeconds += waited.count();
+		}
+		
+		if( frameQueue.empty() )
+			return false;
+		
+		// hand over the frame, no copy needed.
+		current  = std::move( frameQueue.front().second );
+		frameIdx = frameQueue.front().first;
+		frameQueue.pop_front();
+		stats.advances += 1;
+		qlock.unlock();
+		space_cv.notify_all();
+		return true;
+	}
 	
 	++frameIdx;
 	cvvc.grab();
@@ -98,35 +237,211 @@ bool VideoSource::Advance()
 
 bool VideoSource::Regress()
 {
+	std::unique_lock<std::mutex> clock( cap_mutex );
+	FlushQueue();
+	
 	if( frameIdx > 0 )
 		--frameIdx;
-	cvvc.set(cv::CAP_PROP_POS_FRAMES, frameIdx);
+	bool ok = Seek( frameIdx );
+	decodeIdx = frameIdx + 1;
 	
+	// decode thread can start again from the new position.
+	clock.unlock();
+	space_cv.notify_all();
+	return ok;
+}
+
+bool VideoSource::JumpToFrame(unsigned frame)
+{
+	std::unique_lock<std::mutex> clock( cap_mutex );
+	
+	// if we're just stepping forward onto a frame we've already decoded,
+	// no need to seek at all.
+	if( decodeDepth > 0 && frame == frameIdx + 1 )
+	{
+		std::unique_lock<std::mutex> qlock( queue_mutex );
+		if( !frameQueue.empty() && frameQueue.front().first == frame )
+		{
+			qlock.unlock();
+			clock.unlock();
+			return Advance();
+		}
+	}
+	
+	FlushQueue();
+	
+	frameIdx = frame;
+	bool ok = Seek( frame );
+	decodeIdx = frameIdx + 1;
+	
+	clock.unlock();
+	space_cv.notify_all();
+	return ok;
+}
+
+bool VideoSource::Seek( unsigned frame )
+{
+	// caller should hold the capture mutex.
+	// We retrieve into a new Mat because someone might still be holding on to current.
+	cv::Mat img;
+	bool exact;
+	if( !SeekCapture( cvvc, frame, img, exact ) )
+		return false;
+	current = img;
+	return true;
+}
+
+bool VideoSource::SeekCapture( cv::VideoCapture &cap, unsigned frame, cv::Mat &img, bool &exact )
+{
+	exact = false;
+	if( index.IsValid() )
+	{
+		if( frame >= index.NumFrames() )
+			return false;
+		
+		//
+		// Seek to the keyframe before the frame we want and find out where we really are
+		// from the frame timestamp. Then decode forward to the exact frame. If the seek 
+		// lands us after the frame we want, try again from an earlier keyframe.
+		//
+		unsigned kf = index.KeyframeAtOrBefore( frame );
+		while( true )
+		{
+			cap.set(cv::CAP_PROP_POS_FRAMES, kf + numberOfFirstFrame);
+			int at = index.FrameAtTime( cap.get(cv::CAP_PROP_POS_MSEC) );
+			if( at >= 0 && at <= (int)frame )
+			{
+				while( at >= 0 && at < (int)frame )
+				{
+					if( !cap.grab() )
+						return false;
+					at = index.FrameAtTime( cap.get(cv::CAP_PROP_POS_MSEC) );
+				}
+				
+				if( at == (int)frame )
+				{
+					try
+					{
+						if( !cap.retrieve(img) )
+							return false;
+					}
+					catch(...)
+					{
+						return false;
+					}
+					exact = true;
+					return true;
+				}
+			}
+			
+			if( kf == 0 )
+				break;
+			kf = index.PreviousKeyframe( kf );
+		}
+		cout << "VideoSource: couldn't seek exactly to frame " << frame << " of " << vidPath << ", seek may be approximate." << endl;
+	}
+	
+	// It seems like the capture frames might be indexed from 1. Very annoying to find this out quite so many years later!
+	cap.set(cv::CAP_PROP_POS_FRAMES, frame + numberOfFirstFrame);
 	try
 	{
-		return cvvc.retrieve(current);
+		if( !cap.retrieve(img) )
+			return false;
 	}
 	catch(...)
 	{
 		return false;
 	}
+	return true;
 }
 
-bool VideoSource::JumpToFrame(unsigned frame)
+cv::Mat VideoSource::GetFrame( unsigned frame )
 {
-	// It seems like the capture frames might be indexed from 1. Very annoying to find this out quite so many years later!
-	cvvc.set(cv::CAP_PROP_POS_FRAMES, frame + numberOfFirstFrame);
-	frameIdx = frame;
+	if( vidPath.find(":") != std::string::npos || ( numFrames >= 0 && (int)frame >= numFrames ) )
+		return cv::Mat();
 	
+	// can decoder d get to frame by just decoding forward?
+	auto isNear = [&]( FrameDecoder &d )
+	{
+		return index.IsValid() && d.next >= (int)index.KeyframeAtOrBefore( frame ) && d.next <= (int)frame;
+	};
 	
+	//
+	// Borrow a decoder: the idle one that is closest behind the frame in the same GOP,
+	// otherwise any idle one, otherwise a new one if we're allowed.
+	//
+	std::unique_lock<std::mutex> lock( decoders_mutex );
+	FrameDecoder *dec = NULL;
+	while( !dec )
+	{
+		for( unsigned dc = 0; dc < decoders.size(); ++dc )
+		{
+			FrameDecoder *d = decoders[dc].get();
+			if( d->busy )
+				continue;
+			if( !dec || ( isNear( *d ) && ( !isNear( *dec ) || d->next > dec->next ) ) )
+				dec = d;
+		}
+		
+		if( !dec && decoders.size() < maxDecoders )
+		{
+			decoders.push_back( std::unique_ptr< FrameDecoder >( new FrameDecoder ) );
+			dec = decoders.back().get();
+			dec->next = -1;
+		}
+		
+		if( !dec )
+			decoders_cv.wait( lock );
+	}
+	dec->busy = true;
+	lock.unlock();
+	
+	cv::Mat img;
+	bool ok = false;
+	std::exception_ptr err;
 	try
 	{
-		return cvvc.retrieve(current);
+		if( !dec->cap.isOpened() && !dec->cap.open( vidPath ) )
+		{
+			throw std::runtime_error("Could not open video source: " + vidPath );
+		}
+		
+		int at = -1;
+		if( isNear( *dec ) )
+		{
+			// decode forward, checking where we are from the timestamps as Seek does.
+			at = dec->next - 1;
+			while( at >= 0 && at < (int)frame && dec->cap.grab() )
+				at = index.FrameAtTime( dec->cap.get(cv::CAP_PROP_POS_MSEC) );
+		}
+		
+		bool exact = false;
+		if( at == (int)frame )
+		{
+			ok = exact = dec->cap.retrieve( img );
+		}
+		else
+		{
+			ok = SeekCapture( dec->cap, frame, img, exact );
+		}
+		dec->next = exact ? frame + 1 : -1;
 	}
 	catch(...)
 	{
-		return false;
+		err = std::current_exception();
+		dec->next = -1;
 	}
+	
+	lock.lock();
+	dec->busy = false;
+	lock.unlock();
+	decoders_cv.notify_one();
+	
+	if( err )
+		std::rethrow_exception( err );
+	if( !ok )
+		return cv::Mat();
+	return img;
 }
 
 cv::Mat VideoSource::GetCurrent()
@@ -2,12 +2,33 @@
 #define ME_VIDEO_SOURCE
 
 #include "imgio/imagesource.h"
+#include "imgio/vidIndex.h"
+
+#include <deque>
+#include <memory>
+
+// statistics on the decode-ahead thread of a VideoSource.
+struct VideoDecodeStats
+{
+	unsigned long decoded;       // frames decoded by the background thread.
+	double        decodeSeconds; // time spent decoding those frames.
+	unsigned long advances;      // calls to Advance() served from the queue.
+	unsigned long stalls;        // ... of which had to wait for the decoder.
+	double        stallSeconds;  // total time spent waiting.
+	unsigned long flushes;       // times the queue was thrown away by a seek.
+	size_t        queueDepth;    // frames currently waiting in the queue.
+};
 
 // the most basic image source is a directory of images.
-class VideoSource : public ImageSource
+class VideoSource : public ImageSource, public FrameProvider
 {
 public:
-	VideoSource( std::string in_vidPath, std::string in_calPath);
+	//
+	// decodeAhead is the number of frames to decode ahead of the current frame on
+	// a background thread. 0 means decode on the caller's thread when Advance() is called,
+	// and a negative value means use the value in the user's CommonConfig.
+	//
+	VideoSource( std::string in_vidPath, std::string in_calPath, int decodeAhead = -1 );
 	virtual ~VideoSource();
 
 
@@ -24,11 +45,13 @@ public:
 	
 	virtual bool JumpToFrame(unsigned frame);
 
+	// 0 indexed, the same as JumpToFrame() and every other source. This used to be 
+	// OpenCV's CAP_PROP_POS_FRAMES, which is the number of the next frame, so was one more
+	// than it should be. We count frames ourselves because when decoding ahead the capture
+	// is somewhere in the future anyway.
 	virtual unsigned  GetCurrentFrameID()
 	{
-		// OpenCV says the CAP_PROP_POS_FRAMES is
-		// the number of the next frame, hence -1
-		return cvvc.get(cv::CAP_PROP_POS_FRAMES);
+		return frameIdx;
 	}
 	virtual frameTime_t GetCurrentFrameTime()
 	{
@@ -41,7 +64,7 @@ public:
 	// return a negative value.
 	virtual int GetNumImages()
 	{
-		return cvvc.get(cv::CAP_PROP_FRAME_COUNT);	// negative signals we don't know
+		return numFrames;	// negative signals we don't know
 	}
 
 	Calibration& GetCalibration()
@@ -73,11 +96,61 @@ public:
 	{
 		calibration.Write(calPath);
 	}
-
+	
+	VideoDecodeStats GetDecodeStats();
+	
+	//
+	// Decode any frame of a video file without moving the current frame. Each call borrows
+	// one of a pool of extra decoders (up to one per core), preferring one that is already
+	// earlier in the same GOP so it only has to decode forward rather than seek. Frames are
+	// only exact if we have the keyframe index. Live sources always give an empty image.
+	//
+	cv::Mat GetFrame( unsigned frame );
 
 
 private:
 	cv::VideoCapture cvvc;
+	std::mutex cap_mutex;       // held by whoever is using cvvc
+	int numFrames;
+	
+	// keyframe index so that we can seek to exact frames.
+	VideoIndex index;
+	bool Seek( unsigned frame );
+	
+	// seek any capture of our video to frame and retrieve it. exact is false if
+	// we had to fall back on OpenCV's seek and can't be sure where we are.
+	bool SeekCapture( cv::VideoCapture &cap, unsigned frame, cv::Mat &img, bool &exact );
+	
+	//
+	// decoders for GetFrame().
+	//
+	struct FrameDecoder
+	{
+		cv::VideoCapture cap;
+		int next;           // frame that the next grab() gives us, -1 if we don't know.
+		bool busy;
+	};
+	std::vector< std::unique_ptr< FrameDecoder > > decoders;
+	unsigned maxDecoders;
+	std::mutex decoders_mutex;
+	std::condition_variable decoders_cv;  // tells GetFrame() a decoder is free
+	
+	//
+	// decode-ahead.
+	//
+	void DecodeThread();
+	void FlushQueue();
+	
+	unsigned decodeDepth;
+	unsigned decodeIdx;          // index of the next frame the decode thread will get.
+	bool decodeEOF;
+	std::deque< std::pair< unsigned, cv::Mat > > frameQueue;
+	std::mutex queue_mutex;
+	std::condition_variable space_cv;  // tells the decode thread there is room in the queue
+	std::condition_variable ready_cv;  // tells Advance() there is a frame in the queue
+	std::thread decodeThread;
+	bool threadQuit;
+	VideoDecodeStats stats;
 
 	bool currentReady;
 	cv::Mat current;
@@ -32,6 +32,11 @@ typedef Eigen::Matrix< std::complex<float>, Eigen::Dynamic, Eigen::Dynamic> cfMa
 typedef Eigen::Matrix<float,4,1> hVec3D;
 typedef Eigen::Matrix<float,3,1> hVec2D;
 
+// batches of (non-homogeneous) points, one point per column. These are row major, so all
+// the x's are together, then all the y's etc. (structure of arrays), which suits SIMD.
+typedef Eigen::Matrix<float, 2, Eigen::Dynamic, Eigen::RowMajor> pointArray2D;
+typedef Eigen::Matrix<float, 3, Eigen::Dynamic, Eigen::RowMajor> pointArray3D;
+
 
 
 struct Rect
@@ -0,0 +1,118 @@
+#include "imgio/loadsave.h"
+#include "imgio/imgDecoders.h"
+
+#include <iostream>
+#include <random>
+using std::cout;
+using std::endl;
+
+//
+// Check that raw Bayer .charImg files come back as they should for each pattern:
+//  - full resolution is the same as OpenCV demosaicing the mosaic,
+//  - half resolution gives back the colour of each 2x2 block exactly, for an
+//    image made of 2x2 blocks of one colour,
+//  - grey gives one channel images of the right size,
+//  - scaling and cropping give the same size images as any other file.
+//
+
+cv::Mat MakeBlockImage( int rows, int cols, std::mt19937 &rng )
+{
+	std::uniform_int_distribution<int> col( 0, 255 );
+	cv::Mat img( rows, cols, CV_8UC3 );
+	for( int r = 0; r < rows; r += 2 )
+	{
+		for( int c = 0; c < cols; c += 2 )
+		{
+			cv::Vec3b v( col(rng), col(rng), col(rng) );
+			img.at<cv::Vec3b>( r,   c ) = v;
+			img.at<cv::Vec3b>( r,   c+1 ) = v;
+			img.at<cv::Vec3b>( r+1, c ) = v;
+			img.at<cv::Vec3b>( r+1, c+1 ) = v;
+		}
+	}
+	return img;
+}
+
+bool Same( const cv::Mat &a, const cv::Mat &b )
+{
+	return a.size() == b.size() && a.type() == b.type() && cv::norm( a, b, cv::NORM_INF ) == 0;
+}
+
+int main( int argc, char *argv[] )
+{
+	std::string dir = "/tmp";
+	if( argc == 2 )
+		dir = argv[1];
+	std::string fn = dir + "/bayerRoundTrip.charImg";
+
+	std::mt19937 rng(1234);
+	int fails = 0;
+	auto check = [&]( bool ok, std::string what )
+	{
+		if( !ok )
+		{
+			cout << "FAIL: " << what << endl;
+			++fails;
+		}
+	};
+
+	cv::Mat bgr = MakeBlockImage( 480, 640, rng );
+	for( int p = BAYER_RGGB; p <= BAYER_GBRG; ++p )
+	{
+		bayerPattern_t pattern = (bayerPattern_t)p;
+		std::string name = BayerPatternName( pattern );
+
+		cv::Mat raw;
+		MosaicBayer( bgr, pattern, raw );
+
+		for( std::string codec : { "snappy", "none" } )
+		{
+			std::string what = name + " " + codec;
+			SaveBayerImage( raw, fn, pattern, ParseImgCodec( codec ) );
+
+			// full resolution
+			cv::Mat full = LoadImage( fn );
+			LoadImageOptions opts;
+			cv::Mat ref;
+			DecodeBayer( raw, pattern, ref, opts, NULL );
+			check( full.type() == CV_8UC3 && Same( full, ref ), what + " full resolution" );
+
+			// half resolution should be exactly the block colours.
+			opts.scaleDenom = 2;
+			cv::Mat half = LoadImage( fn, opts ), refHalf;
+			cv::resize( bgr, refHalf, cv::Size( bgr.cols/2, bgr.rows/2 ), 0, 0, cv::INTER_NEAREST );
+			check( Same( half, refHalf ), what + " half resolution" );
+
+			// grey, both sizes.
+			opts.bayerGray = true;
+			cv::Mat grayHalf = LoadImage( fn, opts );
+			check( grayHalf.type() == CV_8UC1 && grayHalf.size() == half.size(), what + " half resolution grey" );
+			opts.scaleDenom = 1;
+			cv::Mat gray = LoadImage( fn, opts );
+			check( gray.type() == CV_8UC1 && gray.size() == raw.size(), what + " grey" );
+
+			// scale and crop - the sizes have to match what OutputRect says.
+			opts.bayerGray = false;
+			for( int d : { 1, 2, 4, 8 } )
+			{
+				opts.scaleDenom = d;
+				opts.roi = cv::Rect( 33, 17, 301, 203 );
+				cv::Mat part = LoadImage( fn, opts );
+				cv::Rect o = opts.OutputRect( raw.cols, raw.rows );
+				check( part.type() == CV_8UC3 && part.size() == o.size(), what + " crop at 1/" + std::to_string(d) );
+
+				// at full resolution, the crop should be exactly that part of the whole image.
+				if( d == 1 )
+					check( Same( part, full( o ) ), what + " crop matches whole image" );
+			}
+		}
+	}
+
+	if( fails > 0 )
+	{
+		cout << fails << " checks failed." << endl;
+		return 1;
+	}
+	cout << "all Bayer round trips ok." << endl;
+	return 0;
+}
@@ -0,0 +1,130 @@
+#include "calib/calibration.h"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+using std::cout;
+using std::endl;
+
+//
+// Points per second for projecting and unprojecting one point at a time, against the
+// batched (structure of arrays, OpenMP) versions, and the biggest difference between the two.
+// Give it a calibration file, or it will use a made up 1920x1080 camera with a fair bit
+// of lens distortion.
+//
+int main( int argc, char *argv[] )
+{
+	Calibration calib;
+	if( argc >= 2 )
+	{
+		if( !calib.Read( argv[1] ) )
+		{
+			cout << "could not read calibration: " << argv[1] << endl;
+			return 1;
+		}
+	}
+	else
+	{
+		cout << "usage: " << argv[0] << " [calib file] [num points]" << endl;
+		cout << "  no calibration given, using a synthetic one." << endl;
+		calib.width  = 1920;
+		calib.height = 1080;
+		calib.K << 1400, 0, 960,
+		           0, 1400, 540,
+		           0,    0,   1;
+		calib.L = transMatrix3D::Identity();
+		calib.L(0,3) = 100.0f;
+		calib.L(2,3) = 3000.0f;
+		calib.distParams = { -0.25f, 0.08f, 0.001f, -0.0005f, 0.0f };
+	}
+
+	int n = 2000000;
+	if( argc >= 3 )
+		n = atoi( argv[2] );
+
+	// random points, all of which land in the image.
+	std::mt19937 rng( 1234 );
+	std::uniform_real_distribution<float> ux( 0, calib.width ), uy( 0, calib.height ), ud( 1000.0f, 5000.0f );
+	pointArray2D pixels( 2, n );
+	for( int pc = 0; pc < n; ++pc )
+	{
+		pixels(0,pc) = ux( rng );
+		pixels(1,pc) = uy( rng );
+	}
+
+	// unproject them to some distance, which gives us world points to project.
+	hVec3D cc = calib.GetCameraCentre();
+	pointArray3D world( 3, n );
+	for( int pc = 0; pc < n; ++pc )
+	{
+		hVec2D p; p << pixels(0,pc), pixels(1,pc), 1.0f;
+		hVec3D w = cc + calib.Unproject( p ) * ud( rng );
+		world.col(pc) = w.head(3);
+	}
+
+	auto rate = []( int n, std::chrono::steady_clock::time_point t0, std::chrono::steady_clock::time_point t1 )
+	{
+		return n / std::chrono::duration<double>( t1 - t0 ).count();
+	};
+
+	cout << std::setw(20) << "" << std::setw(16) << "single pts/s" << std::setw(16) << "batch pts/s" << std::setw(14) << "max diff" << endl;
+
+	// project.
+	{
+		pointArray2D single( 2, n ), batch;
+		auto t0 = std::chrono::steady_clock::now();
+		for( int pc = 0; pc < n; ++pc )
+		{
+			hVec3D w; w << world(0,pc), world(1,pc), world(2,pc), 1.0f;
+			hVec2D p = calib.Project( w );
+			single(0,pc) = p(0);
+			single(1,pc) = p(1);
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		calib.Project( world, batch );
+		auto t2 = std::chrono::steady_clock::now();
+
+		cout << std::setw(20) << "Project" << std::setw(16) << rate(n,t0,t1) << std::setw(16) << rate(n,t1,t2)
+		     << std::setw(14) << ( single - batch ).cwiseAbs().maxCoeff() << endl;
+	}
+
+	// unproject.
+	{
+		pointArray3D single( 3, n ), batch;
+		auto t0 = std::chrono::steady_clock::now();
+		for( int pc = 0; pc < n; ++pc )
+		{
+			hVec2D p; p << pixels(0,pc), pixels(1,pc), 1.0f;
+			hVec3D r = calib.Unproject( p );
+			single.col(pc) = r.head(3);
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		calib.Unproject( pixels, batch );
+		auto t2 = std::chrono::steady_clock::now();
+
+		cout << std::setw(20) << "Unproject" << std::setw(16) << rate(n,t0,t1) << std::setw(16) << rate(n,t1,t2)
+		     << std::setw(14) << ( single - batch ).cwiseAbs().maxCoeff() << endl;
+	}
+
+	// undistort.
+	{
+		pointArray2D single( 2, n ), batch;
+		auto t0 = std::chrono::steady_clock::now();
+		for( int pc = 0; pc < n; ++pc )
+		{
+			hVec2D p; p << pixels(0,pc), pixels(1,pc), 1.0f;
+			hVec2D u = calib.UndistortPoint( p );
+			single(0,pc) = u(0);
+			single(1,pc) = u(1);
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		calib.UndistortPoints( pixels, batch );
+		auto t2 = std::chrono::steady_clock::now();
+
+		cout << std::setw(20) << "UndistortPoint" << std::setw(16) << rate(n,t0,t1) << std::setw(16) << rate(n,t1,t2)
+		     << std::setw(14) << ( single - batch ).cwiseAbs().maxCoeff() << endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include "imgio/dirManifest.h"
+
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <thread>
+using std::cout;
+using std::endl;
+
+//
+// Check that a directory listing from the manifest matches a real listing,
+// and that adding or removing a file makes us list the directory again.
+//
+
+bool Same( const std::vector< DirManifestEntry > &a, const std::vector< DirManifestEntry > &b )
+{
+	if( a.size() != b.size() )
+		return false;
+	for( unsigned ec = 0; ec < a.size(); ++ec )
+	{
+		if( a[ec].name != b[ec].name || a[ec].size != b[ec].size || a[ec].mtime != b[ec].mtime )
+			return false;
+	}
+	return true;
+}
+
+void Touch( std::string fn, int bytes )
+{
+	std::ofstream outfi( fn );
+	outfi << std::string( bytes, 'x' );
+}
+
+int main( int argc, char *argv[] )
+{
+	std::string dir = "/tmp/dirManifestTest";
+	if( argc == 2 )
+		dir = argv[1];
+
+	boost::filesystem::remove_all( dir );
+	boost::filesystem::create_directories( dir + "/subdir" );
+	for( int fc = 0; fc < 1000; ++fc )
+	{
+		char fn[64];
+		snprintf( fn, 64, "/img_%06d.jpg", fc );
+		Touch( dir + fn, fc % 17 );
+	}
+	Touch( dir + "/a name with spaces.png", 3 );
+
+	// a freshly changed directory doesn't get a manifest, so wait a bit.
+	std::this_thread::sleep_for( std::chrono::seconds(3) );
+
+	int fails = 0;
+	auto check = [&]( std::string what )
+	{
+		auto scanned = ListDirectory( dir, false );
+		auto listed  = ListDirectory( dir );
+		if( !Same( scanned, listed ) )
+		{
+			cout << "FAIL: " << what << ": listing from manifest does not match the directory." << endl;
+			++fails;
+		}
+		return scanned.size();
+	};
+
+	size_t n = check( "first listing" );
+	if( n != 1001 )
+	{
+		cout << "FAIL: expected 1001 files (no sub-directories, no manifest), got " << n << endl;
+		++fails;
+	}
+	if( !boost::filesystem::exists( dir + "/.mcdev_manifest" ) )
+	{
+		cout << "FAIL: no manifest was written." << endl;
+		++fails;
+	}
+	check( "second listing" );
+
+	// add a file.
+	Touch( dir + "/img_999999.jpg", 5 );
+	std::this_thread::sleep_for( std::chrono::seconds(3) );
+	if( check( "after adding a file" ) != 1002 )
+	{
+		cout << "FAIL: new file was missed." << endl;
+		++fails;
+	}
+	check( "after adding a file, again" );
+
+	// and remove one.
+	boost::filesystem::remove( dir + "/img_000000.jpg" );
+	if( check( "after removing a file" ) != 1001 )
+	{
+		cout << "FAIL: removed file still listed." << endl;
+		++fails;
+	}
+
+	// parallel preparation of several directories.
+	std::vector< std::string > dirs( 8, dir );
+	PrepareDirectoryManifests( dirs );
+	check( "after PrepareDirectoryManifests" );
+
+	boost::filesystem::remove_all( dir );
+
+	if( fails > 0 )
+	{
+		cout << fails << " checks failed." << endl;
+		return 1;
+	}
+	cout << "all checks ok." << endl;
+	return 0;
+}
@@ -0,0 +1,110 @@
+#include "imgio/loadsave.h"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+using std::cout;
+using std::endl;
+
+//
+// Throughput of the shuffle / delta filters, and what they do for the compression
+// ratio and speed of each codec, on a float image. Give it a .floatImg (a depth map
+// or optical flow for example) or it will make up a smooth synthetic one.
+//
+int main( int argc, char *argv[] )
+{
+	cv::Mat img;
+	if( argc >= 2 )
+	{
+		img = LoadImage( argv[1] );
+		if( img.depth() != CV_32F )
+		{
+			cout << "need a float image." << endl;
+			return 1;
+		}
+		if( !img.isContinuous() )
+			img = img.clone();
+	}
+	else
+	{
+		cout << "usage: " << argv[0] << " [float image] [repeats]" << endl;
+		cout << "  no image given, using a synthetic 1920x1080 depth map." << endl;
+		img = cv::Mat( 1080, 1920, CV_32FC1 );
+		for( int r = 0; r < img.rows; ++r )
+			for( int c = 0; c < img.cols; ++c )
+				img.at<float>(r,c) = 2000.0f + 1.7f*r + 0.3f*c + 50.0f*sin( c / 100.0f );
+	}
+
+	int repeats = 20;
+	if( argc >= 3 )
+		repeats = atoi( argv[2] );
+
+	size_t len = img.total() * img.elemSize();
+	double mb = repeats * len / (1024.0 * 1024.0);
+	unsigned channels = img.channels();
+
+	// raw filter throughput.
+	std::vector<char> filtered( len ), unfiltered( len );
+	cout << std::setw(16) << "filter" << std::setw(14) << "enc MB/s" << std::setw(14) << "dec MB/s" << endl;
+	for( imgFilter_t f : { IMGFILTER_SHUFFLE, IMGFILTER_DELTA } )
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		for( int rc = 0; rc < repeats; ++rc )
+			ImgFilterEncode( f, (char*)img.data, filtered.data(), img.rows, img.cols * channels, channels );
+		auto t1 = std::chrono::steady_clock::now();
+		for( int rc = 0; rc < repeats; ++rc )
+			ImgFilterDecode( f, filtered.data(), unfiltered.data(), img.rows, img.cols * channels, channels );
+		auto t2 = std::chrono::steady_clock::now();
+
+		if( memcmp( unfiltered.data(), img.data, len ) != 0 )
+		{
+			cout << "filter round trip failed!" << endl;
+			return 1;
+		}
+
+		cout << std::setw(16) << (f == IMGFILTER_SHUFFLE ? "shuffle" : "delta")
+		     << std::setw(14) << mb / std::chrono::duration<double>( t1 - t0 ).count()
+		     << std::setw(14) << mb / std::chrono::duration<double>( t2 - t1 ).count() << endl;
+	}
+	cout << endl;
+
+	// filter + codec.
+	std::vector< std::string > codecs = { "snappy", "snappy+shuffle", "snappy+delta" };
+	for( std::string c : { "lz4", "zstd:3" } )
+	{
+		if( ImgCodecAvailable( ParseImgCodec(c).codec ) )
+		{
+			codecs.push_back( c );
+			codecs.push_back( c + "+shuffle" );
+			codecs.push_back( c + "+delta" );
+		}
+	}
+
+	std::vector<char> compressed;
+	cout << std::setw(16) << "codec" << std::setw(10) << "ratio" << std::setw(14) << "enc MB/s" << std::setw(14) << "dec MB/s" << endl;
+	for( unsigned cc = 0; cc < codecs.size(); ++cc )
+	{
+		ImgCodecOptions opts = ParseImgCodec( codecs[cc] );
+		size_t s = 0;
+		auto t0 = std::chrono::steady_clock::now();
+		for( int rc = 0; rc < repeats; ++rc )
+			s = ImgEncodePayload( opts, (char*)img.data, img.rows, img.cols * channels, channels, sizeof(float), compressed );
+		auto t1 = std::chrono::steady_clock::now();
+		for( int rc = 0; rc < repeats; ++rc )
+			ImgDecodePayload( opts.codec, opts.filter, compressed.data(), s, unfiltered.data(), img.rows, img.cols * channels, channels, sizeof(float) );
+		auto t2 = std::chrono::steady_clock::now();
+
+		if( memcmp( unfiltered.data(), img.data, len ) != 0 )
+		{
+			cout << codecs[cc] << " round trip failed!" << endl;
+			return 1;
+		}
+
+		cout << std::setw(16) << codecs[cc]
+		     << std::setw(10) << std::setprecision(3) << (double)len / s
+		     << std::setw(14) << std::setprecision(5) << mb / std::chrono::duration<double>( t1 - t0 ).count()
+		     << std::setw(14) << std::setprecision(5) << mb / std::chrono::duration<double>( t2 - t1 ).count() << endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include "imgio/sourceFactory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+// a cheap checksum of an image, so we don't need to keep all the frames.
+static uint64_t Checksum( cv::Mat img )
+{
+	uint64_t h = 14695981039346656037ull;
+	if( img.empty() )
+		return h;
+	cv::Mat c = img.isContinuous() ? img : img.clone();
+	const unsigned char *p = c.data;
+	size_t n = c.total() * c.elemSize();
+	for( size_t i = 0; i < n; ++i )
+	{
+		h = ( h ^ p[i] ) * 1099511628211ull;
+	}
+	return h;
+}
+
+int main(int argc, char *argv[] )
+{
+	if( argc < 2 || argc > 4 )
+	{
+		cout << "test tool to check that getting frames from many threads at once (FrameProvider::GetFrame)" << endl;
+		cout << "gives the same images as stepping through the source with Advance()." << endl;
+		cout << "The threads ask for the frames in a random order, which is the hardest case for videos." << endl;
+		cout << endl;
+		cout << "Usage: " << endl;
+		cout << argv[0] << " <input source> [num threads] [max frames]" << endl;
+		cout << endl;
+		exit(0);
+	}
+
+	unsigned numThreads = std::thread::hardware_concurrency();
+	if( argc > 2 )
+		numThreads = std::max( 1, atoi( argv[2] ) );
+
+	unsigned maxFrames = 500;
+	if( argc > 3 )
+		maxFrames = atoi( argv[3] );
+
+	auto sp = CreateSource( argv[1] );
+	if( !sp.frames )
+	{
+		cout << argv[1] << " can't give frames to many threads." << endl;
+		return 1;
+	}
+
+	// the reference: step through the source in the usual way.
+	std::vector< unsigned > ids;
+	std::vector< uint64_t > sums;
+	bool done = false;
+	while( !done && ids.size() < maxFrames )
+	{
+		ids.push_back( sp.source->GetCurrentFrameID() );
+		sums.push_back( Checksum( sp.source->GetCurrent() ) );
+		done = !sp.source->Advance();
+	}
+	cout << "read " << ids.size() << " frames with Advance()" << endl;
+
+	std::vector< unsigned > order( ids.size() );
+	for( unsigned fc = 0; fc < order.size(); ++fc )
+		order[fc] = fc;
+	std::mt19937 g( 1234 );
+	std::shuffle( order.begin(), order.end(), g );
+
+	std::atomic<unsigned> next(0), bad(0);
+	auto worker = [&]()
+	{
+		unsigned i;
+		while( ( i = next++ ) < order.size() )
+		{
+			unsigned fc = order[i];
+			if( Checksum( sp.frames->GetFrame( ids[fc] ) ) != sums[fc] )
+			{
+				cout << "frame " << ids[fc] << " is different from GetFrame()" << endl;
+				++bad;
+			}
+		}
+	};
+
+	auto t0 = std::chrono::steady_clock::now();
+	std::vector< std::thread > threads;
+	for( unsigned tc = 0; tc < numThreads; ++tc )
+		threads.push_back( std::thread( worker ) );
+	for( unsigned tc = 0; tc < numThreads; ++tc )
+		threads[tc].join();
+	double secs = std::chrono::duration<double>( std::chrono::steady_clock::now() - t0 ).count();
+
+	cout << "got " << ids.size() << " frames with " << numThreads << " threads in " << secs << "s" << endl;
+	if( bad > 0 )
+	{
+		cout << bad << " frames did not match!" << endl;
+		return 1;
+	}
+	cout << "all frames match." << endl;
+	return 0;
+}
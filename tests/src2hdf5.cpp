@@ -2,35 +2,144 @@
 
 #include "imgio/sourceFactory.h"
 #include "imgio/hdf5source.h"
+#include "imgio/imgDecoders.h"
 
 int main(int argc, char *argv[] )
 {
-	if( argc != 3 )
+	HDF5WriterOptions opts;
+	bool toFloat = false;
+	bool badArgs = argc < 3;
+	for( int ac = 3; ac < argc && !badArgs; ++ac )
+	{
+		std::string arg( argv[ac] );
+		if( arg == "--stack" )
+			opts.stacked = true;
+		else if( arg == "--lz4" )
+			opts.lz4 = true;
+		else if( arg == "--deflate" && ac + 1 < argc )
+			opts.deflate = atoi( argv[++ac] );
+		else if( arg == "--queue" && ac + 1 < argc )
+		{
+			opts.queueLength = atoi( argv[++ac] );
+			opts.printStats  = true;
+		}
+		else if( arg == "--drop" && ac + 1 < argc )
+		{
+			std::string p( argv[++ac] );
+			if( p == "oldest" )
+				opts.whenFull = HDF5WriterOptions::DROP_OLDEST;
+			else if( p == "newest" )
+				opts.whenFull = HDF5WriterOptions::DROP_NEWEST;
+			else
+				badArgs = true;
+		}
+		else if( arg == "--flush" && ac + 1 < argc )
+			opts.flushInterval = atof( argv[++ac] );
+		else if( arg == "--bayer" && ac + 1 < argc )
+			opts.bayer = ParseBayerPattern( argv[++ac] );
+		else if( arg == "--float" )
+			toFloat = true;
+		else
+			badArgs = true;
+	}
+	if( toFloat && opts.bayer != BAYER_NONE )
+		badArgs = true;
+	
+	if( badArgs )
 	{
 		cout << "test tool to take in an image source and write the images ito an hdf5 file" << endl;
 		cout << "The main aim is to test writing images, especially raw images, such as from" << endl;
 		cout << "a live camera grabber, into an hdf5 file instead of thousands of small files" << endl;
 		cout << endl;
 		cout << "Usage: " << endl;
-		cout << argv[0] << " <input source> <output file> " << endl;
+		cout << argv[0] << " <input source> <output file> [--stack] [--deflate <1-9>] [--lz4] [--queue <n>] [--drop <oldest|newest>] [--flush <seconds>] [--bayer <pattern>] [--float]" << endl;
+		cout << endl;
+		cout << "  --stack      : put all the frames in one chunked N x H x W x C dataset, " << endl;
+		cout << "                 rather than a dataset per frame. Frames must all be the same size." << endl;
+		cout << "  --deflate    : gzip the stacked frames at this level." << endl;
+		cout << "  --lz4        : compress the stacked frames with the LZ4 filter plugin, if it is available." << endl;
+		cout << "  --queue      : write on a separate thread, with up to n images waiting, and print counters every second." << endl;
+		cout << "  --drop       : when the queue is full, drop the oldest or newest image rather than waiting." << endl;
+		cout << "  --flush      : flush the file at least this often." << endl;
+		cout << "  --bayer      : store raw Bayer images with this pattern (rggb, bggr, grbg or gbrg). Colour" << endl;
+		cout << "                 input images are turned back into the mosaic a camera would have given." << endl;
+		cout << "  --float      : write the images as floats in [0,1], then read the file back and check" << endl;
+		cout << "                 that every image matches what was written. Can't be used with --bayer." << endl;
 		cout << endl;
 		exit(0);
 	}
 	
 	auto sp = CreateSource( argv[1] );
 	
-	HDF5ImageWriter writer( argv[2] );
+	{
+		HDF5ImageWriter writer( argv[2], opts );
+		
+		bool done = false;
+		cv::Mat img;
+		while( !done )
+		{
+			img = sp.source->GetCurrent();
+			if( opts.bayer != BAYER_NONE && img.channels() == 3 )
+			{
+				cv::Mat raw;
+				MosaicBayer( img, opts.bayer, raw );
+				img = raw;
+			}
+			if( toFloat )
+			{
+				cv::Mat f;
+				img.convertTo( f, CV_32F, 1.0/255.0 );
+				img = f;
+			}
+			
+			writer.AddImage( img, sp.source->GetCurrentFrameID() );
+			
+			done = !sp.source->Advance();
+		}
+		
+		writer.Flush();
+		HDF5WriterStats stats = writer.GetStats();
+		cout << "wrote " << stats.written << " of " << stats.added << " images, dropped " << stats.dropped << endl;
+	}
+	
+	if( !toFloat )
+		return 0;
 	
+	// read it all back, and compare to the input again.
+	auto in = CreateSource( argv[1] );
+	HDF5Source h5( argv[2], "none" );
+	unsigned checked = 0, bad = 0;
 	bool done = false;
-	cv::Mat img;
 	while( !done )
 	{
-		img = sp.source->GetCurrent();
-		
-		writer.AddImage( img, sp.source->GetCurrentFrameID() );
+		cv::Mat f;
+		in.source->GetCurrent().convertTo( f, CV_32F, 1.0/255.0 );
+		cv::Mat r = h5.GetCurrent();
+		if( r.type() != f.type() || r.size() != f.size() || cv::norm( f, r, cv::NORM_INF ) > 0 )
+		{
+			if( bad < 10 )
+				cout << "frame " << in.source->GetCurrentFrameID() << " read back from the hdf5 file isn't the frame written." << endl;
+			++bad;
+		}
+		++checked;
 		
-		done = !sp.source->Advance();
+		bool a = in.source->Advance();
+		bool b = h5.Advance();
+		if( a != b )
+		{
+			cout << "FAIL: the hdf5 file doesn't have the same number of frames as the input." << endl;
+			return 1;
+		}
+		done = !a;
+	}
+	
+	if( bad > 0 )
+	{
+		cout << "FAIL: " << bad << " of " << checked << " float images didn't survive the round trip." << endl;
+		return 1;
 	}
+	cout << "all " << checked << " float images read back correctly." << endl;
+	return 0;
 }
 
 #else
@@ -0,0 +1,49 @@
+#include "imgio/sourceFactory.h"
+#include "imgio/imgSeq.h"
+
+int main(int argc, char *argv[] )
+{
+	if( argc != 3 )
+	{
+		cout << "test tool to take in an image source and write the images into a single .imgSeq file" << endl;
+		cout << "If the output file already exists, the images are appended to it." << endl;
+		cout << "The .imgSeq file can then be used as an image source itself, so this also serves" << endl;
+		cout << "as a way of packing a directory of .charImg/.floatImg files into one file." << endl;
+		cout << endl;
+		cout << "Usage: " << endl;
+		cout << argv[0] << " <input source> <output file.imgSeq> " << endl;
+		cout << endl;
+		exit(0);
+	}
+	
+	auto sp = CreateSource( argv[1] );
+	
+	ImageSequenceWriter writer( argv[2] );
+	
+	bool done = false;
+	cv::Mat img;
+	while( !done )
+	{
+		img = sp.source->GetCurrent();
+		
+		writer.AddImage( img, sp.source->GetCurrentFrameID() );
+		
+		done = !sp.source->Advance();
+	}
+	writer.Flush();
+	
+	// read it back and check we get the same images.
+	ImageSequenceSource seq( argv[2], "none" );
+	sp.source->JumpToFrame(0);
+	seq.JumpToFrame( sp.source->GetCurrentFrameID() );
+	cv::Mat a = sp.source->GetCurrent();
+	cv::Mat b = seq.GetCurrent();
+	if( a.rows != b.rows || a.cols != b.cols || a.type() != b.type() || 
+	    memcmp( a.data, b.data, a.total() * a.elemSize() ) != 0 )
+	{
+		cout << "first image read back from " << argv[2] << " does not match the source!" << endl;
+		return 1;
+	}
+	cout << "wrote " << seq.GetNumImages() << " frames, first frame reads back ok." << endl;
+	return 0;
+}
@@ -0,0 +1,141 @@
+#include "imgio/streamCut.h"
+#include "imgio/vidIndex.h"
+#include "imgio/vidsrc.h"
+#include "imgio/vidWriter.h"
+
+#include <iostream>
+using std::cout;
+using std::endl;
+
+//
+// Check that stream copy cutting gives exactly the frames asked for from a clip made
+// with x265's default settings (as vidOut makes by default), which has open GOPs so most
+// of its keyframes are CRA pictures that can't be cut at.
+//
+// Each frame has its frame number drawn on it as a row of big black and white blocks,
+// so we can read back which frame of the source each frame of the cut is.
+//
+
+static const int W = 320;
+static const int H = 240;
+static const int BITS = 16;
+
+cv::Mat MakeFrame( unsigned fno )
+{
+	cv::Mat img( H, W, CV_8UC3 );
+
+	// something that moves, so the encoder has some work to do.
+	for( int r = 0; r < H; ++r )
+	{
+		unsigned char *p = img.ptr( r );
+		for( int c = 0; c < W; ++c, p += 3 )
+		{
+			p[0] = ( c + 3 * fno ) & 255;
+			p[1] = ( r + 2 * fno ) & 255;
+			p[2] = ( c + r + fno ) & 255;
+		}
+	}
+
+	int bw = W / BITS;
+	for( int b = 0; b < BITS; ++b )
+	{
+		unsigned char v = ( fno >> b ) & 1 ? 255 : 0;
+		img( cv::Rect( b * bw, 0, bw, 40 ) ).setTo( cv::Scalar( v, v, v ) );
+	}
+	return img;
+}
+
+int ReadFrameNumber( cv::Mat img )
+{
+	if( img.rows != H || img.cols != W )
+		return -1;
+
+	int bw = W / BITS;
+	int fno = 0;
+	for( int b = 0; b < BITS; ++b )
+	{
+		// stay away from the edges of the block, where compression smudges it.
+		cv::Scalar m = cv::mean( img( cv::Rect( b * bw + 4, 8, bw - 8, 24 ) ) );
+		if( m[1] > 128 )
+			fno |= 1 << b;
+	}
+	return fno;
+}
+
+int main( int argc, char *argv[] )
+{
+	std::string dir = "/tmp";
+	if( argc == 2 )
+		dir = argv[1];
+	std::string clip = dir + "/streamCutOpenGOP.mp4";
+	std::string cut  = dir + "/streamCutOpenGOP-cut.mp4";
+
+	// x265 puts a keyframe in at least every 250 frames, and our moving pattern
+	// gives it a few scene cuts too.
+	unsigned numFrames = 800;
+	{
+		VidWriter vw( clip, "h265", MakeFrame(0), 25, 18, "yuv420p" );
+		for( unsigned fc = 0; fc < numFrames; ++fc )
+			vw.Write( MakeFrame( fc ) );
+		vw.Flush();
+	}
+
+	VideoIndex index;
+	if( !index.Open( clip ) || index.NumFrames() != numFrames )
+	{
+		cout << "FAIL: couldn't index " << clip << endl;
+		return 1;
+	}
+
+	unsigned keyframes = 0, idrs = 0;
+	for( unsigned f = index.KeyframeAtOrAfter( 0 ); f < numFrames; f = index.KeyframeAtOrAfter( f + 1 ) )
+		++keyframes;
+	for( unsigned f = index.IDRAtOrAfter( 0 ); f < numFrames; f = index.IDRAtOrAfter( f + 1 ) )
+		++idrs;
+	cout << "clip has " << keyframes << " keyframes, of which " << idrs << " are IDR frames." << endl;
+	if( keyframes == idrs )
+	{
+		cout << "note: no open GOP keyframes in the clip, so this doesn't test much." << endl;
+	}
+
+	// a cut that starts and ends part way through GOPs, and has CRAs in the middle.
+	unsigned first = 37;
+	unsigned end   = 611;
+	if( !StreamCopyCut( clip, first, end, cut, 25, 18 ) )
+	{
+		cout << "FAIL: StreamCopyCut declined to cut " << clip << endl;
+		return 1;
+	}
+
+	VideoSource vs( cut, "none", 0 );
+	if( vs.GetNumImages() != (int)(end - first) )
+	{
+		cout << "FAIL: cut has " << vs.GetNumImages() << " frames, should have " << end - first << endl;
+		return 1;
+	}
+
+	unsigned bad = 0;
+	for( unsigned fc = 0; fc < end - first; ++fc )
+	{
+		int fno = ReadFrameNumber( vs.GetCurrent() );
+		if( fno != (int)(first + fc) )
+		{
+			if( bad < 10 )
+				cout << "frame " << fc << " of the cut is frame " << fno << " of the clip, should be " << first + fc << endl;
+			++bad;
+		}
+		if( fc + 1 < end - first && !vs.Advance() )
+		{
+			cout << "FAIL: cut ran out of frames at " << fc << endl;
+			return 1;
+		}
+	}
+
+	if( bad > 0 )
+	{
+		cout << "FAIL: " << bad << " frames of the cut are wrong." << endl;
+		return 1;
+	}
+	cout << "all " << end - first << " frames of the cut are right." << endl;
+	return 0;
+}